@@ -4,8 +4,10 @@
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/InstIterator.h"
 #include <llvm/IR/Instruction.h>
+#include <llvm/IR/Module.h>
 #include <llvm/IR/Value.h>
 
+#include <algorithm>
 #include <set>
 
 #include "dg/ADT/Queue.h"
@@ -13,6 +15,10 @@
 #include "dg/legacy/Analysis.h"
 #include "dg/legacy/BFS.h"
 #include "dg/legacy/NodesWalk.h"
+#include "dg/llvm/Cape/CapeOptions.h"
+#include "dg/llvm/Cape/Plan.h"
+#include "dg/llvm/Cape/PreloadBounds.h"
+#include "dg/llvm/Cape/SecretAnnotations.h"
 
 #ifdef ENABLE_CFG
 #include "dg/BBlock.h"
@@ -42,17 +48,23 @@ public:
                              legacy::NODES_WALK_REV_ID)),
           forward_slice(forward_slc) {}
 
-    uint16_t mark(const std::set<NodeT *> &start, uint32_t slice_id, LLVMPointerAnalysis *pta, uint16_t pass_id, uint16_t buff_id) {
+    uint16_t mark(const std::set<NodeT *> &start, uint32_t slice_id, LLVMPointerAnalysis *pta, uint16_t pass_id, uint16_t buff_id,
+                  llvmdg::InstrumentationPlan *plan, const CapeOptions &opts = CapeOptions(),
+                  llvmdg::PreloadBounds *bounds = nullptr) {
         map<BBlock<NodeT> *, set<BBlock<NodeT> *>> lm;
-        WalkData data(slice_id, this, forward_slice ? &markedBlocks : nullptr, pta, pass_id, &lm);
+        WalkData data(slice_id, this, forward_slice ? &markedBlocks : nullptr, pta, pass_id, &lm, plan, opts);
+        data.bounds = bounds;
         allocId = buff_id;
         this->walk(start, markSlice, &data);
         return allocId;
     }
 
-    uint16_t mark(NodeT *start, uint32_t slice_id, LLVMPointerAnalysis *pta, uint16_t pass_id, uint16_t buff_id) {
+    uint16_t mark(NodeT *start, uint32_t slice_id, LLVMPointerAnalysis *pta, uint16_t pass_id, uint16_t buff_id,
+                  llvmdg::InstrumentationPlan *plan, const CapeOptions &opts = CapeOptions(),
+                  llvmdg::PreloadBounds *bounds = nullptr) {
         map<BBlock<NodeT> *, set<BBlock<NodeT> *>> lm;
-        WalkData data(slice_id, this, forward_slice ? &markedBlocks : nullptr, pta, pass_id, &lm);
+        WalkData data(slice_id, this, forward_slice ? &markedBlocks : nullptr, pta, pass_id, &lm, plan, opts);
+        data.bounds = bounds;
         allocId = buff_id;
         this->walk(start, markSlice, &data);
         return allocId;
@@ -70,14 +82,16 @@ private:
     struct WalkData {
         WalkData(uint32_t si, WalkAndMark *wm,
                  std::set<BBlock<NodeT> *> *mb = nullptr, LLVMPointerAnalysis *pta = nullptr, uint16_t pi = -1,
-                 map<BBlock<NodeT> *, set<BBlock<NodeT> *>> *lm = nullptr)
+                 map<BBlock<NodeT> *, set<BBlock<NodeT> *>> *lm = nullptr,
+                 llvmdg::InstrumentationPlan *pl = nullptr,
+                 const CapeOptions &co = CapeOptions())
             : slice_id(si), analysis(wm)
 #ifdef ENABLE_CFG
               ,
               markedBlocks(mb)
 #endif
               ,
-              PTA(pta), pass_id(pi), loopMap(lm) {
+              PTA(pta), pass_id(pi), loopMap(lm), plan(pl), opts(co) {
         }
 
         uint32_t slice_id;
@@ -88,37 +102,30 @@ private:
         LLVMPointerAnalysis *PTA;
         uint16_t pass_id;
         map<BBlock<NodeT> *, set<BBlock<NodeT> *>> *loopMap;
+        // where the instrumentation goes, the IR is not changed here
+        llvmdg::InstrumentationPlan *plan;
+        CapeOptions opts;
+        // buffers (allocs and mallocs) and globals that the sensitive
+        // access being processed writes to
+        set<uint32_t> writtenBuffers;
+        set<GlobalVariable *> writtenGlobals;
+        // with CapeOptions::boundPreloads, the bytes [first, second) of
+        // the globals that the sensitive access being processed may reach
+        llvmdg::PreloadBounds *bounds{nullptr};
+        map<GlobalVariable *, std::pair<uint64_t, uint64_t>> globalBytes;
     };
 
-    // This tries to get debug info from the instruction before which a new
-    // instruction will be inserted, and if there's no debug info in that
-    // instruction, tries to get the info instead from the previous instruction (if
-    // any). If none of these has debug info and a DISubprogram is provided, it
-    // creates a dummy debug info with the first line of the function, because IR
-    // verifier requires all inlinable callsites should have debug info when both a
-    // caller and callee have DISubprogram. If none of these conditions are met,
-    // returns empty info.
-    static DebugLoc getOrCreateDebugLoc(const Instruction *InsertBefore,
-                                        DISubprogram *SP) {
-        assert(InsertBefore);
-        if (InsertBefore->getDebugLoc())
-            return InsertBefore->getDebugLoc();
-        const Instruction *Prev = InsertBefore->getPrevNode();
-        if (Prev && Prev->getDebugLoc())
-            return Prev->getDebugLoc();
-        if (SP)
-            return llvm::DILocation::get(SP->getContext(), SP->getLine(), 1, SP);
-        return DebugLoc();
+    // the progress messages, silenced by CapeOptions::quiet
+    static raw_ostream &log(const WalkData *data) {
+        return data->opts.quiet ? nulls() : errs();
     }
 
-    static void setDebugLoc(Instruction *nIns, Instruction *ins) {
-        nIns->setDebugLoc(getOrCreateDebugLoc(ins, ins->getParent()->getParent()->getSubprogram()));
-        // errs() << "set Debug Loc\n";
+    // the list of preloaded functions on stdout, also silenced by quiet
+    static raw_ostream &funcsOut(const WalkData *data) {
+        return data->opts.quiet ? nulls() : outs();
     }
 
-    static void addTransactionStart(Instruction *brInst) {
-        IRBuilder<> builder(brInst);
-        Module *M = brInst->getModule();
+    static void addTransactionStart(WalkData *data, Instruction *brInst) {
         // add “call void @startTransaction()"
         // #include <immintrin.h> // clang -c -emit-llvm *.c -mrtm -o *.bc
         // void startTransaction() {
@@ -128,15 +135,8 @@ private:
         //          exit(status);
         //      }
         //  }
-
-        auto st = M->getOrInsertFunction("_Z16startTransactionv",
-                                         FunctionType::getVoidTy(brInst->getContext()));
-        Function *stFunc = cast<Function>(st);
-        auto nCI = builder.CreateCall(stFunc);
-        errs() << "startTransaction added.\n";
-        if (!nCI->getDebugLoc()) {
-            setDebugLoc(nCI, brInst);
-        }
+        data->plan->addTransactionStart(brInst);
+        log(data) << "startTransaction added.\n";
     }
 
     static Instruction *getFuncRet(Function *F) {
@@ -151,7 +151,7 @@ private:
         return NULL;
     }
 
-    static void preloadBB(Instruction *txStart, BasicBlock *B, set<StringRef> *funcs, IRBuilder<> builder, Function *fm) {
+    static void preloadBB(WalkData *data, Instruction *txStart, BasicBlock *B, set<StringRef> *funcs) {
         assert(B && "empty block");
 
         for (auto iit = B->begin(); iit != B->end(); iit++) {
@@ -159,19 +159,13 @@ private:
                 if (auto func = CI->getCalledFunction()) {
                     auto name = func->getName();
                     if (!name.contains("llvm.dbg.") && funcs->insert(name).second) {
-                        outs() << "'" << name << "', ";
-
-                        vector<Value *> args1;
-                        args1.push_back(builder.CreateGlobalStringPtr(name));
-                        auto nCI = builder.CreateCall(fm, args1);
-                        if (!nCI->getDebugLoc()) {
-                            setDebugLoc(nCI, txStart);
-                        }
+                        funcsOut(data) << "'" << name << "', ";
+                        data->plan->addPreloadCode(txStart, name.str());
                         for (auto bit = func->begin(); bit != func->end(); bit++) {
                             // errs() << "block code preloaded\n";
                             // Taking the address of the entry block is illegal.
                             // if (&*bit != &(func->getEntryBlock()))
-                            preloadBB(txStart, &*bit, funcs, builder, fm);
+                            preloadBB(data, txStart, &*bit, funcs);
                         }
                     }
                 }
@@ -179,13 +173,16 @@ private:
         }
     }
 
-    static void preloadBlockCode(Instruction *txStart, BBlock<NodeT> *BB, set<StringRef> *funcs, IRBuilder<> builder, Function *fm) {
+    static void preloadBlockCode(WalkData *data, Instruction *txStart, BBlock<NodeT> *BB, set<StringRef> *funcs) {
+        preloadBB(data, txStart, getLLVMBlock(BB), funcs);
+    }
+
+    static BasicBlock *getLLVMBlock(BBlock<NodeT> *BB) {
         Instruction *Inst = dyn_cast<Instruction>(BB->getFirstNode()->getKey());
-        BasicBlock *B = Inst->getParent();
-        preloadBB(txStart, B, funcs, builder, fm);
+        return Inst->getParent();
     }
 
-    static void preloadTransactionCode(BBlock<NodeT> *start, BBlock<NodeT> *end) {
+    static void preloadTransactionCode(WalkData *data, BBlock<NodeT> *start, BBlock<NodeT> *end) {
         assert(start != end && "branch start and end should be different.");
         if (start->getSlice() == 777)
             return;
@@ -194,21 +191,27 @@ private:
 
         Instruction *txStart = dyn_cast<Instruction>(start->getLastNode()->getKey());
 
-        IRBuilder<> builder(txStart);
-        Module *M = txStart->getModule();
-        Instruction *Inst = dyn_cast<Instruction>(start->getFirstNode()->getKey());
-        BasicBlock *B = Inst->getParent();
-        auto c = M->getOrInsertFunction("_Z15preloadInstAddrPc", builder.getVoidTy(), builder.getInt8PtrTy());
-        Function *fm = cast<Function>(c);
+        BasicBlock *B = getLLVMBlock(start);
         auto name = B->getParent()->getName();
-        if (!name.contains("llvm.dbg.") && funcs->insert(name).second) {
-            outs() << "'" << name << "', ";
-            vector<Value *> args1;
-            args1.push_back(builder.CreateGlobalStringPtr(name));
-            auto nCI = builder.CreateCall(fm, args1);
-            if (!nCI->getDebugLoc()) {
-                setDebugLoc(nCI, txStart);
-            }
+
+        // with block-granular preloading, the enclosing function is
+        // preloaded block by block (see preloadBlock in Plan.cpp)
+        // and only the callees as a whole
+        const bool perBlock = data->opts.blockCodePreload;
+        // every block once per transaction, also the start and the end
+        // (the unified exit of the graph has no LLVM block)
+        set<BasicBlock *> preloaded;
+        auto preloadBlock = [&](BasicBlock *LB) {
+            if (LB && preloaded.insert(LB).second)
+                data->plan->addPreloadBlock(txStart, name.str(), LB);
+        };
+        if (perBlock) {
+            funcsOut(data) << "'" << name << "', ";
+            preloadBlock(B);
+            preloadBlock(getLLVMBlock(end));
+        } else if (!name.contains("llvm.dbg.") && funcs->insert(name).second) {
+            funcsOut(data) << "'" << name << "', ";
+            data->plan->addPreloadCode(txStart, name.str());
         }
 
         start->setSlice(777);
@@ -223,7 +226,9 @@ private:
 
             if (cur->getSlice() != 777) {
                 cur->setSlice(777);
-                preloadBlockCode(txStart, cur, funcs, builder, fm);
+                if (perBlock)
+                    preloadBlock(getLLVMBlock(cur));
+                preloadBlockCode(data, txStart, cur, funcs);
 
                 for (NodeT *nd : cur->getNodes()) {
                     if (nd->getSlice() == 0)
@@ -246,7 +251,7 @@ private:
         }
     }
 
-    static void addTransactionEnd(BBlock<NodeT> *BB, bool isBr) {
+    static void addTransactionEnd(WalkData *data, BBlock<NodeT> *BB, bool isBr) {
         // errs() << "start addTransactionEnd.\n";
         // getIPostDom returns immediate postDominators.
         BBlock<NodeT> *S = BB->getIPostDom();
@@ -268,23 +273,15 @@ private:
             Inst = &*it;
         }
 
-        IRBuilder<> builder(Inst);
-        Module *M = Inst->getModule();
-        auto c = M->getOrInsertFunction("_Z14endTransactionv",
-                                        FunctionType::getVoidTy(Inst->getContext()));
-        Function *xend = cast<Function>(c);
-        auto nCI = builder.CreateCall(xend);
-        errs() << "xend added.\n";
-        if (!nCI->getDebugLoc()) {
-            setDebugLoc(nCI, Inst);
-        }
+        data->plan->addTransactionEnd(Inst);
+        log(data) << "xend added.\n";
 
         if (isBr)
-            preloadTransactionCode(BB, S);
+            preloadTransactionCode(data, BB, S);
     }
 
     static void
-    addTransactionEndForLoop(BBlock<NodeT> *preh, const set<BBlock<NodeT> *> *loop, uint32_t slice_id) {
+    addTransactionEndForLoop(WalkData *data, BBlock<NodeT> *preh, const set<BBlock<NodeT> *> *loop, uint32_t slice_id) {
         auto curB = preh;
         while (curB && (curB = curB->getIPostDom())) {
             if (curB == NULL || loop->count(curB) == 0) {
@@ -301,18 +298,10 @@ private:
                 it++;
                 Inst = &*it;
             }
-            IRBuilder<> builder(Inst);
-            Module *M = Inst->getModule();
-            auto c = M->getOrInsertFunction("_Z14endTransactionv",
-                                            FunctionType::getVoidTy(Inst->getContext()));
-            Function *xend = cast<Function>(c);
-            auto nCI = builder.CreateCall(xend);
-            errs() << "xend added for loop.\n";
-            if (!nCI->getDebugLoc()) {
-                setDebugLoc(nCI, Inst);
-            }
+            data->plan->addTransactionEnd(Inst);
+            log(data) << "xend added for loop.\n";
         }
-        preloadTransactionCode(preh, curB);
+        preloadTransactionCode(data, preh, curB);
     }
 
     template <typename IT>
@@ -341,64 +330,91 @@ private:
         return false;
     }
 
+    // Is the operand of a sensitive access (as numbered in
+    // handlePreloadingForSensitiveAccesses) written by the access?
+    static bool isWrittenOperand(Instruction *Inst, unsigned id) {
+        if (Inst->getOpcode() == Instruction::Store)
+            return id == 1;
+        if (CallInst *CI = dyn_cast<CallInst>(Inst)) {
+            // the destination of memcpy and memset
+            if (Function *fun = CI->getCalledFunction())
+                return id == 0 && (fun->getName().startswith("llvm.memcpy") ||
+                                   fun->getName().startswith("llvm.memset"));
+        }
+        return false;
+    }
+
+    // The bytes that the operand id of the access reads or writes
+    // (0 - unknown, e.g., a memcpy of a variable length).
+    static uint64_t getAccessSize(Instruction *Inst, unsigned id) {
+        const DataLayout &DL = Inst->getModule()->getDataLayout();
+        if (auto *LI = dyn_cast<LoadInst>(Inst))
+            return DL.getTypeStoreSize(LI->getType());
+        if (auto *SI = dyn_cast<StoreInst>(Inst))
+            return id == 1 ? DL.getTypeStoreSize(SI->getValueOperand()->getType()) : 0;
+        if (CallInst *CI = dyn_cast<CallInst>(Inst)) {
+            // the length of memcpy and memset
+            if (CI->getNumArgOperands() > 2) {
+                if (auto *len = dyn_cast<ConstantInt>(CI->getArgOperand(2)))
+                    return len->getZExtValue();
+            }
+        }
+        return 0;
+    }
+
+    static uint64_t getGlobalSize(GlobalVariable *gv) {
+        return gv->getParent()->getDataLayout().getTypeAllocSize(gv->getValueType());
+    }
+
+    // Add the bytes of gv that the access may reach to the bytes that
+    // the transaction preloads.
+    static void addGlobalBytes(WalkData *data, Instruction *Inst, unsigned id, const Offset &offset,
+                               GlobalVariable *gv, uint64_t len) {
+        auto bytes = data->bounds->getAccessedBytes(Inst, Inst->getOperand(id), offset, gv, len);
+        auto it = data->globalBytes.find(gv);
+        if (it == data->globalBytes.end()) {
+            data->globalBytes.emplace(gv, bytes);
+        } else {
+            it->second.first = std::min(it->second.first, bytes.first);
+            it->second.second = std::max(it->second.second, bytes.second);
+        }
+    }
+
     static void
-    addPreLoad(Instruction *Inst, Value *lVals[], const set<uint32_t> &allocs, const set<uint32_t> &mallocs, const set<GlobalVariable *> &globals) {
+    addPreLoad(WalkData *data, Instruction *Inst, Value *lVals[], const set<uint32_t> &allocs, const set<uint32_t> &mallocs, const set<GlobalVariable *> &globals) {
         (void)lVals;
-        IRBuilder<> builder(Inst);
+        const bool writeIntent = data->opts.writeIntent;
         /*
                 for (auto lval : lVals) {
                     // pre-load locals
                     builder.CreateLoad(lval);
                 }*/
 
-        Module *M = Inst->getModule();
-        auto c = M->getOrInsertFunction("_Z17iterateAllocStacki", builder.getVoidTy(),
-                                        builder.getInt32Ty());
-        Function *lm = cast<Function>(c);
         for (auto i : allocs) {
             // pre-load non-local allocs
-            vector<Value *> args1;
-            args1.push_back(builder.getInt32(i));
-            // errs() << "load bid " << bid << "\n";
-            auto nCI = builder.CreateCall(lm, args1);
-            if (!nCI->getDebugLoc()) {
-                setDebugLoc(nCI, Inst);
-            }
+            data->plan->addPreloadAlloc(Inst, i, writeIntent && data->writtenBuffers.count(i));
         }
 
-        c = M->getOrInsertFunction("_Z16iterateMallocSeti", builder.getVoidTy(), builder.getInt32Ty());
-        lm = cast<Function>(c);
         for (auto i : mallocs) {
             // pre-load non-local allocs
-            vector<Value *> args1;
-            args1.push_back(builder.getInt32(i));
-            // errs() << "load bid " << bid << "\n";
-            auto nCI = builder.CreateCall(lm, args1);
-            if (!nCI->getDebugLoc()) {
-                setDebugLoc(nCI, Inst);
-            }
+            data->plan->addPreloadMalloc(Inst, i, writeIntent && data->writtenBuffers.count(i));
         }
 
-        c = M->getOrInsertFunction("_Z13iterateGlobaliPv", builder.getVoidTy(), builder.getInt32Ty(),
-                                   builder.getInt8PtrTy());
-        lm = cast<Function>(c);
         for (auto gv : globals) {
             // pre-load globals
-            vector<Value *> args1;
-            Type *T = gv->getValueType();
-            int size = M->getDataLayout().getTypeAllocSize(T); // # Byte
-            // errs() << "Global type size in bytes: " << size << "\n";
-            args1.push_back(builder.getInt32(size));
-            Value *pv = builder.CreateBitCast(gv, builder.getInt8PtrTy());
-            args1.push_back(pv);
-            auto nCI = builder.CreateCall(lm, args1);
-            if (!nCI->getDebugLoc()) {
-                setDebugLoc(nCI, Inst);
+            const bool write = writeIntent && data->writtenGlobals.count(gv);
+            auto bytes = data->globalBytes.find(gv);
+            if (bytes != data->globalBytes.end() &&
+                bytes->second.second - bytes->second.first < getGlobalSize(gv)) {
+                data->plan->addPreloadGlobal(Inst, gv, write, bytes->second.first,
+                                             bytes->second.second - bytes->second.first);
+            } else {
+                data->plan->addPreloadGlobal(Inst, gv, write);
             }
         }
     }
 
-    static void processHighestBr(NodeT *bn, uint32_t slice_id, Value *lVals[], const set<uint32_t> &allocs, const set<uint32_t> &mallocs, const set<GlobalVariable *> &globals) {
+    static void processHighestBr(WalkData *data, NodeT *bn, uint32_t slice_id, Value *lVals[], const set<uint32_t> &allocs, const set<uint32_t> &mallocs, const set<GlobalVariable *> &globals) {
         Instruction *Inst = dyn_cast<Instruction>(bn->getKey());
         BasicBlock::iterator it(Inst);
         while (Inst->getOpcode() == Instruction::PHI) {
@@ -411,14 +427,14 @@ private:
                 return;
             }
             CD->setSlice(slice_id);
-            addTransactionStart(Inst);
-            addTransactionEnd(CD, Inst->getOpcode() == Instruction::Br);
+            addTransactionStart(data, Inst);
+            addTransactionEnd(data, CD, Inst->getOpcode() == Instruction::Br);
         }
-        addPreLoad(Inst, lVals, allocs, mallocs, globals);
+        addPreLoad(data, Inst, lVals, allocs, mallocs, globals);
     }
 
     static void
-    placeTransForLoop(NodeT *bn, const set<BBlock<NodeT> *> *blks, uint32_t slice_id, Value *lVals[], const set<uint32_t> &allocs, const set<uint32_t> &mallocs, const set<GlobalVariable *> &globals) {
+    placeTransForLoop(WalkData *data, NodeT *bn, const set<BBlock<NodeT> *> *blks, uint32_t slice_id, Value *lVals[], const set<uint32_t> &allocs, const set<uint32_t> &mallocs, const set<GlobalVariable *> &globals) {
         // Instruction *Inst = dyn_cast<Instruction>(bn->getKey());
         BBlock<NodeT> *CD = bn->getBBlock();
         // pre-header found
@@ -431,20 +447,20 @@ private:
                 return;
             }
             node->setSlice(888);
-            addTransactionStart(sInst);
-            addTransactionEndForLoop(S, blks, slice_id);
+            addTransactionStart(data, sInst);
+            addTransactionEndForLoop(data, S, blks, slice_id);
         }
-        addPreLoad(sInst, lVals, allocs, mallocs, globals);
+        addPreLoad(data, sInst, lVals, allocs, mallocs, globals);
     }
 
     static bool
-    processBBlockIDomsAndNodeRevCDs(BBlock<NodeT> *BB, NodeT *ND, uint32_t slice_id, Value *lVals[], const set<uint32_t> &allocs, const set<uint32_t> &mallocs, const set<GlobalVariable *> &globals, bool isLoop, const set<BBlock<NodeT> *> *blks) {
+    processBBlockIDomsAndNodeRevCDs(WalkData *data, BBlock<NodeT> *BB, NodeT *ND, uint32_t slice_id, Value *lVals[], const set<uint32_t> &allocs, const set<uint32_t> &mallocs, const set<GlobalVariable *> &globals, bool isLoop, const set<BBlock<NodeT> *> *blks) {
         BBlock<NodeT> *CD = NULL;
         if (BB && BB->getSlice() > 0) {
             CD = BB->getIDom();
             if (CD && CD->getSlice() > 0) {
                 // find the top-level br.
-                if (processBBlockIDomsAndNodeRevCDs(CD, NULL, slice_id, lVals, allocs, mallocs, globals, isLoop, blks)) {
+                if (processBBlockIDomsAndNodeRevCDs(data, CD, NULL, slice_id, lVals, allocs, mallocs, globals, isLoop, blks)) {
                     return true;
                 }
             }
@@ -462,7 +478,7 @@ private:
                     auto *bb = node->getBBlock();
                     //errs() << bb << ": get inst bb\n";
                     //errs() << "get sensitive inst bb\n";
-                    if (processBBlockIDomsAndNodeRevCDs(bb, node, slice_id, lVals, allocs, mallocs, globals, isLoop, blks)) {
+                    if (processBBlockIDomsAndNodeRevCDs(data, bb, node, slice_id, lVals, allocs, mallocs, globals, isLoop, blks)) {
                         return true;
                     }
                 }
@@ -487,7 +503,7 @@ private:
                 // }
                 //errs() << bb << ": get inst bb\n";
                 //errs() << "get sensitive inst bb\n";
-                if (processBBlockIDomsAndNodeRevCDs(bb, node, slice_id, lVals, allocs, mallocs, globals, isLoop, blks)) {
+                if (processBBlockIDomsAndNodeRevCDs(data, bb, node, slice_id, lVals, allocs, mallocs, globals, isLoop, blks)) {
                     return true;
                 }
             }
@@ -501,7 +517,7 @@ private:
                 // find the immediate br
                 if (Inst && Inst->getOpcode() == Instruction::Br) {
                     // errs() << "br sid: " << last->getSlice() << "\n";
-                    processHighestBr(last, slice_id, lVals, allocs, mallocs, globals);
+                    processHighestBr(data, last, slice_id, lVals, allocs, mallocs, globals);
                     return true;
                 }
             }
@@ -511,7 +527,7 @@ private:
     }
 
     static bool
-    processBBlockRevCDs(bool isLoop, bool addDep, BBlock<NodeT> *BB, const set<BBlock<NodeT> *> *blks,
+    processBBlockRevCDs(WalkData *data, bool isLoop, bool addDep, BBlock<NodeT> *BB, const set<BBlock<NodeT> *> *blks,
                         uint32_t slice_id, Value *lVals[], const set<uint32_t> &allocs, const set<uint32_t> &mallocs, const set<GlobalVariable *> &globals) {
         if (!BB)
             return false;
@@ -538,10 +554,10 @@ private:
                 if (Inst && Inst->getOpcode() == Instruction::Br) {
                     // dbgs() << "the immediate br found: " << *Inst << "\n";
                     // look for highest br
-                    if (!processBBlockIDomsAndNodeRevCDs(CD, NULL, slice_id, lVals, allocs, mallocs, globals, isLoop, blks)) {
+                    if (!processBBlockIDomsAndNodeRevCDs(data, CD, NULL, slice_id, lVals, allocs, mallocs, globals, isLoop, blks)) {
                         // errs() << "use the immediate br as highest\n";
                         //errs() << "1 br sid: " << last->getSlice() << "\n";
-                        processHighestBr(last, slice_id, lVals, allocs, mallocs, globals);
+                        processHighestBr(data, last, slice_id, lVals, allocs, mallocs, globals);
                     }
                     // it should be true that one block only have one sensitive br
                     return true;
@@ -567,7 +583,7 @@ private:
             // }
             //errs() << bb << ": get inst bb\n";
             //errs() << "get sensitive inst bb\n";
-            if (processBBlockIDomsAndNodeRevCDs(bb, node, slice_id, lVals, allocs, mallocs, globals, isLoop, blks)) {
+            if (processBBlockIDomsAndNodeRevCDs(data, bb, node, slice_id, lVals, allocs, mallocs, globals, isLoop, blks)) {
                 return true;
             }
         }
@@ -575,28 +591,15 @@ private:
         // never find a immediate br: add transaction as per the current block
         if (isLoop) {
             // BB->setSlice(slice_id);
-            placeTransForLoop(BB->getFirstNode(), blks, slice_id, lVals, allocs, mallocs, globals);
+            placeTransForLoop(data, BB->getFirstNode(), blks, slice_id, lVals, allocs, mallocs, globals);
         } else if (addDep) {
             // errs() << "handle address dependency\n";
             // BB->setSlice(slice_id);
-            processHighestBr(BB->getFirstNode(), slice_id, lVals, allocs, mallocs, globals);
+            processHighestBr(data, BB->getFirstNode(), slice_id, lVals, allocs, mallocs, globals);
         }
         return false;
     }
 
-    inline static uint64_t getConstantValue(const Value *op) {
-        uint64_t size = 0;
-        if (const ConstantInt *C = dyn_cast<ConstantInt>(op)) {
-            size = C->getLimitedValue();
-            // if the size cannot be expressed as an uint64_t,
-            // just set it to 0 (that means unknown)
-            if (size == ~(static_cast<uint64_t>(0)))
-                size = 0;
-        }
-
-        return size;
-    }
-
     // static set<BBlock<NodeT>*> collectLoopBlks(BBlock<NodeT> *header, BBlock<NodeT> *hpred, WalkData *data) {
     static set<BBlock<NodeT> *> collectLoopBlks(BBlock<NodeT> *header, BBlock<NodeT> *hpred) {
         // map<BBlock<NodeT>*, set<BBlock<NodeT>*>> loopMap = *(data->loopMap);
@@ -702,7 +705,6 @@ private:
                                          uint32_t slice_id, Value *lVals[], set<uint32_t> &allocs, set<uint32_t> &mallocs, set<GlobalVariable *> &globals, unsigned opIdx) {
         (void)lVals;
         DependenceGraph<NodeT> *dg = n->getDG();
-        Module *M = Inst->getModule();
         vector<int> vect;
         if (opIdx <= 1) {
             vect.push_back(opIdx);
@@ -711,8 +713,9 @@ private:
             vect.push_back(1);
         }
         // vect.push_back(0);
-        auto sec = new StringRef("secret");
         for (auto id : vect) {
+            const bool written = isWrittenOperand(Inst, id);
+            const uint64_t len = getAccessSize(Inst, id);
             PSNode *pts = PTA->getPointsToNode(Inst->getOperand(id));
             for (const auto &ptr : pts->pointsTo) {
                 Value *vl = ptr.target->getUserData<Value>();
@@ -720,10 +723,15 @@ private:
                     // errs() << "NULL pt value at a " << (opIdx==0?"load":"store") << "\n";
                     continue;
                 }
+                // an annotated local or the bytes of an annotated field
+                if (!isa<GlobalVariable>(vl) && llvmdg::mayHoldSecret(vl, ptr.offset, len)) {
+                    log(data) << "sec as an operand of a (opIdx: " << id << ")\n";
+                    return;
+                }
                 GlobalVariable *gv;
                 if ((gv = dyn_cast<GlobalVariable>(vl)) && !gv->getName().contains("ecc_sets")) {
-                    if (gv->hasAttribute(*sec)) {
-                        errs() << "sec as an operand of a (opIdx: " << id << ")\n";
+                    if (llvmdg::mayHoldSecret(gv, ptr.offset, len)) {
+                        log(data) << "sec as an operand of a (opIdx: " << id << ")\n";
                         return;
                     }
 
@@ -734,6 +742,10 @@ private:
                     }
 
                     globals.insert(gv);
+                    if (written)
+                        data->writtenGlobals.insert(gv);
+                    if (data->bounds)
+                        addGlobalBytes(data, Inst, id, ptr.offset, gv, len);
 
                     if (gv->getName().contains("ecc_sets")) {
                         DILocation *loc = Inst->getDebugLoc();
@@ -760,46 +772,17 @@ private:
                             iit--;
                             errs() << "reached end of a block for AI\n";
                         }
-                        IRBuilder<> builder(&*iit);
-
-                        auto c = M->getOrInsertFunction("_Z14pushAllocStackiliPv", builder.getVoidTy(),
-                                                        builder.getInt32Ty(), builder.getInt64Ty(),
-                                                        builder.getInt32Ty(),
-                                                        builder.getInt8PtrTy()); //Type::getInt8PtrTy(ct)
-                        Function *fm = cast<Function>(c);
-
-                        vector<Value *> args1;
-                        args1.push_back(builder.getInt32(bid));
-                        Value *arraySize = AI->getArraySize();
-                        Value *as = builder.CreateIntCast(arraySize, builder.getInt64Ty(), false);
-                        args1.push_back(as);
-                        Type *T = AI->getAllocatedType();
-                        int size = M->getDataLayout().getTypeAllocSize(T); // # Byte
-                        args1.push_back(builder.getInt32(size));           // elem size in bytes
-                        Value *pv = builder.CreateBitCast(vl, builder.getInt8PtrTy());
-                        args1.push_back(pv);
-
-                        auto nCI = builder.CreateCall(fm, args1);
-                        if (!nCI->getDebugLoc()) {
-                            setDebugLoc(nCI, &*iit);
-                        }
+                        // the buffer id, the number and size (bytes) of the elements
+                        data->plan->addPushAlloc(&*iit, bid, AI);
                         // we need ret of AI's func rather than n's
                         // if (Instruction *ret = getFuncRet(n->getBBlock())) {
-                        if (Instruction *ret = getFuncRet(AI->getFunction())) {
-                            IRBuilder<> retBld(ret);
-                            auto c = M->getOrInsertFunction("_Z13popAllocStacki", builder.getVoidTy(),
-                                                            builder.getInt32Ty()); //Type::getInt8PtrTy(ct)
-                            Function *fm = cast<Function>(c);
-                            vector<Value *> args1;
-                            args1.push_back(builder.getInt32(bid));
-                            auto nCI = retBld.CreateCall(fm, args1);
-                            if (!nCI->getDebugLoc()) {
-                                setDebugLoc(nCI, ret);
-                            }
-                        }
+                        if (Instruction *ret = getFuncRet(AI->getFunction()))
+                            data->plan->addPopAlloc(ret, bid);
                     }
                     // assert(bid < 100 && "bid overflown");
                     allocs.insert(bid);
+                    if (written)
+                        data->writtenBuffers.insert(bid);
                     // errs() << "adding allocs bid " << bid << "\n";
                 }
                 if (CallInst *CI = dyn_cast<CallInst>(vl)) {
@@ -821,28 +804,13 @@ private:
                                 iit--;
                                 errs() << "reached end of a block for CI\n";
                             }
-                            IRBuilder<> builder(&*iit);
-                            auto c = M->getOrInsertFunction("_Z15insertMallocSetiiPv", builder.getVoidTy(),
-                                                            builder.getInt32Ty(), builder.getInt32Ty(),
-                                                            builder.getInt8PtrTy()); //Type::getInt8PtrTy(ct)
-                            Function *fm = cast<Function>(c);
-
-                            vector<Value *> args1;
-                            args1.push_back(builder.getInt32(bid));
-
-                            Value *op = CI->getOperand(0);
-                            int size = getConstantValue(op); // # Byte
-                            // errs() << "malloc size: " << size/4 << "\n";
-                            args1.push_back(builder.getInt32(size)); // bytes
-                            Value *pv = builder.CreateBitCast(vl, builder.getInt8PtrTy());
-                            args1.push_back(pv);
-                            auto nCI = builder.CreateCall(fm, args1);
-                            if (!nCI->getDebugLoc()) {
-                                setDebugLoc(nCI, &*iit);
-                            }
+                            // the size of the buffer in bytes (0 if unknown)
+                            data->plan->addInsertMalloc(&*iit, bid, CI);
                         }
                         // assert(bid < 100 && "bid overflown");
                         mallocs.insert(bid);
+                        if (written)
+                            data->writtenBuffers.insert(bid);
                         // errs() << "adding mallocs bid " << bid << "\n";
                     }
                 }
@@ -862,19 +830,19 @@ private:
                 return false;
             if (Inst && (Inst->getOpcode() == Instruction::Load || Inst->getOpcode() == Instruction::Store)) {
                 unsigned opIdx = Inst->getOpcode() == Instruction::Load ? 0 : 1;
+                const uint64_t len = getAccessSize(Inst, opIdx);
                 PSNode *pts = PTA->getPointsToNode(Inst->getOperand(opIdx));
-                auto sec = new StringRef("secret");
                 for (const auto &ptr : pts->pointsTo) {
                     Value *vl = ptr.target->getUserData<Value>();
                     if (vl == NULL) {
                         continue;
                     }
 
-                    if (GlobalVariable *gv = dyn_cast<GlobalVariable>(vl)) {
-                        if (gv->hasAttribute(*sec)) {
-                            errs() << "sec as an operand of a " << (opIdx == 0 ? "load" : "store") << "\n";
-                            return false;
-                        }
+                    // the secret global or local itself, or the bytes of
+                    // a secret field (not the other fields of its object)
+                    if (llvmdg::mayHoldSecret(vl, ptr.offset, len)) {
+                        log(data) << "sec as an operand of a " << (opIdx == 0 ? "load" : "store") << "\n";
+                        return false;
                     }
                 }
             } else if (Inst && Inst->getOpcode() == Instruction::Br) {
@@ -884,7 +852,7 @@ private:
                 getBrLoopBlocks(blks, B, data, header);
                 if (blks.count(B) && isCondExit(B, &blks)) {
                     assert(header && "empty loop header");
-                    errs() << "conditional exit of a loop\n";
+                    log(data) << "conditional exit of a loop\n";
                     for (auto blk : blks) {
                         // no need to setSlice explicitely: blk->setSlice(slice_id);
                         // errs()<<"loop blk\n";
@@ -941,6 +909,9 @@ private:
         set<uint32_t> allocs;
         set<uint32_t> mallocs;
         set<GlobalVariable *> globals;
+        data->writtenBuffers.clear();
+        data->writtenGlobals.clear();
+        data->globalBytes.clear();
         if (pass_id == 2 &&
             (Inst->getOpcode() == Instruction::Load || Inst->getOpcode() == Instruction::Store)) {
             unsigned OpIdx = Inst->getOpcode() == Instruction::Load ? 0 : 1;
@@ -952,7 +923,7 @@ private:
             }
             // if (!globals.empty()) {errs() << "addDep " << addDep << "\n";}
             // errs() << *Inst << "$$$$$$$$$$\n";
-            processBBlockRevCDs(false, addDep, n->getBBlock(), NULL, slice_id + 4, NULL, allocs, mallocs, globals);
+            processBBlockRevCDs(data, false, addDep, n->getBBlock(), NULL, slice_id + 4, NULL, allocs, mallocs, globals);
         } else if (pass_id == 1 && Inst->getOpcode() == Instruction::Br) {
             BBlock<NodeT> *B = n->getBBlock();
             BBlock<NodeT> *header;
@@ -960,7 +931,7 @@ private:
             getBrLoopBlocks(blks, B, data, header);
             if (blks.count(B) && isCondExit(B, &blks)) {
                 assert(header && "empty loop header2");
-                errs() << "conditional exit of a loop2\n";
+                log(data) << "conditional exit of a loop2\n";
                 for (auto blk : blks) {
                     for (NodeT *nd : blk->getNodes()) {
                         Instruction *ndInst = dyn_cast<Instruction>(nd->getKey());
@@ -973,7 +944,7 @@ private:
                     }
                     // errs() << "iter blk_2 " << blk << " " << blks->size() << " "<< blks->count(blk) << "\n";
                 }
-                processBBlockRevCDs(true, false, header, &blks, slice_id + 4, NULL, allocs, mallocs, globals);
+                processBBlockRevCDs(data, true, false, header, &blks, slice_id + 4, NULL, allocs, mallocs, globals);
             }
         } else if (CallInst *CI = dyn_cast<CallInst>(Inst)) {
             Function *fun = CI->getCalledFunction();
@@ -997,7 +968,7 @@ private:
                 }
 
                 // if (!globals.empty()) {errs() << "addDep " << addDep << "\n";}
-                processBBlockRevCDs(false, addDep, n->getBBlock(), NULL, slice_id + 4, NULL, allocs, mallocs,
+                processBBlockRevCDs(data, false, addDep, n->getBBlock(), NULL, slice_id + 4, NULL, allocs, mallocs,
                                     globals);
 
             } else if (fname.equals("llvm.memset.p0i8.i64")) {
@@ -1009,7 +980,7 @@ private:
                     addDep = checkAddressDependency(n->user_begin(), n->user_end(), CI->getOperand(0), slice_id + 3);
                 }
                 // if (!globals.empty()) {errs() << "addDep " << addDep << "\n";}
-                processBBlockRevCDs(false, addDep, n->getBBlock(), NULL, slice_id + 4, NULL, allocs, mallocs,
+                processBBlockRevCDs(data, false, addDep, n->getBBlock(), NULL, slice_id + 4, NULL, allocs, mallocs,
                                     globals);
             }
         }
@@ -1034,6 +1005,9 @@ template <typename NodeT>
 class Slicer : legacy::Analysis<NodeT> {
     uint32_t options;
     uint32_t slice_id;
+    CapeOptions cape_options;
+    llvmdg::InstrumentationPlan plan;
+    llvmdg::PreloadBounds *preloadBounds{nullptr};
 
     std::set<DependenceGraph<NodeT> *> sliced_graphs;
 
@@ -1085,23 +1059,15 @@ public:
     SlicerStatistics &getStatistics() { return statistics; }
     const SlicerStatistics &getStatistics() const { return statistics; }
 
-    DebugLoc getOrCreateDebugLoc(const Instruction *InsertBefore,
-                                 DISubprogram *SP) {
-        assert(InsertBefore);
-        if (InsertBefore->getDebugLoc())
-            return InsertBefore->getDebugLoc();
-        const Instruction *Prev = InsertBefore->getPrevNode();
-        if (Prev && Prev->getDebugLoc())
-            return Prev->getDebugLoc();
-        if (SP)
-            return llvm::DILocation::get(SP->getContext(), SP->getLine(), 1, SP);
-        return DebugLoc();
-    }
+    void setCapeOptions(const CapeOptions &opts) { cape_options = opts; }
+    const CapeOptions &getCapeOptions() const { return cape_options; }
 
-    void setDebugLoc(Instruction *nIns, Instruction *ins) {
-        nIns->setDebugLoc(getOrCreateDebugLoc(ins, ins->getParent()->getParent()->getSubprogram()));
-        // errs() << "set Debug Loc\n";
-    }
+    // the ranges of the preloaded globals (CapeOptions::boundPreloads)
+    void setPreloadBounds(llvmdg::PreloadBounds *bounds) { preloadBounds = bounds; }
+
+    // the instrumentation that the marking passes decided on
+    llvmdg::InstrumentationPlan &getPlan() { return plan; }
+    const llvmdg::InstrumentationPlan &getPlan() const { return plan; }
 
     void handleFreeFunc(const vector<CallInst *> *allFreeCalls, LLVMPointerAnalysis *PTA) {
         for (CallInst *CI : *allFreeCalls) {
@@ -1124,24 +1090,9 @@ public:
                         Function *mFunc = mCI->getCalledFunction();
                         if (mFunc && mFunc->getName().equals("malloc")) {
                             uint32_t bid = ptr.target->getBufferId();
-                            errs() << "get malloc for free: " << bid << "\n";
-                            if (ptr.target->isBuffered()) {
-                                Module *M = CI->getModule();
-                                IRBuilder<> builder(CI);
-                                auto c = M->getOrInsertFunction("_Z14eraseMallocSetiPv",
-                                                                builder.getInt1Ty(), builder.getInt32Ty(),
-                                                                builder.getInt8PtrTy());
-                                Function *fm = cast<Function>(c);
-
-                                vector<Value *> args1;
-                                args1.push_back(builder.getInt32(bid));
-                                Value *pv = builder.CreateBitCast(op, builder.getInt8PtrTy());
-                                args1.push_back(pv);
-                                auto nCI = builder.CreateCall(fm, args1);
-                                if (!nCI->getDebugLoc()) {
-                                    setDebugLoc(nCI, CI);
-                                }
-                            }
+                            (cape_options.quiet ? nulls() : errs()) << "get malloc for free: " << bid << "\n";
+                            if (ptr.target->isBuffered())
+                                plan.addEraseMalloc(CI, bid);
                         }
                     }
                 }
@@ -1156,7 +1107,7 @@ public:
             sl_id = 1;
 
         WalkAndMark<NodeT> wm(forward_slice);
-        buff_id = wm.mark(start, sl_id, pta, pass_id, buff_id);
+        buff_id = wm.mark(start, sl_id, pta, pass_id, buff_id, &plan, cape_options, preloadBounds);
 
         ///
         // If we are performing forward slicing,
@@ -1195,7 +1146,7 @@ public:
             sl_id = ++slice_id;
 
         WalkAndMark<NodeT> wm(forward_slice);
-        int buff_id = wm.mark(start, sl_id, NULL, 0, 0);
+        int buff_id = wm.mark(start, sl_id, NULL, 0, 0, &plan, cape_options);
 
         ///
         // If we are performing forward slicing,
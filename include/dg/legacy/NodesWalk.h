@@ -3,6 +3,7 @@
 
 #include "dg/DGParameters.h"
 #include "dg/legacy/Analysis.h"
+#include "dg/llvm/Cape/SecretAnnotations.h"
 
 #include "llvm/IR/DebugInfoMetadata.h"
 
@@ -259,7 +260,6 @@ private:
                     if (auto *stInst = llvm::dyn_cast<llvm::StoreInst>(cv)) {
                         unsigned opIdx = 0;
                         PSNode *pts = PTA->getPointsToNode(stInst->getOperand(opIdx));
-                        auto sec = new llvm::StringRef("secret");
                         bool adTaken = false;
                         for (const auto &ptr : pts->pointsTo) {
                             auto *vl = ptr.target->getUserData<llvm::Value>();
@@ -267,7 +267,8 @@ private:
                                 continue;
                             }
 
-                            if (llvm::GlobalVariable *gv = llvm::dyn_cast<llvm::GlobalVariable>(vl); gv && gv->hasAttribute(*sec)) {
+                            // the address of the secret bytes
+                            if (llvmdg::mayHoldSecret(vl, ptr.offset, 1)) {
 #ifdef _DEBUG_
                                 llvm::errs() << "address-taking at sec\n";
 #endif
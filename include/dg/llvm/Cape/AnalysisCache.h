@@ -0,0 +1,83 @@
+#ifndef DG_LLVM_CAPE_ANALYSIS_CACHE_H_
+#define DG_LLVM_CAPE_ANALYSIS_CACHE_H_
+
+#include <map>
+#include <set>
+#include <string>
+
+namespace llvm {
+class Function;
+} // namespace llvm
+
+namespace dg {
+
+class LLVMDependenceGraph;
+class LLVMPointerAnalysis;
+
+namespace llvmdg {
+
+///
+// What the previous runs of llvm-dg-dump learned about every function
+// (llvm-dg-dump -cache FILE), so that the dependence graph is built only
+// for what the secrets reach.
+//
+// Every function reachable from entry gets a structural hash of its
+// instructions and of the globals that it uses (ignoring the debug info
+// and value names). A function that hashes the same as in the cache is
+// a hit, unless a changed (or new) function may affect it: the changed
+// functions, their transitive callers and callees, and the functions
+// that access the memory objects (by PTA) that a changed function
+// accesses, with their callers, are misses and get the graph. A changed
+// function that may access unknown memory makes all functions misses.
+//
+// A hit whose nodes the graph marked none of the last time does not
+// touch the secrets now either, and the graph leaves it out like
+// -secret-scope does. The hits with marked nodes get the graph together
+// with their callees and their callers.
+//
+// The pointer analysis is still computed for the whole module: its
+// result is a fixpoint over all the functions that cannot be resumed
+// from per-function summaries.
+class AnalysisCache {
+  public:
+    struct Entry {
+        std::string hash;
+        // the nodes that the graph marked (0 - untouched by the secrets)
+        unsigned marked{0};
+    };
+
+    // The version of the cache format. The first line of the file is
+    // "cape-cache <version>", the second "key <key>", followed by one
+    // line per function: <hash> <marked nodes> <name>
+    static constexpr unsigned version = 2;
+
+    // Read the cache of a previous run. The key describes the options
+    // of the run; the cache of a different key (or a missing file) is
+    // empty. Returns false (and reports why) if the file is malformed.
+    bool load(const std::string &file, const std::string &key);
+    // Returns false (and reports why) if the file cannot be written.
+    bool save(const std::string &file) const;
+
+    // Hash the functions reachable from entry (the indirect calls are
+    // resolved by PTA) and get the functions that need the graph.
+    std::set<const llvm::Function *> getScope(LLVMPointerAnalysis *PTA,
+                                              const llvm::Function *entry);
+
+    // Remember the marked nodes of the functions in the graph.
+    void update(LLVMDependenceGraph *dg);
+
+    unsigned getHits() const { return hits; }
+    unsigned getMisses() const { return misses; }
+
+  private:
+    std::string key;
+    // by the function name
+    std::map<std::string, Entry> entries;
+    unsigned hits{0};
+    unsigned misses{0};
+};
+
+} // namespace llvmdg
+} // namespace dg
+
+#endif
@@ -0,0 +1,90 @@
+#ifndef DG_LLVM_CAPE_OPTIONS_H_
+#define DG_LLVM_CAPE_OPTIONS_H_
+
+#include <string>
+#include <vector>
+
+namespace dg {
+
+///
+// Options that drive how Cape instruments the module once the
+// secret-dependent nodes have been marked.
+struct CapeOptions {
+    // Preload only the code of the basic blocks that can execute
+    // inside a transaction instead of the whole enclosing function.
+    // Callees are still preloaded as whole functions.
+    bool blockCodePreload{false};
+
+    // Move the functions that execute inside transactions into one
+    // contiguous, line-aligned section (see CodeLayout.h).
+    bool clusterCode{false};
+    const char *codeSection{"cape_text"};
+    unsigned codeAlignment{64};
+
+    // Move the globals that are preloaded into transactions into
+    // dedicated sections and align them to cache lines (or to
+    // dataAlignment if they are at least that big), see GlobalsLayout.h.
+    bool packGlobals{false};
+    const char *dataSection{"cape_data"};
+    const char *rodataSection{"cape_rodata"};
+    unsigned lineSize{64};
+    unsigned dataAlignment{64};
+    // Also make the data sections start and end at huge page
+    // boundaries so that the runtime can back them (and the heap
+    // arenas) with huge pages (CAPE_HUGE_PAGES in samples/common.h).
+    bool hugePages{false};
+    unsigned hugePageSize{2 << 20};
+
+    // Serve the sensitive malloc sites from per-buffer-id arenas
+    // so that their objects can be preloaded as one range,
+    // see HeapArena.h.
+    bool heapArena{false};
+
+    // Repeat the preloads of each transaction before its xbegin,
+    // outside of the transaction, see WarmUp.h.
+    bool warmUp{false};
+
+    // Preload the objects that a transaction writes to with write
+    // intent, so that their lines are in the write set from the start.
+    bool writeIntent{false};
+
+    // Preload only the bytes of the globals that the sensitive accesses
+    // may reach (e.g., the part of a table that a few secret bits index),
+    // bounded by the known bits and value relations of their indices,
+    // see PreloadBounds.h.
+    bool boundPreloads{false};
+
+    // Replace small secret-dependent branches by constant-time
+    // selects instead of transactions, see IfConversion.h.
+    bool ifConvert{false};
+    unsigned ifConvertMaxInsts{8};
+
+    // Move the secret-independent instructions out of the
+    // transactions, before xbegin or after xend, see Hoisting.h.
+    bool hoist{false};
+
+    // Profile-guided placement of the transactions, see Profile.h.
+    // profileGen makes the program record a per-site profile,
+    // profileUse are the profiles (merged) to place the sites by.
+    bool profileGen{false};
+    std::vector<std::string> profileUse;
+    // warm up the sites that abort in at least this share of attempts
+    double profileWarmUpAborts{0.01};
+    // split the sites that abort on capacity in this share of attempts
+    double profileSplitCapacity{0.05};
+    // merge adjacent sites that take fewer cycles per commit
+    unsigned profileMergeCycles{1000};
+
+    // Build the dependence graph only for the functions that can touch
+    // secret-derived values (and their callers and callees), see
+    // SecretScope.h.
+    bool secretScope{false};
+
+    // Do not print a line for every transaction start and end and
+    // every freed buffer (llvm-dg-dump -stats prints the counts).
+    bool quiet{false};
+};
+
+} // namespace dg
+
+#endif
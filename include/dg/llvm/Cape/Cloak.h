@@ -0,0 +1,34 @@
+#ifndef DG_LLVM_CAPE_CLOAK_H_
+#define DG_LLVM_CAPE_CLOAK_H_
+
+namespace llvm {
+class Module;
+}
+
+namespace dg {
+
+class LLVMPointerAnalysis;
+
+namespace llvmdg {
+
+///
+// Cloak-style coarse protection (llvm-dg-dump -cloak), the baseline
+// that Cape's targeted preloading is compared against.
+//
+// Every call of a function annotated with __attribute__((annotate("cloak")))
+// runs in its own transaction that, before the call, preloads
+//  - all the code (preloadInstAddrForCloak, every function in funcMap),
+//  - every global that the called function and its callees may access
+//    (any address-taken function for indirect calls), and
+//  - the objects that the pointer arguments point to, as far as their
+//    size is known at the call: globals, locals of the caller and
+//    single malloc'd objects of constant size.
+// Pointer arguments whose objects cannot be preloaded are reported.
+//
+// Returns the number of call sites put into transactions.
+unsigned addCloakTransactions(llvm::Module &M, LLVMPointerAnalysis *PTA);
+
+} // namespace llvmdg
+} // namespace dg
+
+#endif
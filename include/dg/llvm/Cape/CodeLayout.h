@@ -0,0 +1,31 @@
+#ifndef DG_LLVM_CAPE_CODE_LAYOUT_H_
+#define DG_LLVM_CAPE_CODE_LAYOUT_H_
+
+#include "dg/llvm/Cape/CapeOptions.h"
+
+namespace llvm {
+class Module;
+}
+
+namespace dg {
+namespace llvmdg {
+
+///
+// Cluster the code that Cape preloads into transactions.
+//
+// Every function that contains a transaction or whose code is preloaded
+// before one (i.e., is named by a preloadInstAddr/preloadBlockAddr call)
+// is moved into the section opts.codeSection and aligned to
+// opts.codeAlignment. The functions are also made adjacent in the module
+// in the order in which they are preloaded, so that the linker lays them
+// out as one dense range and a preload touches as few lines and pages
+// as possible.
+//
+// Must run after the module was instrumented.
+// Returns the number of functions that were moved.
+unsigned clusterTransactionalCode(llvm::Module &M, const CapeOptions &opts);
+
+} // namespace llvmdg
+} // namespace dg
+
+#endif
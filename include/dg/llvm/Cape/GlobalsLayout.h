@@ -0,0 +1,35 @@
+#ifndef DG_LLVM_CAPE_GLOBALS_LAYOUT_H_
+#define DG_LLVM_CAPE_GLOBALS_LAYOUT_H_
+
+#include "dg/llvm/Cape/CapeOptions.h"
+
+namespace llvm {
+class Module;
+}
+
+namespace dg {
+namespace llvmdg {
+
+///
+// Lay out the globals that Cape preloads into transactions.
+//
+// The globals passed to iterateGlobal() or iterateGlobalW() are moved
+// into opts.rodataSection (constants) or opts.dataSection (the rest), so
+// that they do not share cache lines with unrelated data that other
+// threads may write. Globals that span at least a cache line are
+// aligned to the line (or to opts.dataAlignment when they are at least
+// that big), so that a table occupies the minimal number of lines. The
+// globals are ordered from the biggest to the smallest, which packs the
+// small ones together behind the aligned tables.
+//
+// With opts.hugePages, each of the sections is also aligned and padded
+// to opts.hugePageSize.
+//
+// Must run after the module was instrumented.
+// Returns the number of globals that were moved.
+unsigned packPreloadedGlobals(llvm::Module &M, const CapeOptions &opts);
+
+} // namespace llvmdg
+} // namespace dg
+
+#endif
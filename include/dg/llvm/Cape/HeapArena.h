@@ -0,0 +1,34 @@
+#ifndef DG_LLVM_CAPE_HEAP_ARENA_H_
+#define DG_LLVM_CAPE_HEAP_ARENA_H_
+
+namespace llvm {
+class Module;
+}
+
+namespace dg {
+namespace llvmdg {
+
+///
+// Redirect the sensitive malloc sites to the arena allocator of the runtime.
+//
+// Every malloc whose result is recorded by insertMallocSet(bid, ...) is
+// replaced by capeArenaMalloc(bid, size), which allocates the object from
+// a contiguous slab owned by the buffer id. iterateMallocSet(bid) then
+// preloads a single range instead of chasing every object. The
+// insertMallocSet() calls become redundant and are removed.
+//
+// Every use of free(), realloc() and reallocarray() in the module (but in
+// the arena runtime) is replaced by capeArenaFree(), capeArenaRealloc()
+// and capeArenaReallocArray(), since an arena object may reach any of
+// them: the calls, and the addresses taken in code or in the initializers
+// of globals (e.g., a table of allocator functions).
+// They handle the arena objects and fall back to libc for other pointers.
+//
+// Must run after the module was instrumented.
+// Returns the number of redirected malloc sites.
+unsigned redirectSensitiveMallocs(llvm::Module &M);
+
+} // namespace llvmdg
+} // namespace dg
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef DG_LLVM_CAPE_HOISTING_H_
+#define DG_LLVM_CAPE_HOISTING_H_
+
+#include <functional>
+
+namespace llvm {
+class Instruction;
+class Module;
+} // namespace llvm
+
+namespace dg {
+namespace llvmdg {
+
+///
+// Move secret-independent instructions out of the transactions.
+//
+// A transaction spans the code between its startTransaction() call and
+// its endTransaction() call (see TransactionRegion in Sites.h), which
+// may be in the same block. An instruction of the transaction is moved
+// above xbegin when it
+//  - is not marked by Cape (isMarked) and does not depend on a secret,
+//  - can be executed speculatively (no stores, no calls),
+//  - has all operands available before xbegin, and
+//  - is not a load, or the transaction writes no memory.
+// Similarly, an instruction whose users are all after xend is moved
+// right after xend. This makes the transactions shorter and smaller
+// while everything that depends on the secret stays inside.
+//
+// Must run after the module was instrumented.
+// Returns the number of moved instructions.
+unsigned hoistOutOfTransactions(llvm::Module &M,
+                                const std::function<bool(const llvm::Instruction *)> &isMarked);
+
+} // namespace llvmdg
+} // namespace dg
+
+#endif
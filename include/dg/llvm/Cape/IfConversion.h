@@ -0,0 +1,35 @@
+#ifndef DG_LLVM_CAPE_IF_CONVERSION_H_
+#define DG_LLVM_CAPE_IF_CONVERSION_H_
+
+#include "dg/llvm/Cape/CapeOptions.h"
+
+namespace llvm {
+class Module;
+}
+
+namespace dg {
+namespace llvmdg {
+
+///
+// Replace small secret-dependent branches by constant-time selects.
+//
+// A conditional branch whose condition depends on a secret global (a
+// global with the "secret" attribute) is converted when it forms a
+// triangle or a diamond whose arms
+//  - have no side effects and can be executed speculatively,
+//  - do not access memory at secret-dependent addresses,
+//  - have at most opts.ifConvertMaxInsts instructions each.
+// The arms are executed unconditionally and every phi node at the join
+// becomes a mask-based select whose mask is hidden from the optimizer,
+// so that the back end cannot turn it into a branch again. Such
+// branches then need no transaction; transactions remain for regions
+// with secret-indexed accesses or big bodies.
+//
+// Must run before the dependence graph is built.
+// Returns the number of converted branches.
+unsigned convertSecretBranches(llvm::Module &M, const CapeOptions &opts);
+
+} // namespace llvmdg
+} // namespace dg
+
+#endif
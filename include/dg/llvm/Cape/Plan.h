@@ -0,0 +1,120 @@
+#ifndef DG_LLVM_CAPE_PLAN_H_
+#define DG_LLVM_CAPE_PLAN_H_
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace llvm {
+class BasicBlock;
+class Instruction;
+class Module;
+class Value;
+class raw_ostream;
+} // namespace llvm
+
+namespace dg {
+namespace llvmdg {
+
+///
+// One change of the Cape instrumentation: a call of the runtime (see
+// samples/common.h) that goes right before the instruction at (the
+// registration of a buffer goes right after the buffer's object).
+struct PlanAction {
+    enum class Kind {
+        // startTransaction() and endTransaction()
+        TransactionStart,
+        TransactionEnd,
+        // preloadInstAddr(name) - the code of the function name
+        PreloadCode,
+        // preloadBlockAddr(name, block, next block)
+        PreloadBlock,
+        // iterateAllocStack(buffer), iterateMallocSet(buffer) and
+        // iterateGlobal(size, object), with write intent if write is set
+        // (iterateGlobal of only length bytes at offset if length is set)
+        PreloadAlloc,
+        PreloadMalloc,
+        PreloadGlobal,
+        // the registration of the buffer object (the alloca or the
+        // malloc call) after it is allocated, and its removal
+        PushAlloc,
+        PopAlloc,
+        InsertMalloc,
+        // before a free of the buffer (the operand of the call at)
+        EraseMalloc,
+    };
+
+    Kind kind;
+    llvm::Instruction *at{nullptr};
+    // PreloadCode, PreloadBlock
+    std::string name;
+    llvm::BasicBlock *block{nullptr};
+    // the preloaded and (un)registered buffers
+    uint32_t buffer{0};
+    bool write{false};
+    // PreloadGlobal, PushAlloc, InsertMalloc
+    llvm::Value *object{nullptr};
+    // the preloaded bytes of the global, all of them if length is 0
+    uint64_t offset{0};
+    uint64_t length{0};
+
+    PlanAction(Kind k, llvm::Instruction *a) : kind(k), at(a) {}
+};
+
+///
+// The instrumentation that the marking passes decided on (see Slicing.h),
+// in the order of the decisions. The marking only fills the plan, the IR
+// does not change until applyPlan, so the plan can be dumped, compared
+// between runs (llvm-dg-dump -plan FILE) and applied later to the same
+// module (-apply-plan FILE) without running the analysis again.
+class InstrumentationPlan {
+    std::vector<PlanAction> actions;
+
+  public:
+    void addTransactionStart(llvm::Instruction *at);
+    void addTransactionEnd(llvm::Instruction *at);
+    void addPreloadCode(llvm::Instruction *at, const std::string &name);
+    void addPreloadBlock(llvm::Instruction *at, const std::string &name, llvm::BasicBlock *B);
+    void addPreloadAlloc(llvm::Instruction *at, uint32_t buffer, bool write);
+    void addPreloadMalloc(llvm::Instruction *at, uint32_t buffer, bool write);
+    void addPreloadGlobal(llvm::Instruction *at, llvm::Value *global, bool write,
+                          uint64_t offset = 0, uint64_t length = 0);
+    void addPushAlloc(llvm::Instruction *at, uint32_t buffer, llvm::Value *alloca);
+    void addPopAlloc(llvm::Instruction *at, uint32_t buffer);
+    void addInsertMalloc(llvm::Instruction *at, uint32_t buffer, llvm::Value *call);
+    void addEraseMalloc(llvm::Instruction *at, uint32_t buffer);
+    // e.g., an action read from a file
+    void addAction(PlanAction A) { actions.push_back(std::move(A)); }
+
+    const std::vector<PlanAction> &getActions() const { return actions; }
+    size_t size() const { return actions.size(); }
+    bool empty() const { return actions.empty(); }
+    void clear() { actions.clear(); }
+};
+
+// Insert the calls of the plan, in its order, into the module. The
+// runtime declarations and the strings are created first, then the
+// functions are instrumented one by one. Returns how many functions
+// the plan changed.
+unsigned applyPlan(const InstrumentationPlan &plan);
+
+// The version of the JSON format of the plans:
+// {"version": 1, "actions": [{"kind": "transaction-start",
+//   "at": {"function": "f", "inst": 12}, ...}, ...]}
+// (a bounded preload-global has also "offset" and "length").
+// The instructions (and blocks) are numbered in the order of the
+// function before the instrumentation.
+constexpr unsigned planVersion = 1;
+
+void writePlanJSON(llvm::raw_ostream &out, const InstrumentationPlan &plan);
+// Returns false (and reports why) if the file cannot be written.
+bool writePlan(const std::string &file, const InstrumentationPlan &plan);
+// Read a plan that an earlier run made for the (not instrumented) module.
+// Returns false (and reports why) if the plan does not fit the module.
+bool readPlan(llvm::Module &M, const std::string &file, InstrumentationPlan &plan);
+
+} // namespace llvmdg
+} // namespace dg
+
+#endif
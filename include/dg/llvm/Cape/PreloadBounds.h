@@ -0,0 +1,72 @@
+#ifndef DG_LLVM_CAPE_PRELOAD_BOUNDS_H_
+#define DG_LLVM_CAPE_PRELOAD_BOUNDS_H_
+
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+#include "dg/Offset.h"
+
+namespace llvm {
+class DataLayout;
+class GlobalVariable;
+class Instruction;
+class Module;
+class Value;
+} // namespace llvm
+
+namespace dg {
+
+namespace analysis {
+class LLVMValueRelations;
+} // namespace analysis
+
+namespace llvmdg {
+
+///
+// The bytes of a global that a sensitive access may reach, so that the
+// transaction preloads only them instead of the whole object
+// (llvm-dg-dump -bound-preloads). For an access like T[s & 0xff] of a
+// large table, that is the first 256 elements.
+//
+// The offset of the access is the offset of its pointer in PTA if that
+// is known; otherwise the GEPs from the global to the pointer are
+// followed, and every variable index is bounded by its known bits
+// (computeKnownBits) and by the value relations at the access
+// (ValueRelations, e.g. an index checked by i < 16 before). Accesses
+// outside of the global are undefined, so the range is clipped to it.
+//
+// The value relations are computed once for the whole module. If the
+// module has terminators that they do not handle (invoke, indirectbr),
+// only the known bits are used.
+class PreloadBounds {
+    const llvm::DataLayout &DL;
+    std::unique_ptr<analysis::LLVMValueRelations> VR;
+
+    void boundByRelations(const llvm::Instruction *at, const llvm::Value *idx,
+                          int64_t &min, int64_t &max);
+    bool getIndexRange(const llvm::Instruction *at, const llvm::Value *idx,
+                       int64_t &min, int64_t &max);
+    bool getOffsetRange(const llvm::Instruction *at, const llvm::Value *ptr,
+                        const llvm::GlobalVariable *obj, int64_t &min, int64_t &max);
+
+public:
+    PreloadBounds(llvm::Module &M);
+    ~PreloadBounds();
+
+    // The bytes [first, second) of obj that the access at of len bytes
+    // (0 - unknown) through ptr may reach; offset is the offset of ptr
+    // in obj from PTA. All bytes of obj if they cannot be bounded.
+    std::pair<uint64_t, uint64_t> getAccessedBytes(const llvm::Instruction *at,
+                                                   const llvm::Value *ptr,
+                                                   const Offset &offset,
+                                                   const llvm::GlobalVariable *obj,
+                                                   uint64_t len);
+
+    bool hasRelations() const { return VR != nullptr; }
+};
+
+} // namespace llvmdg
+} // namespace dg
+
+#endif
@@ -0,0 +1,82 @@
+#ifndef DG_LLVM_CAPE_PROFILE_H_
+#define DG_LLVM_CAPE_PROFILE_H_
+
+#include <cstdint>
+#include <map>
+#include <set>
+#include <string>
+
+#include "dg/llvm/Cape/CapeOptions.h"
+
+namespace llvm {
+class Module;
+}
+
+namespace dg {
+namespace llvmdg {
+
+///
+// What a program built with -DCAPE_PROFILE recorded for one
+// transaction site (see samples/common.h).
+struct SiteProfile {
+    // executions of xbegin, including the retries
+    uint64_t attempts{0};
+    uint64_t commits{0};
+    // aborts by the cause reported by xbegin
+    uint64_t conflict{0};
+    uint64_t capacity{0};
+    uint64_t explicitAborts{0};
+    uint64_t other{0};
+    // cycles from the first xbegin to the commit, summed over commits
+    uint64_t cycles{0};
+
+    SiteProfile &operator+=(const SiteProfile &rhs);
+
+    double abortRatio() const;
+    double capacityRatio() const;
+    double cyclesPerCommit() const;
+};
+
+// Profiles indexed by the site numbers (see Sites.h).
+using Profile = std::map<unsigned, SiteProfile>;
+
+// The version of the profile format, the first line of a profile is
+// "cape-profile <version>". Followed by comment lines starting with '#'
+// and one line per site:
+//   <site> <attempts> <commits> <conflict> <capacity> <explicit> <other> <cycles>
+// Profiles are merged by summing the lines of the same site, so that
+// the runtime can simply add each run to the existing file.
+constexpr unsigned profileVersion = 1;
+
+// Read a profile and add it to the given one.
+// Returns false (and reports why) if the file cannot be used.
+bool readProfile(const std::string &file, Profile &profile);
+
+///
+// Make the program record a profile: every startTransaction() is
+// preceded by capeProfileEnter(site) that tells the runtime which site
+// is starting. Must run after all passes that add or remove sites,
+// and the run that uses the profile must use the same Cape options
+// so that the site numbers match.
+// Returns the number of instrumented sites.
+unsigned addProfiling(llvm::Module &M);
+
+///
+// Change the transaction sites according to the profile:
+//  - a hot site that aborts on capacity (opts.profileSplitCapacity) is
+//    split into two transactions at a block that every execution of the
+//    transaction goes through, i.e., not inside any (secret-dependent)
+//    branch of it; each part keeps only the preloads of the code and
+//    the objects it may access (all of those it cannot tell apart),
+//  - a cheap site (opts.profileMergeCycles) that starts shortly after the
+//    end of another cheap site in the same block is merged into it,
+//  - the sites that abort often enough (opts.profileWarmUpAborts) are
+//    returned as the ones where the warm-up (WarmUp.h) pays off.
+// Sites that are not in the profile are left alone.
+std::set<unsigned> applyProfile(llvm::Module &M, const Profile &profile,
+                                const CapeOptions &opts);
+
+} // namespace llvmdg
+} // namespace dg
+
+#endif
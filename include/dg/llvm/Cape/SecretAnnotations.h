@@ -0,0 +1,63 @@
+#ifndef DG_LLVM_CAPE_SECRET_ANNOTATIONS_H_
+#define DG_LLVM_CAPE_SECRET_ANNOTATIONS_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "dg/Offset.h"
+
+namespace llvm {
+class Argument;
+class Module;
+class Value;
+} // namespace llvm
+
+namespace dg {
+
+class LLVMPointerAnalysis;
+
+namespace llvmdg {
+
+///
+// The secrets besides the secret globals (the globals that
+// __attribute__((annotate("secret"))) gives the "secret" attribute):
+//  - the locals annotated with "secret" (llvm.var.annotation, clang emits
+//    it also for the annotated parameters at -O0),
+//  - the struct fields annotated with "secret" (llvm.ptr.annotation,
+//    clang emits it at every access of the field), and
+//  - the parameters with the "secret" attribute.
+//
+// The annotated locals get !cape.secret, so that isSecret recognizes
+// them. A field pointer is not a memory object, which is what the checks
+// of the accesses see (the targets of PTA): its object gets the bytes of
+// the field by addSecretFieldBytes instead. Returns the annotated locals,
+// field pointers and parameters; the slices start at them instead of at
+// a global.
+std::vector<llvm::Value *> findSecretAnnotations(llvm::Module &M);
+
+bool isSecretParam(const llvm::Argument *A);
+
+// A global with the "secret" attribute, a local found by
+// findSecretAnnotations, or a secret parameter.
+bool isSecret(const llvm::Value *V);
+
+///
+// The secret bytes of the memory objects with annotated fields: the
+// object that a field pointer of findSecretAnnotations points to (by the
+// offset of the pointer in PTA) gets [offset, offset + size of the field)
+// in !cape.secret.bytes, or all its bytes if the offset is unknown. The
+// rest of the object is not secret, so that only the accesses that
+// overlap the field count as accesses of the secret. Returns the number
+// of the objects.
+unsigned addSecretFieldBytes(llvm::Module &M, LLVMPointerAnalysis *PTA,
+                             const std::vector<llvm::Value *> &secrets);
+
+// May the len bytes at offset in the memory object V (len 0 - up to the
+// end of the object) hold a secret? All bytes of an object that isSecret
+// do, otherwise only the bytes of addSecretFieldBytes.
+bool mayHoldSecret(const llvm::Value *V, const Offset &offset, uint64_t len);
+
+} // namespace llvmdg
+} // namespace dg
+
+#endif
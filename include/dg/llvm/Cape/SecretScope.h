@@ -0,0 +1,43 @@
+#ifndef DG_LLVM_CAPE_SECRET_SCOPE_H_
+#define DG_LLVM_CAPE_SECRET_SCOPE_H_
+
+#include <set>
+
+namespace llvm {
+class Function;
+class Module;
+} // namespace llvm
+
+namespace dg {
+
+class LLVMPointerAnalysis;
+
+namespace llvmdg {
+
+///
+// The functions that the dependence graph needs for Cape
+// (llvm-dg-dump -secret-scope), so that it is not built for the rest.
+//
+// A cheap flow-insensitive pre-pass over the functions reachable from
+// entry finds the functions that can touch secret-derived values: the
+// values computed from the secrets (the globals with the "secret"
+// attribute, what the memcpy calls of entry copy, and the annotated
+// locals, fields and parameters of SecretAnnotations.h), the memory objects
+// (of the pointer analysis) that they are stored to, and the objects
+// that are accessed at secret-dependent addresses or freed. A function
+// with a secret-dependent branch and everything it calls are taken as
+// whole. The scope are these functions, all their callees (which
+// transactions may call) and their callers up to entry (so that the
+// graph reaches them). If a secret value may be stored to unknown memory,
+// the scope is every reachable function.
+//
+// The forward slice from the secrets stays in the scope, so the graph
+// marks the same nodes and Cape instruments the module the same way.
+std::set<const llvm::Function *> getSecretScope(llvm::Module &M,
+                                                LLVMPointerAnalysis *PTA,
+                                                const llvm::Function *entry);
+
+} // namespace llvmdg
+} // namespace dg
+
+#endif
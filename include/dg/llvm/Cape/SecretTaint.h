@@ -0,0 +1,55 @@
+#ifndef DG_LLVM_CAPE_SECRET_TAINT_H_
+#define DG_LLVM_CAPE_SECRET_TAINT_H_
+
+#include <set>
+
+namespace llvm {
+class Argument;
+class BasicBlock;
+class CallInst;
+class DataLayout;
+class Instruction;
+class Module;
+class PHINode;
+class Value;
+} // namespace llvm
+
+namespace dg {
+namespace llvmdg {
+
+///
+// A simple flow-insensitive analysis of the values that depend on
+// the secret globals (the globals with the "secret" attribute) and the
+// annotated secret locals, fields and parameters (SecretAnnotations.h). It
+// follows the SSA def-use chains, the stores of secret-dependent values
+// into memory objects, the arguments and return values of calls, and
+// the phi nodes that merge the paths of secret-dependent branches.
+//
+// It is much cheaper and less precise than the dependence graph, and it
+// is meant for the Cape transformations that run when the graph is not
+// available or is not up to date.
+class SecretTaint {
+    const llvm::DataLayout &DL;
+    // values that depend on a secret
+    std::set<const llvm::Value *> tainted;
+    // memory objects (or pointer arguments) that hold a secret
+    std::set<const llvm::Value *> secretMem;
+
+    const llvm::Value *getObject(const llvm::Value *ptr) const;
+    bool pointsToSecret(const llvm::Value *ptr) const;
+    bool anyOperandTainted(const llvm::Instruction &I) const;
+    bool isSecretBranch(const llvm::BasicBlock *B) const;
+    bool mergesSecretPaths(const llvm::PHINode *phi) const;
+    void handleCall(const llvm::CallInst *CI);
+    void handleInstruction(const llvm::Instruction &I);
+
+public:
+    SecretTaint(llvm::Module &M);
+
+    bool isTainted(const llvm::Value *v) const { return tainted.count(v) > 0; }
+};
+
+} // namespace llvmdg
+} // namespace dg
+
+#endif
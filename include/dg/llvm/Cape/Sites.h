@@ -0,0 +1,76 @@
+#ifndef DG_LLVM_CAPE_SITES_H_
+#define DG_LLVM_CAPE_SITES_H_
+
+#include <set>
+#include <vector>
+
+namespace llvm {
+class BasicBlock;
+class CallInst;
+class Instruction;
+class Module;
+} // namespace llvm
+
+namespace dg {
+namespace llvmdg {
+
+///
+// Get the transaction sites (the calls of startTransaction) of the module.
+//
+// The sites are numbered in the order of functions and instructions in
+// the module, which is stable for the same input and Cape options. The
+// number is also attached to the call as !cape.site metadata and a site
+// keeps it once it got one, so adding or removing sites later (see
+// Profile.h) does not renumber the others. The returned vector is indexed
+// by the number and has null entries for the removed sites.
+std::vector<llvm::CallInst *> getTransactionSites(llvm::Module &M);
+
+// Get the number of a transaction site, or -1 if the call is not a site.
+int getTransactionSiteId(const llvm::CallInst *CI);
+
+// Drop the number of a site (e.g., of a copied startTransaction call),
+// so that the next getTransactionSites gives it a new one.
+void clearTransactionSiteId(llvm::CallInst *CI);
+
+// Is this a call of one of the preload helpers of the runtime?
+bool isPreloadCall(const llvm::Instruction *I);
+
+// Is this a call of a preload helper, startTransaction or endTransaction?
+// None of them changes the memory of the program.
+bool isCapeRuntimeCall(const llvm::Instruction *I);
+
+// Get the preload calls of the transaction that starts with xbegin
+// (Cape puts them right after xbegin in the same block) whose arguments
+// are also available before xbegin.
+std::vector<llvm::CallInst *> getSitePreloads(llvm::CallInst *xbegin);
+
+///
+// The code of a transaction: the instructions after xbegin in its block,
+// the blocks reachable from there up to (not including) the block with
+// the endTransaction call, and the instructions before xend in that block.
+// A transaction that ends in the block where it starts has only the
+// instructions between the two calls. Transactions with more than one
+// endTransaction call have no code.
+struct TransactionRegion {
+    llvm::CallInst *xbegin{nullptr};
+    llvm::CallInst *xend{nullptr};
+    // the whole blocks of the transaction
+    std::vector<llvm::BasicBlock *> blocks;
+    std::set<const llvm::BasicBlock *> blockSet;
+    // the instructions of the blocks of xbegin and xend that are
+    // in the transaction, in order
+    std::vector<llvm::Instruction *> partial;
+    std::set<const llvm::Instruction *> partialSet;
+    // the transaction writes memory (besides the runtime calls)
+    bool writesMemory{false};
+
+    bool contains(const llvm::Instruction *I) const;
+    bool empty() const { return blocks.empty() && partial.empty(); }
+};
+
+TransactionRegion getTransactionRegion(llvm::CallInst *xbegin);
+
+} // namespace llvmdg
+} // namespace dg
+
+#endif
@@ -0,0 +1,97 @@
+#ifndef DG_LLVM_CAPE_STATS_H_
+#define DG_LLVM_CAPE_STATS_H_
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace llvm {
+class Module;
+class raw_ostream;
+} // namespace llvm
+
+namespace dg {
+namespace llvmdg {
+
+///
+// Per-phase statistics of a run of llvm-dg-dump (-stats FILE).
+//
+// A phase is measured from begin(name) to end(name): the wall time,
+// the CPU time (user and system) of the process and the peak resident
+// set size of the process at its end. A phase that runs more times
+// (e.g., a marking pass for every secret) sums the times. The phases
+// are reported in the order in which they first started.
+class CapeStats {
+  public:
+    struct Phase {
+        std::string name;
+        unsigned runs{0};
+        double wallTime{0};
+        double cpuTime{0};
+        // kilobytes, the maximum over the runs
+        long peakRSS{0};
+    };
+
+    CapeStats();
+
+    void begin(const std::string &name);
+    void end(const std::string &name);
+
+    // measure the lifetime of the object as a phase
+    class Scope {
+        CapeStats *stats;
+        std::string name;
+
+      public:
+        Scope(CapeStats *s, const std::string &n) : stats(s), name(n) {
+            if (stats)
+                stats->begin(name);
+        }
+        ~Scope() {
+            if (stats)
+                stats->end(name);
+        }
+    };
+
+    void setCount(const std::string &name, uint64_t value) { counts[name] = value; }
+    uint64_t getCount(const std::string &name) const {
+        auto it = counts.find(name);
+        return it == counts.end() ? 0 : it->second;
+    }
+    void setInfo(const std::string &name, const std::string &value) { info[name] = value; }
+
+    // Count the transaction sites, their ends and the preload calls
+    // in the instrumented module.
+    void countModule(llvm::Module &M);
+
+    const std::vector<Phase> &getPhases() const { return phases; }
+
+    // {"info": {...}, "phases": [...], "total": {...}, "counts": {...}}
+    void writeJSON(llvm::raw_ostream &out) const;
+    // Returns false (and reports why) if the file cannot be written.
+    bool writeJSON(const std::string &file) const;
+
+  private:
+    struct Sample {
+        double wall{0};
+        double cpu{0};
+        long peakRSS{0};
+    };
+
+    static Sample sample();
+
+    Sample start;
+    std::vector<Phase> phases;
+    // the running phases and when they started
+    std::map<std::string, Sample> running;
+    std::map<std::string, uint64_t> counts;
+    std::map<std::string, std::string> info;
+
+    Phase &getPhase(const std::string &name);
+};
+
+} // namespace llvmdg
+} // namespace dg
+
+#endif
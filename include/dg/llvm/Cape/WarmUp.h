@@ -0,0 +1,33 @@
+#ifndef DG_LLVM_CAPE_WARM_UP_H_
+#define DG_LLVM_CAPE_WARM_UP_H_
+
+#include <set>
+
+namespace llvm {
+class Module;
+}
+
+namespace dg {
+namespace llvmdg {
+
+///
+// Add a non-transactional warm-up before every transaction site.
+//
+// The preload calls that follow startTransaction() are repeated right
+// before it, outside of the transaction, so that the cold misses (and
+// page walks) are taken before xbegin and the in-transaction preload
+// mostly hits the caches. The warm-up is guarded by
+// capeWarmUpEnabled(site), so it can be switched per site at run time
+// (CAPE_WARMUP in samples/common.h).
+//
+// If only is given, just the sites with these numbers get a warm-up
+// (see applyProfile in Profile.h).
+//
+// Must run after the module was instrumented.
+// Returns the number of sites that got a warm-up.
+unsigned addWarmUp(llvm::Module &M, const std::set<unsigned> *only = nullptr);
+
+} // namespace llvmdg
+} // namespace dg
+
+#endif
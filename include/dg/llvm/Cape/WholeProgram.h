@@ -0,0 +1,45 @@
+#ifndef DG_LLVM_CAPE_WHOLE_PROGRAM_H_
+#define DG_LLVM_CAPE_WHOLE_PROGRAM_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace llvm {
+class LLVMContext;
+class Module;
+} // namespace llvm
+
+namespace dg {
+namespace llvmdg {
+
+///
+// Cape over a program of several bitcode files (llvm-dg-dump -link).
+//
+// linkUnits loads the files lazily and links them into one module, so
+// that the analysis follows the secrets across the translation units.
+// Every function and global remembers the file (unit) that defines it.
+// Returns null (and reports why) if a file cannot be loaded or linked.
+std::unique_ptr<llvm::Module> linkUnits(llvm::LLVMContext &ctx,
+                                        const std::vector<std::string> &files);
+
+// Split the instrumented module back into its units and write each of
+// them to <file>_ac.ll. What Cape added goes to the unit that defines
+// the entry function. The internal symbols that another unit now uses
+// (e.g., a callee that a transaction preloads) become hidden globals
+// named cape.<unit>.<name>, where <unit> is the name of the unit's
+// source file without the directory, with every character but letters
+// and digits replaced by '_' (and .<index of the unit> if more units
+// have the same name). The other internal symbols keep the names
+// from their unit even if the linker renamed them. So the output of a
+// unit does not depend on the other units, and a file whose new text
+// is the same as what it contains is not written again: a build system
+// only recompiles the units whose instrumentation changed.
+// Returns false (and reports why) if a unit cannot be written; written
+// is set to the number of the written files.
+bool writeUnits(llvm::Module &M, const std::string &entry, unsigned *written);
+
+} // namespace llvmdg
+} // namespace dg
+
+#endif
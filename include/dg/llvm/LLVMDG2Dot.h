@@ -99,7 +99,7 @@ public:
     LLVMDG2Dot(LLVMDependenceGraph *dg,
                uint32_t opts = debug::PRINT_CFG | debug::PRINT_DD | debug::PRINT_CD,
                const char *file = NULL)
-        : debug::DG2Dot<LLVMNode>(dg, opts, file) {}
+        : debug::DG2Dot<LLVMNode>(dg, opts, file), llvmDG(dg) {}
 
     /* virtual */
     std::ostream& printKey(std::ostream& os, llvm::Value *val)
@@ -186,7 +186,7 @@ public:
             return false;
 
         const std::map<llvm::Value *,
-                       LLVMDependenceGraph *>& CF = getConstructedFunctions();
+                       LLVMDependenceGraph *>& CF = llvmDG->getConstructedFunctions();
 
         start();
 
@@ -203,6 +203,7 @@ public:
     }
 
 private:
+    LLVMDependenceGraph *llvmDG;
 
     void dumpSubgraph(LLVMDependenceGraph *graph, const char *name)
     {
@@ -227,7 +228,7 @@ public:
     LLVMDGDumpBlocks(LLVMDependenceGraph *dg,
                   uint32_t opts = debug::PRINT_CFG | debug::PRINT_DD | debug::PRINT_CD,
                   const char *file = NULL)
-        : debug::DG2Dot<LLVMNode>(dg, opts, file) {}
+        : debug::DG2Dot<LLVMNode>(dg, opts, file), llvmDG(dg) {}
 
     /* virtual
     std::ostream& printKey(std::ostream& os, llvm::Value *val)
@@ -250,7 +251,7 @@ public:
             return false;
 
         const std::map<llvm::Value *,
-                       LLVMDependenceGraph *>& CF = getConstructedFunctions();
+                       LLVMDependenceGraph *>& CF = llvmDG->getConstructedFunctions();
 
         start();
 
@@ -269,6 +270,7 @@ public:
     }
 
 private:
+    LLVMDependenceGraph *llvmDG;
 
     void dumpSubgraph(LLVMDependenceGraph *graph, const char *name)
     {
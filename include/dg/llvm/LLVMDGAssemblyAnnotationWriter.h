@@ -64,6 +64,8 @@ private:
     LLVMPointerAnalysis *PTA;
     LLVMDataDependenceAnalysis *DDA;
     const std::set<LLVMNode *> *criteria;
+    // the graph whose nodes are annotated
+    const LLVMDependenceGraph *dg;
     std::string module_comment{};
 
     void printValue(const llvm::Value *val,
@@ -282,8 +284,9 @@ public:
     LLVMDGAssemblyAnnotationWriter(AnnotationOptsT o = ANNOTATE_SLICE,
                                    LLVMPointerAnalysis *pta = nullptr,
                                    LLVMDataDependenceAnalysis *dda = nullptr,
-                                   const std::set<LLVMNode *>* criteria = nullptr)
-        : opts(o), PTA(pta), DDA(dda), criteria(criteria)
+                                   const std::set<LLVMNode *>* criteria = nullptr,
+                                   const LLVMDependenceGraph *dg = nullptr)
+        : opts(o), PTA(pta), DDA(dda), criteria(criteria), dg(dg)
     {
         assert(!(opts & ANNOTATE_PTR) || PTA);
         assert(!(opts & ANNOTATE_DU) || DDA);
@@ -312,11 +315,11 @@ public:
     void emitInstructionAnnot(const llvm::Instruction *I,
                               llvm::formatted_raw_ostream& os) override
     {
-        if (opts == 0)
+        if (opts == 0 || !dg)
             return;
 
         LLVMNode *node = nullptr;
-        for (auto& it : getConstructedFunctions()) {
+        for (auto& it : dg->getConstructedFunctions()) {
             LLVMDependenceGraph *sub = it.second;
             node = sub->getNode(const_cast<llvm::Instruction *>(I));
             if (node)
@@ -332,10 +335,10 @@ public:
     void emitBasicBlockStartAnnot(const llvm::BasicBlock *B,
                                   llvm::formatted_raw_ostream& os) override
     {
-        if (opts == 0)
+        if (opts == 0 || !dg)
             return;
 
-        for (auto& it : getConstructedFunctions()) {
+        for (auto& it : dg->getConstructedFunctions()) {
             LLVMDependenceGraph *sub = it.second;
             auto& cb = sub->getBlocks();
             auto I = cb.find(const_cast<llvm::BasicBlock *>(B));
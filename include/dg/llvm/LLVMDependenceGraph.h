@@ -10,7 +10,10 @@
 #endif
 
 #include <map>
+#include <memory>
+#include <set>
 #include <unordered_map>
+#include <vector>
 
 #include "dg/llvm/ThreadRegions/ControlFlowGraph.h"
 
@@ -21,6 +24,7 @@ namespace llvm {
 class Module;
 class Value;
 class Function;
+class CallInst;
 } // namespace llvm
 
 #include "dg/DependenceGraph.h"
@@ -109,6 +113,22 @@ public:
     bool getCallSites(const std::vector<std::string> &names, std::set<LLVMNode *> *callsites);
 
     bool getSecretNodes(llvm::Value *, std::set<LLVMNode *> *callsites);
+    // the nodes of the annotated secrets (see Cape/SecretAnnotations.h):
+    // the locals and field pointers, and the users of the parameters
+    bool getAnnotatedSecretNodes(const std::vector<llvm::Value *> &secrets,
+                                 std::set<LLVMNode *> *callsites);
+
+    // Build subgraphs only for the functions in the given set (it must
+    // outlive the graph). The calls of other functions are handled like
+    // the calls of undefined functions. nullptr (the default) builds
+    // all the functions reachable from the entry.
+    void setFunctionScope(const std::set<const llvm::Function *> *scope) {
+        functionScope = scope;
+    }
+
+    bool isInScope(const llvm::Function *F) const {
+        return !functionScope || functionScope->count(F) > 0;
+    }
 
     // FIXME we need remove the callsite from here if we slice away
     // the callsite
@@ -156,6 +176,18 @@ public:
     LLVMPointerAnalysis *getPTA() const { return PTA; }
     LLVMDataDependenceAnalysis *getDDA() const { return DDA; }
 
+    // the graphs of all the functions built for the module
+    // (the same for the graph of the entry function and its subgraphs)
+    const std::map<llvm::Value *, LLVMDependenceGraph *> &
+    getConstructedFunctions() const {
+        return moduleGraphs->constructedFunctions;
+    }
+
+    // the calls of free in the constructed functions
+    const std::vector<llvm::CallInst *> *getAllFreeCalls() const {
+        return &moduleGraphs->freeCalls;
+    }
+
     LLVMNode *findNode(llvm::Value *value) const;
 
     void addDefUseEdges();
@@ -199,6 +231,9 @@ private:
 
     bool threads{false};
 
+    // the functions to build subgraphs for, all if nullptr
+    const std::set<const llvm::Function *> *functionScope{nullptr};
+
     // all callnodes in this graph - forming call graph
     std::set<LLVMNode *> callNodes;
 
@@ -212,16 +247,18 @@ private:
     LLVMDataDependenceAnalysis *DDA;
     //LLVMControlDependenceAnalysis *CDA;
 
+    // what the graphs built for one module share, it is
+    // inherited to subgraphs like the global nodes
+    struct ModuleGraphs {
+        std::map<llvm::Value *, LLVMDependenceGraph *> constructedFunctions;
+        std::vector<llvm::CallInst *> freeCalls;
+    };
+    std::shared_ptr<ModuleGraphs> moduleGraphs{std::make_shared<ModuleGraphs>()};
+
     // verifier needs access to private elements
     friend class LLVMDGVerifier;
 };
 
-const std::vector<llvm::CallInst *> *getAllFreeCalls();
-
-const std::map<llvm::Value *,
-               LLVMDependenceGraph *> &
-getConstructedFunctions();
-
 LLVMNode *
 findInstruction(llvm::Instruction *instruction,
                 const std::map<llvm::Value *, LLVMDependenceGraph *> &constructedFunctions);
@@ -2,6 +2,8 @@
 #define _DG_LLVM_DEPENDENCE_GRAPH_BUILDER_H_
 
 #include <string>
+#include <set>
+#include <functional>
 #include <ctime> // std::clock
 
 // ignore unused parameters in LLVM libraries
@@ -74,10 +76,13 @@ class LLVMDependenceGraphBuilder {
     std::unique_ptr<LLVMDependenceGraph> _dg{};
     std::unique_ptr<ControlFlowGraph> _controlFlowGraph{};
     llvm::Function *_entryFunction{nullptr};
+    // the functions that the graph is built for (see build(scope))
+    std::set<const llvm::Function *> _scope{};
 
     struct Statistics {
         uint64_t cdaTime{0};
         uint64_t ptaTime{0};
+        uint64_t scopeTime{0};
         uint64_t rdaTime{0};
         uint64_t inferaTime{0};
         uint64_t joinsTime{0};
@@ -88,23 +93,39 @@ class LLVMDependenceGraphBuilder {
     void _timerStart() { _time_start = std::clock(); }
     uint64_t _timerEnd() { return (std::clock() - _time_start); }
 
+    // called at the start and at the end of every phase (see setPhaseCallback)
+    std::function<void(const char *, bool)> _phaseCallback{};
+    void _phaseStart(const char *phase) {
+        if (_phaseCallback)
+            _phaseCallback(phase, false);
+    }
+    void _phaseEnd(const char *phase) {
+        if (_phaseCallback)
+            _phaseCallback(phase, true);
+    }
+
     void _runPointerAnalysis() {
         assert(_PTA && "BUG: No PTA");
 
+        _phaseStart("pta");
         _timerStart();
         _PTA->run();
         _statistics.ptaTime = _timerEnd();
+        _phaseEnd("pta");
     }
 
     void _runDataDependenceAnalysis() {
         assert(_DDA && "BUG: No RD");
 
+        _phaseStart("dda");
         _timerStart();
         _DDA->run();
         _statistics.rdaTime = _timerEnd();
+        _phaseEnd("dda");
     }
 
     void _runControlDependenceAnalysis() {
+        _phaseStart("cda");
         _timerStart();
         //_CDA->run();
         // FIXME: until we get rid of the legacy code,
@@ -112,30 +133,74 @@ class LLVMDependenceGraphBuilder {
         // into the dg
         _dg->computeControlDependencies(_options.CDAOptions);
         _statistics.cdaTime = _timerEnd();
+        _phaseEnd("cda");
     }
 
     void _runInterferenceDependenceAnalysis() {
+        _phaseStart("interference");
         _timerStart();
         _dg->computeInterferenceDependentEdges(_controlFlowGraph.get());
         _statistics.inferaTime = _timerEnd();
+        _phaseEnd("interference");
     }
 
     void _runForkJoinAnalysis() {
+        _phaseStart("fork-join");
         _timerStart();
         _dg->computeForkJoinDependencies(_controlFlowGraph.get());
         _statistics.joinsTime = _timerEnd();
+        _phaseEnd("fork-join");
     }
 
     void _runCriticalSectionAnalysis() {
+        _phaseStart("critical-sections");
         _timerStart();
         _dg->computeCriticalSections(_controlFlowGraph.get());
         _statistics.critsecTime = _timerEnd();
+        _phaseEnd("critical-sections");
     }
 
     bool verify() const {
         return _dg->verify();
     }
 
+    // build the graph and all its edges, the pointer analysis has run
+    std::unique_ptr<LLVMDependenceGraph>&& _buildWithEdges() {
+        _runDataDependenceAnalysis();
+
+        // build the graph itself (the nodes, but without edges)
+        _phaseStart("graph");
+        _dg->build(_M, _PTA.get(), _DDA.get(), _entryFunction);
+        _phaseEnd("graph");
+
+        // insert the data dependencies edges
+        _phaseStart("def-use");
+        _dg->addDefUseEdges();
+        _phaseEnd("def-use");
+
+        // compute and fill-in control dependencies
+        _runControlDependenceAnalysis();
+
+        if (_options.threads) {
+            if (_options.PTAOptions.isSVF()) {
+                assert(0 && "Threading needs the DG pointer analysis, SVF is not supported yet");
+                abort();
+            }
+            _controlFlowGraph->buildFunction(_entryFunction);
+            _runInterferenceDependenceAnalysis();
+            _runForkJoinAnalysis();
+            _runCriticalSectionAnalysis();
+        }
+
+        // verify if the graph is built correctly
+        if (_options.verifyGraph && !_dg->verify()) {
+            _dg.reset();
+            return std::move(_dg);
+        }
+
+        return std::move(_dg);
+    }
+
 public:
     LLVMDependenceGraphBuilder(llvm::Module *M)
     : LLVMDependenceGraphBuilder(M, {}) {}
@@ -168,39 +233,41 @@ public:
 
     const Statistics& getStatistics() const { return _statistics; }
 
+    // Call cb(phase, false) when a phase of the construction starts and
+    // cb(phase, true) when it ends. The phases are "pta", "scope", "dda",
+    // "graph", "def-use", "cda" and, with threads, "interference",
+    // "fork-join" and "critical-sections".
+    void setPhaseCallback(std::function<void(const char *, bool)> cb) {
+        _phaseCallback = std::move(cb);
+    }
+
     // construct the whole graph with all edges
     std::unique_ptr<LLVMDependenceGraph>&& build() {
         // compute data dependencies
         _runPointerAnalysis();
-        _runDataDependenceAnalysis();
-
-        // build the graph itself (the nodes, but without edges)
-        _dg->build(_M, _PTA.get(), _DDA.get(), _entryFunction);
-
-        // insert the data dependencies edges
-        _dg->addDefUseEdges();
+        return _buildWithEdges();
+    }
 
-        // compute and fill-in control dependencies
-        _runControlDependenceAnalysis();
+    // Given the results of the pointer analysis, returns the functions
+    // that the graph needs (it should contain the entry function).
+    using FunctionScope =
+        std::function<std::set<const llvm::Function *>(LLVMPointerAnalysis *)>;
 
-        if (_options.threads) {
-            if (_options.PTAOptions.isSVF()) {
-                assert(0 && "Threading needs the DG pointer analysis, SVF is not supported yet");
-                abort();
-            }
-            _controlFlowGraph->buildFunction(_entryFunction);
-            _runInterferenceDependenceAnalysis();
-            _runForkJoinAnalysis();
-            _runCriticalSectionAnalysis();
-        }
+    // Construct the graph with all edges, but only for the functions
+    // that scope returns. The calls of the other functions are handled
+    // like the calls of undefined functions, so their nodes, def-use
+    // edges and control dependencies are never computed.
+    std::unique_ptr<LLVMDependenceGraph>&& build(const FunctionScope& scope) {
+        _runPointerAnalysis();
 
-        // verify if the graph is built correctly
-        if (_options.verifyGraph && !_dg->verify()) {
-            _dg.reset();
-            return std::move(_dg);
-        }
+        _phaseStart("scope");
+        _timerStart();
+        _scope = scope(_PTA.get());
+        _statistics.scopeTime = _timerEnd();
+        _phaseEnd("scope");
+        _dg->setFunctionScope(&_scope);
 
-        return std::move(_dg);
+        return _buildWithEdges();
     }
 
     // Build only the graph with CFG edges.
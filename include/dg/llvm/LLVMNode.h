@@ -64,12 +64,14 @@ public:
             owned_key = std::unique_ptr<llvm::Value>(val);
 #endif
         funcs.insert("_Z15preloadInstAddrPc");
+        funcs.insert("_Z16preloadBlockAddrPcPvS0_");
     }
 
     LLVMNode(llvm::Value *val, LLVMDependenceGraph *dg)
         : LLVMNode(val) {
         setDG(dg);
         funcs.insert("_Z15preloadInstAddrPc");
+        funcs.insert("_Z16preloadBlockAddrPcPvS0_");
     }
 
     LLVMDGParameters *getOrCreateParameters() {
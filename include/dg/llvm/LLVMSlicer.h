@@ -38,9 +38,6 @@ namespace dg {
 
 class LLVMNode;
 
-extern std::map<const llvm::Value *,
-                LLVMDependenceGraph *> constructedFunctions;
-
 namespace llvmdg {
 
 template <typename Val>
@@ -138,7 +135,7 @@ public:
         return 0;
     }
 
-    uint32_t slice(LLVMDependenceGraph *,
+    uint32_t slice(LLVMDependenceGraph *dg,
                    LLVMNode *start, uint32_t sl_id = 0)
     {
         // mark nodes for slicing
@@ -148,7 +145,7 @@ public:
 
         // take every subgraph and slice it intraprocedurally
         // this includes the main graph
-        for (auto& it : constructedFunctions) {
+        for (auto& it : dg->getConstructedFunctions()) {
             if (dontTouch(it.first->getName()))
                 continue;
 
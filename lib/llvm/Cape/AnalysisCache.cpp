@@ -0,0 +1,386 @@
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+// ignore unused parameters in LLVM libraries
+#if (__clang__)
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wunused-parameter"
+#else
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+#endif
+
+#include <llvm/ADT/SmallString.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/IntrinsicInst.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/MD5.h>
+#include <llvm/Support/raw_ostream.h>
+
+#if (__clang__)
+#pragma clang diagnostic pop // ignore -Wunused-parameter
+#else
+#pragma GCC diagnostic pop
+#endif
+
+#include "dg/llvm/Cape/AnalysisCache.h"
+#include "dg/llvm/Cape/SecretAnnotations.h"
+#include "dg/llvm/LLVMDependenceGraph.h"
+#include "dg/llvm/PointerAnalysis/PointerAnalysis.h"
+
+namespace dg {
+namespace llvmdg {
+
+using namespace llvm;
+
+static std::string getMD5(StringRef text) {
+    MD5 hash;
+    hash.update(text);
+    MD5::MD5Result result;
+    hash.final(result);
+    SmallString<32> str;
+    MD5::stringifyResult(result, str);
+    return str.str().str();
+}
+
+bool AnalysisCache::load(const std::string &file, const std::string &k) {
+    key = k;
+    entries.clear();
+
+    std::ifstream in(file);
+    if (!in.is_open()) // the first run
+        return true;
+
+    std::string line;
+    unsigned ver = 0;
+    if (!std::getline(in, line) ||
+        sscanf(line.c_str(), "cape-cache %u", &ver) != 1) {
+        errs() << "ERROR: " << file << " is not a Cape analysis cache\n";
+        return false;
+    }
+    // a cache of other options or an older llvm-dg-dump, start over
+    if (ver != version || !std::getline(in, line) || line != "key " + key)
+        return true;
+
+    unsigned lineNo = 2;
+    while (std::getline(in, line)) {
+        ++lineNo;
+        std::istringstream ss(line);
+        Entry entry;
+        std::string name;
+        if (!(ss >> entry.hash >> entry.marked) || !std::getline(ss >> std::ws, name)) {
+            errs() << "ERROR: " << file << ":" << lineNo << ": malformed function\n";
+            entries.clear();
+            return false;
+        }
+        entries[name] = entry;
+    }
+    return true;
+}
+
+bool AnalysisCache::save(const std::string &file) const {
+    std::ofstream out(file);
+    if (!out) {
+        errs() << "ERROR: cannot write the analysis cache to " << file << "\n";
+        return false;
+    }
+    out << "cape-cache " << version << "\nkey " << key << "\n";
+    for (const auto &it : entries)
+        out << it.second.hash << " " << it.second.marked << " " << it.first << "\n";
+    return true;
+}
+
+class FunctionHasher {
+    LLVMPointerAnalysis *PTA;
+
+    using FunctionSet = std::set<const Function *>;
+    std::map<const Function *, FunctionSet> callees;
+    std::map<const Function *, FunctionSet> callers;
+    std::map<const GlobalVariable *, std::string> globalHashes;
+
+    void addCallee(const Function *F, const Function *G, std::vector<const Function *> &queue,
+                   FunctionSet &seen) {
+        if (G->isDeclaration())
+            return;
+        callees[F].insert(G);
+        callers[G].insert(F);
+        if (seen.insert(G).second)
+            queue.push_back(G);
+    }
+
+    std::string hashGlobal(const GlobalVariable &GV) {
+        auto it = globalHashes.find(&GV);
+        if (it != globalHashes.end())
+            return it->second;
+
+        std::string text;
+        raw_string_ostream out(text);
+        out << *GV.getValueType() << (GV.isConstant() ? " constant" : " global")
+            << (GV.hasAttribute("secret") ? " secret" : "");
+        if (GV.hasInitializer()) {
+            out << " ";
+            GV.getInitializer()->printAsOperand(out, true);
+        }
+        return globalHashes[&GV] = getMD5(out.str());
+    }
+
+    // The globals that V uses (through constant expressions, too).
+    void printGlobals(raw_ostream &out, const Value *V, std::set<const Value *> &visited) {
+        if (!visited.insert(V).second)
+            return;
+        if (auto *GV = dyn_cast<GlobalVariable>(V)) {
+            out << " @" << GV->getName() << "=" << hashGlobal(*GV);
+        } else if (auto *CE = dyn_cast<ConstantExpr>(V)) {
+            for (const Value *op : CE->operands())
+                printGlobals(out, op, visited);
+        }
+    }
+
+    // Add everything reachable from F along the edges.
+    static void addClosure(FunctionSet &set, const Function *F,
+                           std::map<const Function *, FunctionSet> &edges) {
+        std::vector<const Function *> queue{F};
+        while (!queue.empty()) {
+            const Function *G = queue.back();
+            queue.pop_back();
+            for (const Function *H : edges[G]) {
+                if (set.insert(H).second)
+                    queue.push_back(H);
+            }
+        }
+    }
+
+  public:
+    std::vector<const Function *> reachable;
+
+    FunctionHasher(LLVMPointerAnalysis *pta) : PTA(pta) {}
+
+    void buildCallGraph(const Function *entry) {
+        FunctionSet seen{entry};
+        reachable.push_back(entry);
+        for (size_t i = 0; i < reachable.size(); ++i) {
+            const Function *F = reachable[i];
+            for (const BasicBlock &B : *F) {
+                for (const Instruction &I : B) {
+                    auto *CI = dyn_cast<CallInst>(&I);
+                    if (!CI || CI->isInlineAsm())
+                        continue;
+                    const Value *called = CI->getCalledValue()->stripPointerCasts();
+                    if (auto *G = dyn_cast<Function>(called)) {
+                        addCallee(F, G, reachable, seen);
+                    } else {
+                        for (const Function *G : getCalledFunctions(called, PTA))
+                            addCallee(F, G, reachable, seen);
+                    }
+                    // e.g., pthread_create
+                    for (auto it = CI->arg_begin(), et = CI->arg_end(); it != et; ++it) {
+                        if (auto *G = dyn_cast<Function>((*it)->stripPointerCasts()))
+                            addCallee(F, G, reachable, seen);
+                    }
+                }
+            }
+        }
+    }
+
+    // The instructions with their operands and the globals that they
+    // use, the values of the function are numbered, so that their names
+    // and the debug info do not matter.
+    std::string hashFunction(const Function &F) {
+        std::map<const Value *, unsigned> ids;
+        for (const Argument &A : F.args())
+            ids.emplace(&A, ids.size());
+        for (const BasicBlock &B : F) {
+            ids.emplace(&B, ids.size());
+            for (const Instruction &I : B)
+                ids.emplace(&I, ids.size());
+        }
+
+        std::string text;
+        raw_string_ostream out(text);
+        out << *F.getFunctionType();
+        for (const Argument &A : F.args())
+            out << (isSecretParam(&A) ? " secret" : " -");
+        out << "\n";
+        std::set<const Value *> visited;
+        for (const BasicBlock &B : F) {
+            out << "block\n";
+            for (const Instruction &I : B) {
+                if (isa<DbgInfoIntrinsic>(&I))
+                    continue;
+                out << I.getOpcodeName() << " " << *I.getType();
+                if (auto *CI = dyn_cast<CmpInst>(&I))
+                    out << " " << CI->getPredicate();
+                for (const Value *op : I.operands()) {
+                    out << " ";
+                    auto it = ids.find(op);
+                    if (it != ids.end()) {
+                        out << "%" << it->second;
+                    } else if (isa<MetadataAsValue>(op)) {
+                        out << "!";
+                    } else if (auto *GV = dyn_cast<GlobalValue>(op)) {
+                        out << "@" << GV->getName();
+                    } else {
+                        op->printAsOperand(out, true);
+                    }
+                }
+                out << "\n";
+            }
+        }
+        for (const BasicBlock &B : F) {
+            for (const Instruction &I : B) {
+                for (const Value *op : I.operands())
+                    printGlobals(out, op, visited);
+            }
+        }
+        return getMD5(out.str());
+    }
+
+    // The seeds with their callees (which transactions may call) and
+    // their callers up to the entry (so that the graph reaches them).
+    FunctionSet getClosure(const FunctionSet &seeds) {
+        FunctionSet scope(seeds);
+        for (const Function *F : seeds) {
+            addClosure(scope, F, callees);
+            addClosure(scope, F, callers);
+        }
+        return scope;
+    }
+
+    // The memory objects that F loads, stores or passes to calls.
+    // Returns false if F may access unknown memory.
+    bool getObjects(const Function &F, std::set<const Value *> &objects) {
+        bool known = true;
+        auto add = [&](const Value *ptr) {
+            // PTA has no node for the constant pointers into globals
+            if (auto *GV = dyn_cast<GlobalVariable>(ptr->stripInBoundsOffsets())) {
+                objects.insert(GV);
+                return;
+            }
+            auto pts = PTA->getLLVMPointsToChecked(ptr);
+            for (const auto &p : pts.second) {
+                if (p.value)
+                    objects.insert(p.value);
+            }
+            if (!pts.first || pts.second.hasUnknown())
+                known = false;
+        };
+
+        for (const BasicBlock &B : F) {
+            for (const Instruction &I : B) {
+                if (auto *LI = dyn_cast<LoadInst>(&I)) {
+                    add(LI->getPointerOperand());
+                } else if (auto *SI = dyn_cast<StoreInst>(&I)) {
+                    add(SI->getPointerOperand());
+                } else if (auto *CI = dyn_cast<CallInst>(&I)) {
+                    if (isa<DbgInfoIntrinsic>(CI))
+                        continue;
+                    for (auto it = CI->arg_begin(), et = CI->arg_end(); it != et; ++it) {
+                        if ((*it)->getType()->isPointerTy())
+                            add(*it);
+                    }
+                }
+            }
+        }
+        return known;
+    }
+
+    // The functions whose marked nodes the changed functions may change:
+    // the changed functions with their callers and callees, and the
+    // functions that share memory objects with the changed functions,
+    // with their callers (so that the graph reaches them).
+    FunctionSet getAffected(const FunctionSet &changed) {
+        FunctionSet affected = getClosure(changed);
+        if (changed.empty())
+            return affected;
+
+        std::set<const Value *> changedObjects;
+        for (const Function *F : changed) {
+            // the change may reach any memory
+            if (!getObjects(*F, changedObjects))
+                return FunctionSet(reachable.begin(), reachable.end());
+        }
+        if (changedObjects.empty())
+            return affected;
+
+        FunctionSet sharing;
+        for (const Function *F : reachable) {
+            if (affected.count(F) > 0)
+                continue;
+            std::set<const Value *> objects;
+            bool shares = !getObjects(*F, objects);
+            for (const Value *obj : objects) {
+                if (changedObjects.count(obj) > 0)
+                    shares = true;
+            }
+            if (shares)
+                sharing.insert(F);
+        }
+        for (const Function *F : sharing) {
+            affected.insert(F);
+            addClosure(affected, F, callers);
+        }
+        return affected;
+    }
+};
+
+std::set<const Function *> AnalysisCache::getScope(LLVMPointerAnalysis *PTA,
+                                                   const Function *entry) {
+    FunctionHasher hasher(PTA);
+    hasher.buildCallGraph(entry);
+
+    std::map<std::string, Entry> current;
+    std::set<const Function *> changed;
+    for (const Function *F : hasher.reachable) {
+        Entry &cached = current[F->getName().str()];
+        cached.hash = hasher.hashFunction(*F);
+
+        auto it = entries.find(F->getName().str());
+        if (it != entries.end() && it->second.hash == cached.hash)
+            cached.marked = it->second.marked;
+        else
+            changed.insert(F);
+    }
+    // the functions that are no longer reachable are forgotten (their
+    // callers or the function pointers that reached them changed)
+    entries.swap(current);
+
+    // the marked nodes of the affected functions are not known until
+    // the graph is built, the rest is reused
+    auto affected = hasher.getAffected(changed);
+    misses = affected.size();
+    hits = hasher.reachable.size() - misses;
+
+    std::set<const Function *> seeds;
+    for (const Function *F : hasher.reachable) {
+        Entry &cached = entries[F->getName().str()];
+        if (affected.count(F) > 0)
+            cached.marked = 0;
+        else if (cached.marked != 0)
+            seeds.insert(F);
+    }
+    auto scope = hasher.getClosure(seeds);
+    scope.insert(affected.begin(), affected.end());
+    scope.insert(entry);
+    return scope;
+}
+
+void AnalysisCache::update(LLVMDependenceGraph *dg) {
+    for (const auto &it : dg->getConstructedFunctions()) {
+        auto *F = dyn_cast<Function>(it.first);
+        auto entry = F ? entries.find(F->getName().str()) : entries.end();
+        if (entry == entries.end())
+            continue;
+
+        unsigned marked = 0;
+        for (const auto &nodeIt : *it.second) {
+            if (nodeIt.second->getSlice() != 0)
+                ++marked;
+        }
+        entry->second.marked = marked;
+    }
+}
+
+} // namespace llvmdg
+} // namespace dg
@@ -0,0 +1,217 @@
+#include <map>
+#include <set>
+#include <vector>
+
+// ignore unused parameters in LLVM libraries
+#if (__clang__)
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wunused-parameter"
+#else
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+#endif
+
+#include <llvm/Analysis/ValueTracking.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/Dominators.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/raw_ostream.h>
+
+#if (__clang__)
+#pragma clang diagnostic pop // ignore -Wunused-parameter
+#else
+#pragma GCC diagnostic pop
+#endif
+
+#include "dg/llvm/Cape/Cloak.h"
+#include "dg/llvm/PointerAnalysis/PointerAnalysis.h"
+
+namespace dg {
+namespace llvmdg {
+
+using namespace llvm;
+
+static const Value *getObject(const Value *ptr, const DataLayout &DL) {
+#if LLVM_VERSION_MAJOR >= 12
+    (void)DL;
+    return getUnderlyingObject(ptr);
+#else
+    return GetUnderlyingObject(const_cast<Value *>(ptr), DL);
+#endif
+}
+
+class CloakInserter {
+    Module &M;
+    const DataLayout &DL;
+    LLVMPointerAnalysis *PTA;
+
+    // the globals that each function and its callees may access
+    std::map<const Function *, std::set<const GlobalVariable *>> accessed;
+
+    static bool isPreloadable(const GlobalVariable *GV) {
+        return GV->getValueType()->isSized() && !GV->getName().startswith("llvm.");
+    }
+
+    void getCallees(const Function *F, std::vector<const Function *> &callees) {
+        for (const_inst_iterator I = inst_begin(F), E = inst_end(F); I != E; ++I) {
+            auto *CI = dyn_cast<CallInst>(&*I);
+            if (!CI)
+                continue;
+            if (const Function *callee = CI->getCalledFunction()) {
+                callees.push_back(callee);
+            } else if (!CI->isInlineAsm()) {
+                for (const Function &G : M)
+                    if (G.hasAddressTaken())
+                        callees.push_back(&G);
+            }
+        }
+    }
+
+    const std::set<const GlobalVariable *> &getAccessedGlobals(const Function *F) {
+        auto it = accessed.find(F);
+        if (it != accessed.end())
+            return it->second;
+
+        std::set<const GlobalVariable *> &globals = accessed[F];
+        std::set<const Function *> seen{F};
+        std::vector<const Function *> queue{F};
+        while (!queue.empty()) {
+            const Function *G = queue.back();
+            queue.pop_back();
+
+            for (const_inst_iterator I = inst_begin(G), E = inst_end(G); I != E; ++I) {
+                for (const Value *op : I->operands()) {
+                    if (!op->getType()->isPointerTy())
+                        continue;
+                    auto *GV = dyn_cast<GlobalVariable>(getObject(op, DL));
+                    if (GV && isPreloadable(GV))
+                        globals.insert(GV);
+                }
+            }
+
+            std::vector<const Function *> callees;
+            getCallees(G, callees);
+            for (const Function *callee : callees)
+                if (seen.insert(callee).second)
+                    queue.push_back(callee);
+        }
+
+        return globals;
+    }
+
+    void preload(IRBuilder<> &builder, Value *ptr, Value *size) {
+        auto c = M.getOrInsertFunction("_Z13iterateGlobaliPv", builder.getVoidTy(),
+                                       builder.getInt32Ty(), builder.getInt8PtrTy());
+        Value *size32 = builder.CreateIntCast(size, builder.getInt32Ty(), false);
+        Value *pv = builder.CreateBitCast(ptr, builder.getInt8PtrTy());
+        builder.CreateCall(cast<Function>(c), {size32, pv});
+    }
+
+    // Preload what the pointer argument points to.
+    // Returns false if some of the objects cannot be preloaded.
+    bool preloadArgument(IRBuilder<> &builder, CallInst *CI, Value *arg,
+                         std::set<const GlobalVariable *> &globals,
+                         const DominatorTree &DT) {
+        std::vector<LLVMPointer> targets;
+        for (const auto &ptr : PTA->getLLVMPointsTo(arg))
+            targets.push_back(ptr);
+        if (targets.empty())
+            return false;
+
+        bool all = true;
+        for (const LLVMPointer &ptr : targets) {
+            if (auto *GV = dyn_cast<GlobalVariable>(ptr.value)) {
+                if (isPreloadable(GV))
+                    globals.insert(GV);
+            } else if (auto *AI = dyn_cast<AllocaInst>(ptr.value)) {
+                // locals of the caller, including variable-length ones
+                if (AI->getFunction() != CI->getFunction() || !DT.dominates(AI, CI)) {
+                    all = false;
+                    continue;
+                }
+                uint64_t elem = DL.getTypeAllocSize(AI->getAllocatedType());
+                Value *num = builder.CreateIntCast(AI->getArraySize(), builder.getInt64Ty(), false);
+                preload(builder, AI, builder.CreateMul(num, builder.getInt64(elem)));
+            } else {
+                // a malloc'd object is preloaded from the argument,
+                // so it must be the only target and start there
+                auto *alloc = dyn_cast<CallInst>(ptr.value);
+                Function *F = alloc ? alloc->getCalledFunction() : nullptr;
+                auto *size = F && F->getName() == "malloc"
+                                 ? dyn_cast<ConstantInt>(alloc->getArgOperand(0))
+                                 : nullptr;
+                if (!size || targets.size() != 1 || !ptr.offset.isZero()) {
+                    all = false;
+                    continue;
+                }
+                preload(builder, arg, size);
+            }
+        }
+        return all;
+    }
+
+public:
+    CloakInserter(Module &m, LLVMPointerAnalysis *pta)
+        : M(m), DL(m.getDataLayout()), PTA(pta) {}
+
+    void run(CallInst *CI) {
+        Function *callee = CI->getCalledFunction();
+        DominatorTree DT(*CI->getFunction());
+        IRBuilder<> builder(CI);
+
+        auto c = M.getOrInsertFunction("_Z16startTransactionv", builder.getVoidTy());
+        builder.CreateCall(cast<Function>(c));
+        c = M.getOrInsertFunction("_Z23preloadInstAddrForCloakv", builder.getVoidTy());
+        builder.CreateCall(cast<Function>(c));
+
+        std::set<const GlobalVariable *> globals = getAccessedGlobals(callee);
+        for (auto it = CI->arg_begin(), et = CI->arg_end(); it != et; ++it) {
+            Value *arg = *it;
+            if (!arg->getType()->isPointerTy() || isa<ConstantPointerNull>(arg))
+                continue;
+            if (!preloadArgument(builder, CI, arg, globals, DT))
+                errs() << "cloak: cannot preload all objects of argument "
+                       << (it - CI->arg_begin()) << " of " << callee->getName()
+                       << " in " << CI->getFunction()->getName() << "\n";
+        }
+
+        // in the order of the module, so that the output is stable
+        for (GlobalVariable &GV : M.globals()) {
+            if (globals.count(&GV) == 0)
+                continue;
+            preload(builder, &GV, builder.getInt64(DL.getTypeAllocSize(GV.getValueType())));
+        }
+
+        builder.SetInsertPoint(CI->getNextNode());
+        c = M.getOrInsertFunction("_Z14endTransactionv", builder.getVoidTy());
+        builder.CreateCall(cast<Function>(c));
+    }
+};
+
+unsigned addCloakTransactions(Module &M, LLVMPointerAnalysis *PTA) {
+    std::vector<CallInst *> calls;
+    for (Function &F : M) {
+        for (inst_iterator I = inst_begin(F), E = inst_end(F); I != E; ++I) {
+            auto *CI = dyn_cast<CallInst>(&*I);
+            Function *callee = CI ? CI->getCalledFunction() : nullptr;
+            if (callee && callee->hasFnAttribute("cloak"))
+                calls.push_back(CI);
+        }
+    }
+
+    CloakInserter inserter(M, PTA);
+    for (CallInst *CI : calls) {
+        inserter.run(CI);
+        errs() << "cloak: transaction around the call of "
+               << CI->getCalledFunction()->getName() << " in "
+               << CI->getFunction()->getName() << "\n";
+    }
+
+    return calls.size();
+}
+
+} // namespace llvmdg
+} // namespace dg
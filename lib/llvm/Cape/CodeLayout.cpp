@@ -0,0 +1,104 @@
+#include <set>
+#include <vector>
+
+// ignore unused parameters in LLVM libraries
+#if (__clang__)
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wunused-parameter"
+#else
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+#endif
+
+#include <llvm/Analysis/ValueTracking.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/raw_ostream.h>
+
+#if (__clang__)
+#pragma clang diagnostic pop // ignore -Wunused-parameter
+#else
+#pragma GCC diagnostic pop
+#endif
+
+#include "dg/llvm/Cape/CodeLayout.h"
+
+namespace dg {
+namespace llvmdg {
+
+using namespace llvm;
+
+static const char *txStartName = "_Z16startTransactionv";
+static const char *preloadFuncNames[] = {
+    "_Z15preloadInstAddrPc",
+    "_Z16preloadBlockAddrPcPvS0_",
+};
+
+static bool isPreloadCall(const CallInst *CI) {
+    const Function *callee = CI->getCalledFunction();
+    if (!callee)
+        return false;
+    for (const char *name : preloadFuncNames) {
+        if (callee->getName() == name)
+            return true;
+    }
+    return false;
+}
+
+static void addFunction(Function *F, std::vector<Function *> &order,
+                        std::set<Function *> &seen) {
+    if (F && !F->isDeclaration() && seen.insert(F).second)
+        order.push_back(F);
+}
+
+// Collect the functions that run inside transactions in the order
+// in which they are preloaded.
+static std::vector<Function *> getTransactionalFunctions(Module &M) {
+    std::vector<Function *> order;
+    std::set<Function *> seen;
+
+    for (Function &F : M) {
+        for (inst_iterator I = inst_begin(F), E = inst_end(F); I != E; ++I) {
+            auto *CI = dyn_cast<CallInst>(&*I);
+            if (!CI || !CI->getCalledFunction())
+                continue;
+
+            if (CI->getCalledFunction()->getName() == txStartName) {
+                addFunction(&F, order, seen);
+            } else if (isPreloadCall(CI)) {
+                StringRef name;
+                if (getConstantStringInfo(CI->getArgOperand(0), name))
+                    addFunction(M.getFunction(name), order, seen);
+            }
+        }
+    }
+
+    return order;
+}
+
+unsigned clusterTransactionalCode(Module &M, const CapeOptions &opts) {
+    auto funcs = getTransactionalFunctions(M);
+    auto &FL = M.getFunctionList();
+
+    for (Function *F : funcs) {
+        F->setSection(opts.codeSection);
+        if (F->getAlignment() < opts.codeAlignment) {
+#if LLVM_VERSION_MAJOR >= 10
+            F->setAlignment(MaybeAlign(opts.codeAlignment));
+#else
+            F->setAlignment(opts.codeAlignment);
+#endif
+        }
+        // keep the functions adjacent so that the section is laid out
+        // in the order of preloading
+        FL.splice(FL.end(), FL, F->getIterator());
+        errs() << "moved '" << F->getName() << "' to " << opts.codeSection << "\n";
+    }
+
+    return funcs.size();
+}
+
+} // namespace llvmdg
+} // namespace dg
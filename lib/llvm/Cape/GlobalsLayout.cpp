@@ -0,0 +1,173 @@
+#include <algorithm>
+#include <set>
+#include <vector>
+
+// ignore unused parameters in LLVM libraries
+#if (__clang__)
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wunused-parameter"
+#else
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+#endif
+
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/DataLayout.h>
+#include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/GlobalVariable.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Transforms/Utils/ModuleUtils.h>
+
+#if (__clang__)
+#pragma clang diagnostic pop // ignore -Wunused-parameter
+#else
+#pragma GCC diagnostic pop
+#endif
+
+#include "dg/llvm/Cape/GlobalsLayout.h"
+
+namespace dg {
+namespace llvmdg {
+
+using namespace llvm;
+
+// the preloads of globals, for reading and with write intent
+static const char *iterateGlobalNames[] = {
+    "_Z13iterateGlobaliPv",
+    "_Z14iterateGlobalWiPv",
+};
+
+// Collect the globals that are preloaded into some transaction.
+static std::vector<GlobalVariable *> getPreloadedGlobals(Module &M) {
+    std::vector<GlobalVariable *> globals;
+    std::set<GlobalVariable *> seen;
+
+    std::set<const Function *> iterateGlobal;
+    for (const char *name : iterateGlobalNames) {
+        if (Function *F = M.getFunction(name))
+            iterateGlobal.insert(F);
+    }
+    if (iterateGlobal.empty())
+        return globals;
+
+    for (Function &F : M) {
+        for (inst_iterator I = inst_begin(F), E = inst_end(F); I != E; ++I) {
+            auto *CI = dyn_cast<CallInst>(&*I);
+            if (!CI || iterateGlobal.count(CI->getCalledFunction()) == 0)
+                continue;
+
+            // a bounded preload passes a pointer into the global
+            auto *GV = dyn_cast<GlobalVariable>(CI->getArgOperand(1)->stripInBoundsOffsets());
+            // we can change only the globals that are defined here
+            // and that are not placed explicitly by the programmer
+            if (!GV || GV->isDeclaration() || GV->hasSection() ||
+                GV->isThreadLocal())
+                continue;
+
+            if (seen.insert(GV).second)
+                globals.push_back(GV);
+        }
+    }
+
+    return globals;
+}
+
+static unsigned getLayoutAlignment(uint64_t size, const CapeOptions &opts) {
+    if (size >= opts.dataAlignment)
+        return std::max(opts.dataAlignment, opts.lineSize);
+    if (size >= opts.lineSize)
+        return opts.lineSize;
+    return 0;
+}
+
+static void raiseAlignment(GlobalVariable *GV, unsigned align) {
+    if (GV->getAlignment() >= align)
+        return;
+#if LLVM_VERSION_MAJOR >= 10
+    GV->setAlignment(MaybeAlign(align));
+#else
+    GV->setAlignment(align);
+#endif
+}
+
+// Make the section start at a huge page boundary and pad it
+// to a multiple of the huge page, so that the runtime can remap it
+// to huge pages without touching the neighbouring data.
+static void padToHugePages(Module &M, StringRef section, bool isConst,
+                           const CapeOptions &opts) {
+    const DataLayout &DL = M.getDataLayout();
+    GlobalVariable *first = nullptr;
+    uint64_t end = 0;
+
+    for (GlobalVariable &GV : M.globals()) {
+        if (!GV.hasSection() || GV.getSection() != section)
+            continue;
+
+        if (!first) {
+            first = &GV;
+            raiseAlignment(first, opts.hugePageSize);
+        }
+#if LLVM_VERSION_MAJOR >= 11
+        uint64_t align = DL.getPreferredAlign(&GV).value();
+#else
+        uint64_t align = DL.getPreferredAlignment(&GV);
+#endif
+        end = (end + align - 1) / align * align;
+        end += DL.getTypeAllocSize(GV.getValueType());
+    }
+
+    if (!first || end % opts.hugePageSize == 0)
+        return;
+
+    uint64_t pad = opts.hugePageSize - end % opts.hugePageSize;
+    auto *T = ArrayType::get(Type::getInt8Ty(M.getContext()), pad);
+    // private to the module, so that more instrumented units can be
+    // linked together; llvm.used keeps it from the optimizer
+    auto *GV = new GlobalVariable(M, T, isConst, GlobalValue::PrivateLinkage,
+                                  ConstantAggregateZero::get(T),
+                                  std::string("__") + section.str() + "_pad");
+    GV->setSection(section);
+    appendToUsed(M, {GV});
+    errs() << "padded " << section << " by " << pad << " B to huge pages\n";
+}
+
+unsigned packPreloadedGlobals(Module &M, const CapeOptions &opts) {
+    auto globals = getPreloadedGlobals(M);
+    const DataLayout &DL = M.getDataLayout();
+
+    auto getSize = [&DL](const GlobalVariable *GV) {
+        return DL.getTypeAllocSize(GV->getValueType());
+    };
+
+    // the biggest first, so that the small globals are packed
+    // together and do not make the big ones straddle a line
+    std::stable_sort(globals.begin(), globals.end(),
+                     [&getSize](const GlobalVariable *a, const GlobalVariable *b) {
+                         return getSize(a) > getSize(b);
+                     });
+
+    auto &GL = M.getGlobalList();
+    for (GlobalVariable *GV : globals) {
+        uint64_t size = getSize(GV);
+        GV->setSection(GV->isConstant() ? opts.rodataSection : opts.dataSection);
+
+        raiseAlignment(GV, getLayoutAlignment(size, opts));
+
+        GL.splice(GL.end(), GL, GV->getIterator());
+        errs() << "moved '" << GV->getName() << "' (" << size << " B, align "
+               << GV->getAlignment() << ") to " << GV->getSection() << "\n";
+    }
+
+    if (opts.hugePages) {
+        padToHugePages(M, opts.dataSection, false, opts);
+        padToHugePages(M, opts.rodataSection, true, opts);
+    }
+
+    return globals.size();
+}
+
+} // namespace llvmdg
+} // namespace dg
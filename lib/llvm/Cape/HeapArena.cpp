@@ -0,0 +1,167 @@
+#include <vector>
+
+// ignore unused parameters in LLVM libraries
+#if (__clang__)
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wunused-parameter"
+#else
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+#endif
+
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/raw_ostream.h>
+
+#if (__clang__)
+#pragma clang diagnostic pop // ignore -Wunused-parameter
+#else
+#pragma GCC diagnostic pop
+#endif
+
+#include "dg/llvm/Cape/HeapArena.h"
+
+namespace dg {
+namespace llvmdg {
+
+using namespace llvm;
+
+static bool isCallTo(const Instruction *I, const Function *F) {
+    auto *CI = dyn_cast<CallInst>(I);
+    return F && CI && CI->getCalledFunction() == F;
+}
+
+static std::vector<CallInst *> getCallsTo(Module &M, const Function *F) {
+    std::vector<CallInst *> calls;
+    if (!F)
+        return calls;
+
+    for (Function &Fn : M) {
+        for (inst_iterator I = inst_begin(Fn), E = inst_end(Fn); I != E; ++I) {
+            if (isCallTo(&*I, F))
+                calls.push_back(cast<CallInst>(&*I));
+        }
+    }
+    return calls;
+}
+
+// insertMallocSet(bid, size, ptr) -> capeArenaMalloc(bid, malloc size)
+static unsigned redirectMallocs(Module &M) {
+    Function *mallocF = M.getFunction("malloc");
+    auto inserts = getCallsTo(M, M.getFunction("_Z15insertMallocSetiiPv"));
+    unsigned num = 0;
+
+    for (CallInst *ins : inserts) {
+        auto *mCI = dyn_cast<CallInst>(ins->getArgOperand(2)->stripPointerCasts());
+        if (!mCI || mCI->getCalledFunction() != mallocF) {
+            errs() << "cannot find the malloc of a sensitive buffer\n";
+            continue;
+        }
+
+        IRBuilder<> builder(mCI);
+        Value *size = mCI->getArgOperand(0);
+        auto c = M.getOrInsertFunction("_Z15capeArenaMallocim", builder.getInt8PtrTy(),
+                                       builder.getInt32Ty(), size->getType());
+        Function *am = cast<Function>(c);
+
+        std::vector<Value *> args1;
+        args1.push_back(ins->getArgOperand(0));
+        args1.push_back(size);
+        auto nCI = builder.CreateCall(am, args1);
+        nCI->setDebugLoc(mCI->getDebugLoc());
+        Value *nv = builder.CreateBitCast(nCI, mCI->getType());
+
+        ins->eraseFromParent();
+        mCI->replaceAllUsesWith(nv);
+        mCI->eraseFromParent();
+        ++num;
+    }
+
+    return num;
+}
+
+// the arena runtime itself falls back to the libc functions
+static bool isArenaRuntime(const Function *F) {
+    return F->getName().find("capeArena") != StringRef::npos;
+}
+
+// Replace every use of the libc function name (direct calls, calls
+// through a cast, its address in code and in the initializers of
+// globals, e.g. allocator tables) outside of the arena runtime by the
+// arena function arenaName of the same type.
+static void redirectLibcFunction(Module &M, const char *name, const char *arenaName) {
+    Function *F = M.getFunction(name);
+    if (!F || F->use_empty())
+        return;
+
+    Constant *arenaF = M.getOrInsertFunction(arenaName, F->getFunctionType());
+    if (arenaF->getType() != F->getType())
+        arenaF = ConstantExpr::getBitCast(arenaF, F->getType());
+
+    // the operands of the arena runtime that use F directly or through
+    // a constant cast (the opcode and type of the cast, 0 if direct);
+    // the runtime keeps calling libc
+    struct RuntimeUse {
+        Instruction *I;
+        unsigned idx;
+        unsigned cast;
+        Type *type;
+    };
+    std::vector<RuntimeUse> runtimeUses;
+    auto isRuntimeUse = [](const Use &U) {
+        auto *I = dyn_cast<Instruction>(U.getUser());
+        return I && isArenaRuntime(I->getFunction());
+    };
+    for (Use &U : F->uses()) {
+        if (isRuntimeUse(U)) {
+            runtimeUses.push_back({cast<Instruction>(U.getUser()), U.getOperandNo(), 0, nullptr});
+        } else if (auto *CE = dyn_cast<ConstantExpr>(U.getUser())) {
+            if (!CE->isCast())
+                continue;
+            for (Use &CU : CE->uses()) {
+                if (isRuntimeUse(CU))
+                    runtimeUses.push_back({cast<Instruction>(CU.getUser()), CU.getOperandNo(),
+                                           CE->getOpcode(), CE->getType()});
+            }
+        }
+    }
+
+    // the constants that use F cannot be changed for only some of their
+    // users, so replace all of them and give the runtime F back
+    F->replaceAllUsesWith(arenaF);
+    for (const RuntimeUse &U : runtimeUses) {
+        Constant *orig = F;
+        if (U.cast != 0)
+            orig = ConstantExpr::getCast(U.cast, F, U.type);
+        U.I->setOperand(U.idx, orig);
+    }
+}
+
+// free(ptr) -> capeArenaFree(ptr), realloc(ptr, size) ->
+// capeArenaRealloc(ptr, size) and the same for reallocarray. A pointer
+// from an arena may reach any of them, not only the frees preceded by
+// eraseMallocSet(), and the arena functions fall back to the libc ones
+// for other pointers.
+static void redirectFrees(Module &M) {
+    redirectLibcFunction(M, "free", "_Z13capeArenaFreePv");
+    redirectLibcFunction(M, "realloc", "_Z16capeArenaReallocPvm");
+    redirectLibcFunction(M, "reallocarray", "_Z21capeArenaReallocArrayPvmm");
+
+    // capeArenaFree() forgets the object itself
+    for (CallInst *er : getCallsTo(M, M.getFunction("_Z14eraseMallocSetiPv"))) {
+        if (er->use_empty())
+            er->eraseFromParent();
+    }
+}
+
+unsigned redirectSensitiveMallocs(Module &M) {
+    unsigned num = redirectMallocs(M);
+    if (num > 0)
+        redirectFrees(M);
+    return num;
+}
+
+} // namespace llvmdg
+} // namespace dg
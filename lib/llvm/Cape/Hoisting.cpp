@@ -0,0 +1,159 @@
+#include <set>
+#include <vector>
+
+// ignore unused parameters in LLVM libraries
+#if (__clang__)
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wunused-parameter"
+#else
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+#endif
+
+#include <llvm/Analysis/ValueTracking.h>
+#include <llvm/IR/Dominators.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/IntrinsicInst.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/raw_ostream.h>
+
+#if (__clang__)
+#pragma clang diagnostic pop // ignore -Wunused-parameter
+#else
+#pragma GCC diagnostic pop
+#endif
+
+#include "dg/llvm/Cape/Hoisting.h"
+#include "dg/llvm/Cape/SecretTaint.h"
+#include "dg/llvm/Cape/Sites.h"
+
+namespace dg {
+namespace llvmdg {
+
+using namespace llvm;
+
+class Hoister {
+    const SecretTaint &taint;
+    const std::function<bool(const Instruction *)> &isMarked;
+
+    bool isMovable(const Instruction &I, const TransactionRegion &T) const {
+        if (isa<PHINode>(I) || I.isTerminator() || isa<DbgInfoIntrinsic>(I))
+            return false;
+        if (isMarked(&I) || taint.isTainted(&I))
+            return false;
+        if (!isSafeToSpeculativelyExecute(&I))
+            return false;
+        return !I.mayReadFromMemory() || !T.writesMemory;
+    }
+
+    static bool isAvailableAtEntry(const Value *v, const TransactionRegion &T) {
+        auto *I = dyn_cast<Instruction>(v);
+        return !I || !T.contains(I);
+    }
+
+    // the instructions of the transaction, each before its users
+    // (but in loops and merges of branches)
+    static std::vector<Instruction *> getInstructions(const TransactionRegion &T) {
+        std::vector<Instruction *> insts;
+        const BasicBlock *start = T.xbegin->getParent();
+        for (Instruction *I : T.partial)
+            if (I->getParent() == start)
+                insts.push_back(I);
+        for (BasicBlock *B : T.blocks)
+            for (Instruction &I : *B)
+                insts.push_back(&I);
+        for (Instruction *I : T.partial)
+            if (I->getParent() != start)
+                insts.push_back(I);
+        return insts;
+    }
+
+    unsigned hoist(TransactionRegion &T) {
+        unsigned num = 0;
+        for (Instruction *I : getInstructions(T)) {
+            if (!isMovable(*I, T))
+                continue;
+
+            bool available = true;
+            for (const Value *op : I->operands())
+                available &= isAvailableAtEntry(op, T);
+            if (!available)
+                continue;
+
+            I->moveBefore(T.xbegin);
+            T.partialSet.erase(I);
+            ++num;
+        }
+        return num;
+    }
+
+    unsigned sink(TransactionRegion &T) {
+        if (!T.xend)
+            return 0;
+
+        // the sunk instruction (and so its operands) must dominate xend
+        DominatorTree DT(*T.xbegin->getFunction());
+        const BasicBlock *start = T.xbegin->getParent();
+        bool sameBlock = T.xend->getParent() == start;
+        unsigned num = 0;
+        // go backwards, so that the users are sunk first
+        auto insts = getInstructions(T);
+        for (auto it = insts.rbegin(); it != insts.rend(); ++it) {
+            Instruction &I = **it;
+            if (!T.contains(&I) || !isMovable(I, T) || I.use_empty() ||
+                !DT.dominates(I.getParent(), T.xend->getParent()))
+                continue;
+
+            // all users must follow xend (a phi uses the value on an edge);
+            // the users out of the transaction in its first block precede
+            // xbegin, unless the transaction ends in that block
+            bool after = true;
+            for (const User *U : I.users()) {
+                auto *UI = dyn_cast<Instruction>(U);
+                after &= UI && !isa<PHINode>(UI) && !T.contains(UI) &&
+                         (sameBlock || UI->getParent() != start);
+            }
+            if (!after)
+                continue;
+
+            I.moveAfter(T.xend);
+            T.partialSet.erase(&I);
+            ++num;
+        }
+        return num;
+    }
+
+public:
+    Hoister(const SecretTaint &t, const std::function<bool(const Instruction *)> &m)
+        : taint(t), isMarked(m) {}
+
+    unsigned run(CallInst *xbegin) {
+        TransactionRegion T = getTransactionRegion(xbegin);
+        if (T.empty())
+            return 0;
+        return hoist(T) + sink(T);
+    }
+};
+
+unsigned hoistOutOfTransactions(Module &M,
+                                const std::function<bool(const Instruction *)> &isMarked) {
+    SecretTaint taint(M);
+    Hoister hoister(taint, isMarked);
+    unsigned num = 0;
+
+    auto sites = getTransactionSites(M);
+    for (unsigned id = 0; id < sites.size(); ++id) {
+        if (!sites[id])
+            continue;
+        unsigned n = hoister.run(sites[id]);
+        if (n > 0)
+            errs() << "moved " << n << " secret-independent instructions out of site "
+                   << id << "\n";
+        num += n;
+    }
+
+    return num;
+}
+
+} // namespace llvmdg
+} // namespace dg
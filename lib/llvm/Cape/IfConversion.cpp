@@ -0,0 +1,202 @@
+#include <set>
+#include <vector>
+
+// ignore unused parameters in LLVM libraries
+#if (__clang__)
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wunused-parameter"
+#else
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+#endif
+
+#include <llvm/Analysis/ValueTracking.h>
+#include <llvm/IR/CFG.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/InlineAsm.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/IntrinsicInst.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/raw_ostream.h>
+
+#if (__clang__)
+#pragma clang diagnostic pop // ignore -Wunused-parameter
+#else
+#pragma GCC diagnostic pop
+#endif
+
+#include "dg/llvm/Cape/IfConversion.h"
+#include "dg/llvm/Cape/SecretTaint.h"
+
+namespace dg {
+namespace llvmdg {
+
+using namespace llvm;
+
+class IfConverter {
+    const CapeOptions &opts;
+    const SecretTaint &taint;
+    // the mask barriers that we created (they are safe to speculate)
+    std::set<const Instruction *> created;
+
+    static bool canSelect(Type *T) {
+        return (T->isIntegerTy() && T->getIntegerBitWidth() <= 64) ||
+               T->isPointerTy() || T->isFloatTy() || T->isDoubleTy();
+    }
+
+    // Is the block a side-effect free arm of the branch in B
+    // that ends with a jump to J?
+    bool isConvertibleArm(BasicBlock *arm, BasicBlock *B, BasicBlock *J) const {
+        if (arm->getSinglePredecessor() != B || arm->getSingleSuccessor() != J)
+            return false;
+
+        unsigned num = 0;
+        for (Instruction &I : *arm) {
+            if (&I == arm->getTerminator())
+                break;
+            if (isa<DbgInfoIntrinsic>(I))
+                continue;
+            if (isa<PHINode>(I) || ++num > opts.ifConvertMaxInsts)
+                return false;
+            if (!created.count(&I) && !isSafeToSpeculativelyExecute(&I))
+                return false;
+            // a secret-indexed access must stay in a transaction
+            if (auto *LI = dyn_cast<LoadInst>(&I))
+                if (taint.isTainted(LI->getPointerOperand()))
+                    return false;
+        }
+        return true;
+    }
+
+    // An identity on the mask that the optimizer cannot see through.
+    Value *hideFromOptimizer(IRBuilder<> &builder, Value *v) {
+        auto *FT = FunctionType::get(v->getType(), {v->getType()}, false);
+        auto *barrier = InlineAsm::get(FT, "", "=r,0", false);
+        auto *CI = builder.CreateCall(barrier, {v});
+        created.insert(CI);
+        return CI;
+    }
+
+    // mask ? a : b without a branch or a select,
+    // mask is all ones or all zeros
+    Value *createCTSelect(IRBuilder<> &builder, Value *mask, Value *a, Value *b) {
+        Type *T = a->getType();
+        Type *I64 = builder.getInt64Ty();
+        auto toInt = [&](Value *v) -> Value * {
+            if (T->isPointerTy())
+                return builder.CreatePtrToInt(v, I64);
+            if (T->isFloatingPointTy())
+                v = builder.CreateBitCast(v, builder.getIntNTy(T->getPrimitiveSizeInBits()));
+            return builder.CreateZExtOrTrunc(v, I64);
+        };
+
+        Value *r = builder.CreateOr(builder.CreateAnd(toInt(a), mask),
+                                    builder.CreateAnd(toInt(b), builder.CreateNot(mask)));
+
+        if (T->isPointerTy())
+            return builder.CreateIntToPtr(r, T);
+        if (T->isFloatingPointTy())
+            return builder.CreateBitCast(builder.CreateTrunc(r, builder.getIntNTy(T->getPrimitiveSizeInBits())), T);
+        return builder.CreateTrunc(r, T);
+    }
+
+    bool tryConvert(BasicBlock *B) {
+        auto *br = dyn_cast<BranchInst>(B->getTerminator());
+        if (!br || !br->isConditional() || !taint.isTainted(br->getCondition()))
+            return false;
+
+        BasicBlock *T = br->getSuccessor(0);
+        BasicBlock *F = br->getSuccessor(1);
+        BasicBlock *J = nullptr;
+        std::vector<BasicBlock *> arms;
+
+        if (T->getSingleSuccessor() == F && isConvertibleArm(T, B, F)) {
+            J = F; // triangle, the true arm
+            arms.push_back(T);
+        } else if (F->getSingleSuccessor() == T && isConvertibleArm(F, B, T)) {
+            J = T; // triangle, the false arm
+            arms.push_back(F);
+        } else if (T->getSingleSuccessor() && T->getSingleSuccessor() == F->getSingleSuccessor() &&
+                   isConvertibleArm(T, B, T->getSingleSuccessor()) &&
+                   isConvertibleArm(F, B, F->getSingleSuccessor())) {
+            J = T->getSingleSuccessor(); // diamond
+            arms.push_back(T);
+            arms.push_back(F);
+        } else {
+            return false;
+        }
+
+        if (J == B)
+            return false;
+        // the edges into the join, taken when the condition is true/false
+        BasicBlock *predT = (J == T) ? B : T;
+        BasicBlock *predF = (J == F) ? B : F;
+        for (auto it = J->begin(); auto *phi = dyn_cast<PHINode>(&*it); ++it) {
+            if (!canSelect(phi->getType()))
+                return false;
+        }
+
+        // execute the arms unconditionally
+        for (BasicBlock *arm : arms) {
+            while (&arm->front() != arm->getTerminator())
+                arm->front().moveBefore(br);
+        }
+
+        IRBuilder<> builder(br);
+        Value *mask = hideFromOptimizer(builder, builder.CreateSExt(br->getCondition(),
+                                                                    builder.getInt64Ty()));
+        for (auto it = J->begin(); auto *phi = dyn_cast<PHINode>(&*it); ++it) {
+            Value *sel = createCTSelect(builder, mask,
+                                        phi->getIncomingValueForBlock(predT),
+                                        phi->getIncomingValueForBlock(predF));
+            phi->removeIncomingValue(predT, false);
+            phi->removeIncomingValue(predF, false);
+            phi->addIncoming(sel, B);
+        }
+
+        BranchInst::Create(J, br);
+        br->eraseFromParent();
+        for (BasicBlock *arm : arms)
+            arm->eraseFromParent();
+
+        return true;
+    }
+
+public:
+    IfConverter(const CapeOptions &o, const SecretTaint &t) : opts(o), taint(t) {}
+
+    unsigned run(Function &F) {
+        unsigned num = 0;
+        bool changed;
+        do {
+            changed = false;
+            for (BasicBlock &B : F) {
+                if (tryConvert(&B)) {
+                    changed = true;
+                    ++num;
+                    break;
+                }
+            }
+        } while (changed);
+        return num;
+    }
+};
+
+unsigned convertSecretBranches(Module &M, const CapeOptions &opts) {
+    SecretTaint taint(M);
+    IfConverter converter(opts, taint);
+    unsigned num = 0;
+
+    for (Function &F : M) {
+        unsigned n = converter.run(F);
+        if (n > 0)
+            errs() << "if-converted " << n << " secret-dependent branches in "
+                   << F.getName() << "\n";
+        num += n;
+    }
+
+    return num;
+}
+
+} // namespace llvmdg
+} // namespace dg
@@ -0,0 +1,818 @@
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <cctype>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+// ignore unused parameters in LLVM libraries
+#if (__clang__)
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wunused-parameter"
+#else
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+#endif
+
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/DebugInfoMetadata.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/Format.h>
+#include <llvm/Support/raw_os_ostream.h>
+#include <llvm/Support/raw_ostream.h>
+
+#if (__clang__)
+#pragma clang diagnostic pop // ignore -Wunused-parameter
+#else
+#pragma GCC diagnostic pop
+#endif
+
+#include "dg/llvm/Cape/Plan.h"
+
+namespace dg {
+namespace llvmdg {
+
+using namespace llvm;
+
+using Kind = PlanAction::Kind;
+
+void InstrumentationPlan::addTransactionStart(Instruction *at) {
+    actions.emplace_back(Kind::TransactionStart, at);
+}
+
+void InstrumentationPlan::addTransactionEnd(Instruction *at) {
+    actions.emplace_back(Kind::TransactionEnd, at);
+}
+
+void InstrumentationPlan::addPreloadCode(Instruction *at, const std::string &name) {
+    actions.emplace_back(Kind::PreloadCode, at);
+    actions.back().name = name;
+}
+
+void InstrumentationPlan::addPreloadBlock(Instruction *at, const std::string &name,
+                                          BasicBlock *B) {
+    actions.emplace_back(Kind::PreloadBlock, at);
+    actions.back().name = name;
+    actions.back().block = B;
+}
+
+void InstrumentationPlan::addPreloadAlloc(Instruction *at, uint32_t buffer, bool write) {
+    actions.emplace_back(Kind::PreloadAlloc, at);
+    actions.back().buffer = buffer;
+    actions.back().write = write;
+}
+
+void InstrumentationPlan::addPreloadMalloc(Instruction *at, uint32_t buffer, bool write) {
+    actions.emplace_back(Kind::PreloadMalloc, at);
+    actions.back().buffer = buffer;
+    actions.back().write = write;
+}
+
+void InstrumentationPlan::addPreloadGlobal(Instruction *at, Value *global, bool write,
+                                           uint64_t offset, uint64_t length) {
+    actions.emplace_back(Kind::PreloadGlobal, at);
+    actions.back().object = global;
+    actions.back().write = write;
+    actions.back().offset = offset;
+    actions.back().length = length;
+}
+
+void InstrumentationPlan::addPushAlloc(Instruction *at, uint32_t buffer, Value *alloca) {
+    actions.emplace_back(Kind::PushAlloc, at);
+    actions.back().buffer = buffer;
+    actions.back().object = alloca;
+}
+
+void InstrumentationPlan::addPopAlloc(Instruction *at, uint32_t buffer) {
+    actions.emplace_back(Kind::PopAlloc, at);
+    actions.back().buffer = buffer;
+}
+
+void InstrumentationPlan::addInsertMalloc(Instruction *at, uint32_t buffer, Value *call) {
+    actions.emplace_back(Kind::InsertMalloc, at);
+    actions.back().buffer = buffer;
+    actions.back().object = call;
+}
+
+void InstrumentationPlan::addEraseMalloc(Instruction *at, uint32_t buffer) {
+    actions.emplace_back(Kind::EraseMalloc, at);
+    actions.back().buffer = buffer;
+}
+
+// This tries to get debug info from the instruction before which a new
+// instruction will be inserted, and if there's no debug info in that
+// instruction, tries to get the info instead from the previous instruction (if
+// any). If none of these has debug info and a DISubprogram is provided, it
+// creates a dummy debug info with the first line of the function, because IR
+// verifier requires all inlinable callsites should have debug info when both a
+// caller and callee have DISubprogram. If none of these conditions are met,
+// returns empty info.
+static DebugLoc getOrCreateDebugLoc(const Instruction *InsertBefore, DISubprogram *SP) {
+    assert(InsertBefore);
+    if (InsertBefore->getDebugLoc())
+        return InsertBefore->getDebugLoc();
+    const Instruction *Prev = InsertBefore->getPrevNode();
+    if (Prev && Prev->getDebugLoc())
+        return Prev->getDebugLoc();
+    if (SP)
+        return llvm::DILocation::get(SP->getContext(), SP->getLine(), 1, SP);
+    return DebugLoc();
+}
+
+static void setDebugLoc(Instruction *nIns, Instruction *ins) {
+    if (!nIns->getDebugLoc())
+        nIns->setDebugLoc(getOrCreateDebugLoc(ins, ins->getFunction()->getSubprogram()));
+}
+
+static uint64_t getConstantValue(const Value *op) {
+    uint64_t size = 0;
+    if (const ConstantInt *C = dyn_cast<ConstantInt>(op)) {
+        size = C->getLimitedValue();
+        // if the size cannot be expressed as an uint64_t,
+        // just set it to 0 (that means unknown)
+        if (size == ~(static_cast<uint64_t>(0)))
+            size = 0;
+    }
+    return size;
+}
+
+// The runtime function of the action (with write intent if write).
+static Function *declareRuntime(Module *M, Kind kind, bool write) {
+    LLVMContext &ctx = M->getContext();
+    Type *voidTy = Type::getVoidTy(ctx);
+    Type *i32 = Type::getInt32Ty(ctx);
+    Type *i64 = Type::getInt64Ty(ctx);
+    Type *i8p = Type::getInt8PtrTy(ctx);
+
+    switch (kind) {
+    case Kind::TransactionStart:
+        return cast<Function>(M->getOrInsertFunction("_Z16startTransactionv", voidTy));
+    case Kind::TransactionEnd:
+        return cast<Function>(M->getOrInsertFunction("_Z14endTransactionv", voidTy));
+    case Kind::PreloadCode:
+        return cast<Function>(M->getOrInsertFunction("_Z15preloadInstAddrPc", voidTy, i8p));
+    case Kind::PreloadBlock:
+        return cast<Function>(
+                M->getOrInsertFunction("_Z16preloadBlockAddrPcPvS0_", voidTy, i8p, i8p, i8p));
+    case Kind::PreloadAlloc:
+        return cast<Function>(M->getOrInsertFunction(
+                write ? "_Z18iterateAllocStackWi" : "_Z17iterateAllocStacki", voidTy, i32));
+    case Kind::PreloadMalloc:
+        return cast<Function>(M->getOrInsertFunction(
+                write ? "_Z17iterateMallocSetWi" : "_Z16iterateMallocSeti", voidTy, i32));
+    case Kind::PreloadGlobal:
+        return cast<Function>(M->getOrInsertFunction(
+                write ? "_Z14iterateGlobalWiPv" : "_Z13iterateGlobaliPv", voidTy, i32, i8p));
+    case Kind::PushAlloc:
+        return cast<Function>(
+                M->getOrInsertFunction("_Z14pushAllocStackiliPv", voidTy, i32, i64, i32, i8p));
+    case Kind::PopAlloc:
+        return cast<Function>(M->getOrInsertFunction("_Z13popAllocStacki", voidTy, i32));
+    case Kind::InsertMalloc:
+        return cast<Function>(
+                M->getOrInsertFunction("_Z15insertMallocSetiiPv", voidTy, i32, i32, i8p));
+    case Kind::EraseMalloc:
+        return cast<Function>(M->getOrInsertFunction("_Z14eraseMallocSetiPv",
+                                                     Type::getInt1Ty(ctx), i32, i8p));
+    }
+    llvm_unreachable("unknown plan action");
+}
+
+static const unsigned kindsNum = static_cast<unsigned>(Kind::EraseMalloc) + 1;
+
+class PlanApplier {
+    // The module-level part of the instrumentation: the declarations of
+    // the runtime functions (by the kind and the write intent) and one
+    // string per preloaded function name. It is created up front, in the
+    // order of the plan, so that the functions are then instrumented one
+    // by one without touching the module.
+    Function *runtime[kindsNum][2] = {};
+    std::map<std::string, Value *> names;
+
+    void declare(const PlanAction &A) {
+        Function *&fun = runtime[static_cast<unsigned>(A.kind)][A.write];
+        if (!fun)
+            fun = declareRuntime(A.at->getModule(), A.kind, A.write);
+
+        if ((A.kind == Kind::PreloadCode || A.kind == Kind::PreloadBlock) &&
+            names.count(A.name) == 0) {
+            IRBuilder<> builder(A.at);
+            names[A.name] = builder.CreateGlobalStringPtr(A.name);
+        }
+    }
+
+    // The block is delimited by its own address and by the address of
+    // the block that follows it in the function layout. If there is no
+    // such block (or the final layout does not match the IR order), the
+    // runtime falls back to the bounds of the function from funcMap.
+    static void getBlockRange(IRBuilder<> &builder, BasicBlock *B, Value *&bstart,
+                              Value *&bend) {
+        Function *F = B->getParent();
+        // taking the address of the entry block is illegal,
+        // but the entry block starts where the function starts
+        if (B == &F->getEntryBlock())
+            bstart = builder.CreateBitCast(F, builder.getInt8PtrTy());
+        else
+            bstart = BlockAddress::get(F, B);
+
+        if (BasicBlock *next = B->getNextNode())
+            bend = BlockAddress::get(F, next);
+        else
+            bend = ConstantPointerNull::get(builder.getInt8PtrTy());
+    }
+
+    // The buffer is registered right after it is allocated, before the
+    // calls that the earlier actions put in front of the next instruction.
+    static Instruction *getInsertPoint(const PlanAction &A) {
+        if (A.kind == Kind::PushAlloc || A.kind == Kind::InsertMalloc) {
+            auto *obj = cast<Instruction>(A.object);
+            if (obj != A.at)
+                return obj->getNextNode();
+        }
+        return A.at;
+    }
+
+    void apply(const PlanAction &A) {
+        IRBuilder<> builder(getInsertPoint(A));
+        const DataLayout &DL = A.at->getModule()->getDataLayout();
+        Function *fun = runtime[static_cast<unsigned>(A.kind)][A.write];
+        std::vector<Value *> args;
+
+        switch (A.kind) {
+        case Kind::TransactionStart:
+        case Kind::TransactionEnd:
+            break;
+        case Kind::PreloadCode:
+            args.push_back(names[A.name]);
+            break;
+        case Kind::PreloadBlock: {
+            Value *bstart;
+            Value *bend;
+            getBlockRange(builder, A.block, bstart, bend);
+            args = {names[A.name], bstart, bend};
+            break;
+        }
+        case Kind::PreloadAlloc:
+        case Kind::PreloadMalloc:
+        case Kind::PopAlloc:
+            args.push_back(builder.getInt32(A.buffer));
+            break;
+        case Kind::PreloadGlobal: {
+            auto *gv = cast<GlobalVariable>(A.object);
+            int size = DL.getTypeAllocSize(gv->getValueType()); // # Byte
+            Value *ptr = builder.CreateBitCast(gv, builder.getInt8PtrTy());
+            if (A.length) {
+                // only the bytes that the sensitive accesses may reach
+                size = A.length;
+                ptr = builder.CreateInBoundsGEP(builder.getInt8Ty(), ptr, builder.getInt64(A.offset));
+            }
+            args = {builder.getInt32(size), ptr};
+            break;
+        }
+        case Kind::PushAlloc: {
+            auto *AI = cast<AllocaInst>(A.object);
+            Value *as = builder.CreateIntCast(AI->getArraySize(), builder.getInt64Ty(), false);
+            int size = DL.getTypeAllocSize(AI->getAllocatedType()); // # Byte
+            // the buffer id, the number and size (bytes) of the elements
+            args = {builder.getInt32(A.buffer), as, builder.getInt32(size),
+                    builder.CreateBitCast(AI, builder.getInt8PtrTy())};
+            break;
+        }
+        case Kind::InsertMalloc: {
+            auto *CI = cast<CallInst>(A.object);
+            int size = getConstantValue(CI->getOperand(0)); // # Byte
+            args = {builder.getInt32(A.buffer), builder.getInt32(size),
+                    builder.CreateBitCast(CI, builder.getInt8PtrTy())};
+            break;
+        }
+        case Kind::EraseMalloc:
+            args = {builder.getInt32(A.buffer),
+                    builder.CreateBitCast(A.at->getOperand(0), builder.getInt8PtrTy())};
+            break;
+        }
+        setDebugLoc(builder.CreateCall(fun, args), A.at);
+    }
+
+  public:
+    // Apply the plan function by function (in the order in which the
+    // plan first touches them), the actions of one function in the order
+    // of the plan. The calls in different functions do not depend on each
+    // other, so this gives the same code as applying the actions in the
+    // order of the plan.
+    unsigned run(const InstrumentationPlan &plan) {
+        std::vector<Function *> order;
+        std::map<Function *, std::vector<const PlanAction *>> batches;
+        for (const PlanAction &A : plan.getActions()) {
+            declare(A);
+            auto &batch = batches[A.at->getFunction()];
+            if (batch.empty())
+                order.push_back(A.at->getFunction());
+            batch.push_back(&A);
+        }
+
+        for (Function *F : order) {
+            for (const PlanAction *A : batches[F])
+                apply(*A);
+        }
+        return order.size();
+    }
+};
+
+unsigned applyPlan(const InstrumentationPlan &plan) {
+    return PlanApplier().run(plan);
+}
+
+static const char *kindNames[] = {
+    "transaction-start", "transaction-end", "preload-code", "preload-block",
+    "preload-alloc",     "preload-malloc",  "preload-global", "push-alloc",
+    "pop-alloc",         "insert-malloc",   "erase-malloc",
+};
+
+static void writeString(raw_ostream &out, StringRef str) {
+    out << '"';
+    for (char c : str) {
+        if (c == '"' || c == '\\')
+            out << '\\' << c;
+        else if (static_cast<unsigned char>(c) < 0x20)
+            out << format("\\u%04x", c);
+        else
+            out << c;
+    }
+    out << '"';
+}
+
+// The numbering of the instructions and blocks of the functions.
+class PlanNumbering {
+    std::map<const Function *, std::map<const Value *, unsigned>> ids;
+    std::map<const Function *, std::vector<Instruction *>> insts;
+    std::map<const Function *, std::vector<BasicBlock *>> blocks;
+
+    void number(Function *F) {
+        if (ids.count(F) > 0)
+            return;
+        auto &fids = ids[F];
+        for (BasicBlock &B : *F) {
+            fids[&B] = blocks[F].size();
+            blocks[F].push_back(&B);
+        }
+        for (inst_iterator I = inst_begin(F), E = inst_end(F); I != E; ++I) {
+            fids[&*I] = insts[F].size();
+            insts[F].push_back(&*I);
+        }
+    }
+
+  public:
+    unsigned getId(const Instruction *I) {
+        number(const_cast<Function *>(I->getFunction()));
+        return ids[I->getFunction()][I];
+    }
+
+    unsigned getId(const BasicBlock *B) {
+        number(const_cast<Function *>(B->getParent()));
+        return ids[B->getParent()][B];
+    }
+
+    Instruction *getInst(Function *F, uint64_t id) {
+        number(F);
+        return id < insts[F].size() ? insts[F][id] : nullptr;
+    }
+
+    BasicBlock *getBlock(Function *F, uint64_t id) {
+        number(F);
+        return id < blocks[F].size() ? blocks[F][id] : nullptr;
+    }
+};
+
+static void writeInst(raw_ostream &out, PlanNumbering &numbering, const Instruction *I) {
+    out << "{\"function\": ";
+    writeString(out, I->getFunction()->getName());
+    out << ", \"inst\": " << numbering.getId(I) << "}";
+}
+
+void writePlanJSON(raw_ostream &out, const InstrumentationPlan &plan) {
+    PlanNumbering numbering;
+    out << "{\n  \"version\": " << planVersion << ",\n  \"actions\": [";
+    const char *sep = "";
+    for (const PlanAction &A : plan.getActions()) {
+        out << sep << "\n    {\"kind\": \"" << kindNames[static_cast<int>(A.kind)]
+            << "\", \"at\": ";
+        writeInst(out, numbering, A.at);
+
+        switch (A.kind) {
+        case Kind::PreloadBlock:
+            out << ", \"block\": " << numbering.getId(A.block);
+            // fallthrough
+        case Kind::PreloadCode:
+            out << ", \"name\": ";
+            writeString(out, A.name);
+            break;
+        case Kind::PreloadAlloc:
+        case Kind::PreloadMalloc:
+            out << ", \"buffer\": " << A.buffer
+                << ", \"write\": " << (A.write ? "true" : "false");
+            break;
+        case Kind::PreloadGlobal:
+            out << ", \"global\": ";
+            writeString(out, A.object->getName());
+            out << ", \"write\": " << (A.write ? "true" : "false");
+            if (A.length)
+                out << ", \"offset\": " << A.offset << ", \"length\": " << A.length;
+            break;
+        case Kind::PushAlloc:
+        case Kind::InsertMalloc:
+            out << ", \"buffer\": " << A.buffer << ", \"object\": ";
+            writeInst(out, numbering, cast<Instruction>(A.object));
+            break;
+        case Kind::PopAlloc:
+        case Kind::EraseMalloc:
+            out << ", \"buffer\": " << A.buffer;
+            break;
+        default:
+            break;
+        }
+        out << "}";
+        sep = ",";
+    }
+    out << "\n  ]\n}\n";
+}
+
+bool writePlan(const std::string &file, const InstrumentationPlan &plan) {
+    std::ofstream ofs(file);
+    if (!ofs) {
+        errs() << "ERROR: cannot write the plan to " << file << "\n";
+        return false;
+    }
+    raw_os_ostream out(ofs);
+    writePlanJSON(out, plan);
+    return true;
+}
+
+// The JSON values of a plan. The plans are read without llvm::json,
+// which LLVM 6 does not have; only integer numbers are supported.
+struct PlanValue {
+    enum class Type { Null, Bool, Number, String, Array, Object };
+
+    Type type{Type::Null};
+    bool boolean{false};
+    int64_t number{0};
+    std::string string;
+    std::vector<PlanValue> array;
+    std::map<std::string, PlanValue> object;
+
+    const PlanValue *get(const char *key, Type t) const {
+        if (type != Type::Object)
+            return nullptr;
+        auto it = object.find(key);
+        return it != object.end() && it->second.type == t ? &it->second : nullptr;
+    }
+
+    const PlanValue *getObject(const char *key) const { return get(key, Type::Object); }
+    const PlanValue *getArray(const char *key) const { return get(key, Type::Array); }
+
+    const std::string *getString(const char *key) const {
+        const PlanValue *V = get(key, Type::String);
+        return V ? &V->string : nullptr;
+    }
+
+    const int64_t *getInteger(const char *key) const {
+        const PlanValue *V = get(key, Type::Number);
+        return V ? &V->number : nullptr;
+    }
+
+    const bool *getBoolean(const char *key) const {
+        const PlanValue *V = get(key, Type::Bool);
+        return V ? &V->boolean : nullptr;
+    }
+};
+
+class PlanParser {
+    const std::string &text;
+    size_t pos{0};
+    std::string err;
+
+    // the plans are two levels deep
+    static const unsigned maxDepth = 32;
+
+    bool fail(const char *what) {
+        if (err.empty())
+            err = std::string(what) + " at offset " + std::to_string(pos);
+        return false;
+    }
+
+    void skipSpace() {
+        while (pos < text.size() && isspace(static_cast<unsigned char>(text[pos])))
+            ++pos;
+    }
+
+    bool consume(char c) {
+        skipSpace();
+        if (pos < text.size() && text[pos] == c) {
+            ++pos;
+            return true;
+        }
+        return false;
+    }
+
+    bool parseLiteral(const char *lit) {
+        size_t len = strlen(lit);
+        if (text.compare(pos, len, lit) != 0)
+            return fail("unexpected character");
+        pos += len;
+        return true;
+    }
+
+    static void appendUTF8(std::string &str, unsigned code) {
+        if (code < 0x80) {
+            str += static_cast<char>(code);
+        } else if (code < 0x800) {
+            str += static_cast<char>(0xc0 | (code >> 6));
+            str += static_cast<char>(0x80 | (code & 0x3f));
+        } else {
+            str += static_cast<char>(0xe0 | (code >> 12));
+            str += static_cast<char>(0x80 | ((code >> 6) & 0x3f));
+            str += static_cast<char>(0x80 | (code & 0x3f));
+        }
+    }
+
+    bool parseString(std::string &str) {
+        if (!consume('"'))
+            return fail("expected a string");
+        while (pos < text.size() && text[pos] != '"') {
+            char c = text[pos++];
+            if (c != '\\') {
+                str += c;
+                continue;
+            }
+            if (pos >= text.size())
+                break;
+            c = text[pos++];
+            switch (c) {
+            case '"': case '\\': case '/': str += c; break;
+            case 'b': str += '\b'; break;
+            case 'f': str += '\f'; break;
+            case 'n': str += '\n'; break;
+            case 'r': str += '\r'; break;
+            case 't': str += '\t'; break;
+            case 'u': {
+                unsigned code = 0;
+                if (pos + 4 > text.size() ||
+                    sscanf(text.substr(pos, 4).c_str(), "%4x", &code) != 1)
+                    return fail("bad \\u escape");
+                pos += 4;
+                appendUTF8(str, code);
+                break;
+            }
+            default:
+                return fail("bad escape");
+            }
+        }
+        if (pos >= text.size())
+            return fail("unterminated string");
+        ++pos;
+        return true;
+    }
+
+    bool parseNumber(int64_t &num) {
+        size_t start = pos;
+        if (pos < text.size() && text[pos] == '-')
+            ++pos;
+        while (pos < text.size() && isdigit(static_cast<unsigned char>(text[pos])))
+            ++pos;
+        if (pos < text.size() && strchr(".eE", text[pos]))
+            return fail("not an integer");
+        errno = 0;
+        char *end;
+        num = strtoll(text.c_str() + start, &end, 10);
+        if (end != text.c_str() + pos || end == text.c_str() + start || errno == ERANGE)
+            return fail("bad number");
+        return true;
+    }
+
+    bool parseValue(PlanValue &V, unsigned depth) {
+        if (depth > maxDepth)
+            return fail("nested too deep");
+        skipSpace();
+        if (pos >= text.size())
+            return fail("unexpected end");
+
+        using Type = PlanValue::Type;
+        char c = text[pos];
+        if (c == '{') {
+            ++pos;
+            V.type = Type::Object;
+            if (consume('}'))
+                return true;
+            do {
+                std::string key;
+                if (!parseString(key))
+                    return false;
+                if (!consume(':'))
+                    return fail("expected ':'");
+                if (!parseValue(V.object[key], depth + 1))
+                    return false;
+            } while (consume(','));
+            return consume('}') || fail("expected '}'");
+        }
+        if (c == '[') {
+            ++pos;
+            V.type = Type::Array;
+            if (consume(']'))
+                return true;
+            do {
+                V.array.emplace_back();
+                if (!parseValue(V.array.back(), depth + 1))
+                    return false;
+            } while (consume(','));
+            return consume(']') || fail("expected ']'");
+        }
+        if (c == '"') {
+            V.type = Type::String;
+            return parseString(V.string);
+        }
+        if (c == 't' || c == 'f') {
+            V.type = Type::Bool;
+            V.boolean = c == 't';
+            return parseLiteral(V.boolean ? "true" : "false");
+        }
+        if (c == 'n')
+            return parseLiteral("null");
+        V.type = Type::Number;
+        return parseNumber(V.number);
+    }
+
+  public:
+    PlanParser(const std::string &t) : text(t) {}
+
+    bool parse(PlanValue &V) {
+        if (!parseValue(V, 0))
+            return false;
+        skipSpace();
+        return pos == text.size() || fail("trailing characters");
+    }
+
+    const std::string &getError() const { return err; }
+};
+
+class PlanReader {
+    Module &M;
+    const std::string &file;
+    PlanNumbering numbering;
+
+  public:
+    PlanReader(Module &m, const std::string &f) : M(m), file(f) {}
+
+    bool error(size_t idx, const char *what) {
+        errs() << "ERROR: " << file << ": action " << idx << ": " << what << "\n";
+        return false;
+    }
+
+    Instruction *getInst(const PlanValue *O) {
+        if (!O)
+            return nullptr;
+        auto fun = O->getString("function");
+        auto id = O->getInteger("inst");
+        Function *F = fun ? M.getFunction(*fun) : nullptr;
+        if (!F || !id || *id < 0)
+            return nullptr;
+        return numbering.getInst(F, *id);
+    }
+
+    bool read(const std::vector<PlanValue> &actions, InstrumentationPlan &plan) {
+        for (size_t idx = 0; idx < actions.size(); ++idx) {
+            const PlanValue *O = &actions[idx];
+            if (O->type != PlanValue::Type::Object)
+                return error(idx, "not an object");
+            auto kindName = O->getString("kind");
+            Instruction *at = getInst(O->getObject("at"));
+            if (!kindName || !at)
+                return error(idx, "no kind or an unknown instruction");
+
+            int kind = -1;
+            for (unsigned k = 0; k < sizeof(kindNames) / sizeof(*kindNames); ++k) {
+                if (*kindName == kindNames[k])
+                    kind = k;
+            }
+            if (kind < 0)
+                return error(idx, "unknown kind");
+
+            // nothing can be inserted before the PHIs and the EH pads
+            if (isa<PHINode>(at) || at->isEHPad())
+                return error(idx, "cannot insert before the instruction");
+
+            PlanAction A(static_cast<Kind>(kind), at);
+            auto name = O->getString("name");
+            auto block = O->getInteger("block");
+            auto buffer = O->getInteger("buffer");
+            auto write = O->getBoolean("write");
+            auto global = O->getString("global");
+            A.write = write && *write;
+            if (buffer) {
+                if (*buffer < 0 || *buffer > UINT32_MAX)
+                    return error(idx, "bad buffer");
+                A.buffer = *buffer;
+            }
+
+            switch (A.kind) {
+            case Kind::PreloadBlock:
+                if (!block || *block < 0 ||
+                    !(A.block = numbering.getBlock(at->getFunction(), *block)))
+                    return error(idx, "unknown block");
+                // fallthrough
+            case Kind::PreloadCode:
+                if (!name)
+                    return error(idx, "no name");
+                A.name = *name;
+                break;
+            case Kind::PreloadGlobal:
+                if (!global || !(A.object = M.getNamedGlobal(*global)))
+                    return error(idx, "unknown global");
+                if (auto length = O->getInteger("length")) {
+                    auto offset = O->getInteger("offset");
+                    auto *GV = cast<GlobalVariable>(A.object);
+                    // iterateGlobal takes the length as an int
+                    int64_t size = M.getDataLayout().getTypeAllocSize(GV->getValueType());
+                    if (!offset || *offset < 0 || *length <= 0 || *length > INT32_MAX ||
+                        *offset > size || *length > size - *offset)
+                        return error(idx, "bad offset or length");
+                    A.offset = *offset;
+                    A.length = *length;
+                }
+                break;
+            case Kind::PushAlloc:
+            case Kind::InsertMalloc: {
+                Instruction *obj = getInst(O->getObject("object"));
+                if (!obj || obj->getFunction() != at->getFunction() ||
+                    (A.kind == Kind::PushAlloc ? !isa<AllocaInst>(obj) : !isa<CallInst>(obj)))
+                    return error(idx, "unknown object");
+                // the size of the malloc is its first argument
+                if (A.kind == Kind::InsertMalloc && cast<CallInst>(obj)->getNumArgOperands() == 0)
+                    return error(idx, "the object is not a malloc");
+                A.object = obj;
+                break;
+            }
+            case Kind::PopAlloc:
+                // the buffer is popped when the function returns
+                if (!isa<ReturnInst>(at))
+                    return error(idx, "not at a return");
+                break;
+            case Kind::EraseMalloc: {
+                // the buffer is erased before it is freed
+                auto *CI = dyn_cast<CallInst>(at);
+                if (!CI || CI->getNumArgOperands() == 0 ||
+                    !CI->getArgOperand(0)->getType()->isPointerTy())
+                    return error(idx, "not at a call with a pointer");
+                break;
+            }
+            default:
+                break;
+            }
+            if ((A.kind == Kind::PreloadAlloc || A.kind == Kind::PreloadMalloc ||
+                 A.kind == Kind::PushAlloc || A.kind == Kind::PopAlloc ||
+                 A.kind == Kind::InsertMalloc || A.kind == Kind::EraseMalloc) &&
+                !buffer)
+                return error(idx, "no buffer");
+
+            plan.addAction(std::move(A));
+        }
+        return true;
+    }
+};
+
+bool readPlan(Module &M, const std::string &file, InstrumentationPlan &plan) {
+    std::ifstream ifs(file);
+    if (!ifs) {
+        errs() << "ERROR: cannot open the plan " << file << "\n";
+        return false;
+    }
+    std::stringstream ss;
+    ss << ifs.rdbuf();
+    std::string text = ss.str();
+
+    PlanValue root;
+    PlanParser parser(text);
+    if (!parser.parse(root)) {
+        errs() << "ERROR: " << file << ": " << parser.getError() << "\n";
+        return false;
+    }
+    auto version = root.getInteger("version");
+    const PlanValue *actions = root.getArray("actions");
+    if (!version || *version != planVersion || !actions) {
+        errs() << "ERROR: " << file << " is not a Cape plan of version " << planVersion << "\n";
+        return false;
+    }
+
+    plan.clear();
+    return PlanReader(M, file).read(actions->array, plan);
+}
+
+} // namespace llvmdg
+} // namespace dg
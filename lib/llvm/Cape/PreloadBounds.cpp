@@ -0,0 +1,202 @@
+#include <algorithm>
+#include <cstdlib>
+#include <map>
+
+// ignore unused parameters in LLVM libraries
+#if (__clang__)
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wunused-parameter"
+#else
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+#endif
+
+#include <llvm/Analysis/ValueTracking.h>
+#include <llvm/IR/CFG.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/DataLayout.h>
+#include <llvm/IR/GetElementPtrTypeIterator.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Operator.h>
+#include <llvm/Support/KnownBits.h>
+
+#if (__clang__)
+#pragma clang diagnostic pop // ignore -Wunused-parameter
+#else
+#pragma GCC diagnostic pop
+#endif
+
+#include "dg/llvm/Cape/PreloadBounds.h"
+#include "dg/llvm/ValueRelations/ValueRelations.h"
+
+namespace dg {
+namespace llvmdg {
+
+using namespace llvm;
+using analysis::LLVMValueRelations;
+
+// Offsets and indices are kept in +-maxOffset (far beyond any object),
+// so that the sums below do not overflow.
+static const int64_t maxOffset = INT64_C(1) << 61;
+
+static int64_t clampOffset(int64_t v) {
+    return std::max(-maxOffset, std::min(maxOffset, v));
+}
+
+static int64_t addOffsets(int64_t a, int64_t b) {
+    return clampOffset(a + b);
+}
+
+static int64_t mulOffsets(int64_t a, int64_t b) {
+    if (a == 0 || b == 0)
+        return 0;
+    if (std::llabs(a) > maxOffset / std::llabs(b))
+        return (a < 0) != (b < 0) ? -maxOffset : maxOffset;
+    return a * b;
+}
+
+// The value relations abort on the terminators that they do not know.
+static bool hasKnownTerminators(const Module &M) {
+    for (const Function &F : M) {
+        for (const BasicBlock &B : F) {
+            const Instruction *T = B.getTerminator();
+            if (!T)
+                return false;
+            if (!isa<BranchInst>(T) && !isa<SwitchInst>(T) && succ_begin(&B) != succ_end(&B))
+                return false;
+        }
+    }
+    return true;
+}
+
+PreloadBounds::PreloadBounds(Module &M) : DL(M.getDataLayout()) {
+    if (!hasKnownTerminators(M))
+        return;
+    VR.reset(new LLVMValueRelations(&M));
+    VR->build();
+    VR->compute();
+}
+
+PreloadBounds::~PreloadBounds() = default;
+
+// Narrow [min, max] by the relations of idx to constants at the access.
+void PreloadBounds::boundByRelations(const Instruction *at, const Value *idx,
+                                     int64_t &min, int64_t &max) {
+    auto *loc = VR->getMapping(at);
+    if (!loc)
+        return;
+    loc->transitivelyClose();
+    auto *rels = loc->relations.get(idx);
+    if (!rels)
+        return;
+
+    for (const auto &rel : *rels) {
+        auto *C = dyn_cast<ConstantInt>(rel.getRHS());
+        if (!C || C->getBitWidth() > 64)
+            continue;
+        int64_t c = clampOffset(C->getSExtValue());
+        if (rel.isLt())
+            max = std::min(max, c - 1);
+        else if (rel.isLe() || rel.isEq())
+            max = std::min(max, c);
+        if (rel.isGt())
+            min = std::max(min, c + 1);
+        else if (rel.isGe() || rel.isEq())
+            min = std::max(min, c);
+    }
+}
+
+bool PreloadBounds::getIndexRange(const Instruction *at, const Value *idx,
+                                  int64_t &min, int64_t &max) {
+    if (auto *C = dyn_cast<ConstantInt>(idx)) {
+        if (C->getBitWidth() > 64)
+            return false;
+        min = max = clampOffset(C->getSExtValue());
+        return true;
+    }
+
+    min = -maxOffset;
+    max = maxOffset;
+    unsigned width = idx->getType()->getIntegerBitWidth();
+    if (width <= 64) {
+        // e.g., s & 0xff
+        KnownBits known(width);
+        computeKnownBits(idx, known, DL);
+        if (known.isNonNegative()) {
+            min = clampOffset(known.One.getZExtValue());
+            max = clampOffset((~known.Zero).getZExtValue());
+        }
+    }
+
+    if (VR) {
+        boundByRelations(at, idx, min, max);
+        // the indices are extended to the width of pointers, the
+        // conditions are usually of the value before that
+        if (isa<SExtInst>(idx) || isa<ZExtInst>(idx))
+            boundByRelations(at, cast<CastInst>(idx)->getOperand(0), min, max);
+    }
+    return min <= max;
+}
+
+// The range of the offsets from obj that ptr may have at the access.
+bool PreloadBounds::getOffsetRange(const Instruction *at, const Value *ptr,
+                                   const GlobalVariable *obj, int64_t &min, int64_t &max) {
+    while (auto *BC = dyn_cast<BitCastOperator>(ptr))
+        ptr = BC->getOperand(0);
+    if (ptr == obj) {
+        min = max = 0;
+        return true;
+    }
+
+    auto *GEP = dyn_cast<GEPOperator>(ptr);
+    if (!GEP || !getOffsetRange(at, GEP->getPointerOperand(), obj, min, max))
+        return false;
+
+    for (auto GTI = gep_type_begin(GEP), E = gep_type_end(GEP); GTI != E; ++GTI) {
+        const Value *idx = GTI.getOperand();
+        if (StructType *ST = GTI.getStructTypeOrNull()) {
+            unsigned field = cast<ConstantInt>(idx)->getZExtValue();
+            int64_t off = DL.getStructLayout(ST)->getElementOffset(field);
+            min = addOffsets(min, off);
+            max = addOffsets(max, off);
+            continue;
+        }
+
+        int64_t stride = DL.getTypeAllocSize(GTI.getIndexedType());
+        int64_t imin, imax;
+        if (!getIndexRange(at, idx, imin, imax))
+            return false;
+        min = addOffsets(min, mulOffsets(imin, stride));
+        max = addOffsets(max, mulOffsets(imax, stride));
+    }
+    return true;
+}
+
+std::pair<uint64_t, uint64_t>
+PreloadBounds::getAccessedBytes(const Instruction *at, const Value *ptr, const Offset &offset,
+                                const GlobalVariable *obj, uint64_t len) {
+    const uint64_t size = DL.getTypeAllocSize(obj->getValueType());
+    const std::pair<uint64_t, uint64_t> whole{0, size};
+    if (len == 0 || len >= size)
+        return whole;
+
+    int64_t min, max;
+    if (!offset.isUnknown()) {
+        if (*offset >= size)
+            return whole;
+        min = max = *offset;
+    } else if (!getOffsetRange(at, ptr, obj, min, max)) {
+        return whole;
+    }
+
+    // the accesses out of the object are undefined
+    uint64_t begin = min < 0 ? 0 : std::min<uint64_t>(min, size);
+    uint64_t end = max < 0 ? 0 : std::min<uint64_t>(max + len, size);
+    if (begin >= end)
+        return whole;
+    return {begin, end};
+}
+
+} // namespace llvmdg
+} // namespace dg
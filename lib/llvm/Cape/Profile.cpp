@@ -0,0 +1,554 @@
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// ignore unused parameters in LLVM libraries
+#if (__clang__)
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wunused-parameter"
+#else
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+#endif
+
+#include <llvm/Analysis/PostDominators.h>
+#include <llvm/IR/CFG.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/Dominators.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/IntrinsicInst.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Operator.h>
+#include <llvm/Support/raw_ostream.h>
+
+#if (__clang__)
+#pragma clang diagnostic pop // ignore -Wunused-parameter
+#else
+#pragma GCC diagnostic pop
+#endif
+
+#include "dg/llvm/Cape/Profile.h"
+#include "dg/llvm/Cape/Sites.h"
+
+namespace dg {
+namespace llvmdg {
+
+using namespace llvm;
+
+// the most instructions between two sites that are merged
+static const unsigned maxMergeGap = 16;
+
+SiteProfile &SiteProfile::operator+=(const SiteProfile &rhs) {
+    attempts += rhs.attempts;
+    commits += rhs.commits;
+    conflict += rhs.conflict;
+    capacity += rhs.capacity;
+    explicitAborts += rhs.explicitAborts;
+    other += rhs.other;
+    cycles += rhs.cycles;
+    return *this;
+}
+
+double SiteProfile::abortRatio() const {
+    return attempts == 0 ? 0.0 : (attempts - commits) / static_cast<double>(attempts);
+}
+
+double SiteProfile::capacityRatio() const {
+    return attempts == 0 ? 0.0 : capacity / static_cast<double>(attempts);
+}
+
+double SiteProfile::cyclesPerCommit() const {
+    return commits == 0 ? 0.0 : cycles / static_cast<double>(commits);
+}
+
+bool readProfile(const std::string &file, Profile &profile) {
+    std::ifstream in(file);
+    if (!in.is_open()) {
+        errs() << "ERROR: cannot open profile " << file << "\n";
+        return false;
+    }
+
+    std::string line;
+    unsigned version = 0;
+    if (!std::getline(in, line) ||
+        sscanf(line.c_str(), "cape-profile %u", &version) != 1 ||
+        version != profileVersion) {
+        errs() << "ERROR: " << file << " is not a Cape profile of version "
+               << profileVersion << "\n";
+        return false;
+    }
+
+    Profile read;
+    unsigned lineNo = 1;
+    while (std::getline(in, line)) {
+        ++lineNo;
+        if (line.empty() || line[0] == '#')
+            continue;
+
+        std::istringstream ss(line);
+        unsigned site;
+        SiteProfile P;
+        if (!(ss >> site >> P.attempts >> P.commits >> P.conflict >> P.capacity >>
+              P.explicitAborts >> P.other >> P.cycles)) {
+            errs() << "ERROR: " << file << ":" << lineNo << ": malformed site\n";
+            return false;
+        }
+        read[site] += P;
+    }
+
+    for (auto &it : read)
+        profile[it.first] += it.second;
+    return true;
+}
+
+unsigned addProfiling(Module &M) {
+    unsigned num = 0;
+    auto sites = getTransactionSites(M);
+
+    for (unsigned id = 0; id < sites.size(); ++id) {
+        if (!sites[id])
+            continue;
+
+        IRBuilder<> builder(sites[id]);
+        auto c = M.getOrInsertFunction("_Z16capeProfileEnteri", builder.getVoidTy(),
+                                       builder.getInt32Ty());
+        builder.CreateCall(cast<Function>(c), {builder.getInt32(id)});
+        ++num;
+    }
+
+    return num;
+}
+
+static bool isInCycle(BasicBlock *B, const TransactionRegion &T) {
+    std::vector<BasicBlock *> queue(succ_begin(B), succ_end(B));
+    std::set<BasicBlock *> seen;
+    while (!queue.empty()) {
+        BasicBlock *C = queue.back();
+        queue.pop_back();
+        if (C == B)
+            return true;
+        if (T.blockSet.count(C) == 0 || !seen.insert(C).second)
+            continue;
+        queue.insert(queue.end(), succ_begin(C), succ_end(C));
+    }
+    return false;
+}
+
+// Find a block of the transaction that every execution of it goes
+// through (once), so that no branch of the transaction is pending when
+// the block starts. Of those, take the one that halves the transaction.
+static BasicBlock *findSplitBlock(const TransactionRegion &T) {
+    Function *F = T.xbegin->getFunction();
+    DominatorTree DT(*F);
+    PostDominatorTree PDT;
+    PDT.recalculate(*F);
+
+    BasicBlock *start = T.xbegin->getParent();
+    BasicBlock *end = T.xend->getParent();
+    size_t total = 0;
+    for (BasicBlock *B : T.blocks)
+        total += B->size();
+
+    BasicBlock *best = nullptr;
+    size_t bestDiff = total;
+    for (BasicBlock *B : T.blocks) {
+        if (!DT.dominates(start, B) || !DT.dominates(B, end) ||
+            !PDT.dominates(B, start) || isInCycle(B, T))
+            continue;
+
+        size_t after = 0;
+        for (BasicBlock *C : T.blocks)
+            if (DT.dominates(B, C))
+                after += C->size();
+        size_t before = total - after;
+        if (before == 0)
+            continue;
+
+        size_t diff = before > after ? before - after : after - before;
+        if (diff < bestDiff) {
+            best = B;
+            bestDiff = diff;
+        }
+    }
+
+    return best;
+}
+
+static bool isAllocation(const Value *v) {
+    auto *CI = dyn_cast<CallInst>(v);
+    const Function *F = CI ? CI->getCalledFunction() : nullptr;
+    if (!F)
+        return false;
+    StringRef name = F->getName();
+    return name == "malloc" || name == "calloc" || name == "_Znwm" || name == "_Znam" ||
+           name == "_Z15capeArenaMallocim";
+}
+
+// The objects that ptr may point to: globals, allocas and the results of
+// allocation calls. Returns false if some of them cannot be found
+// (e.g., a pointer loaded from memory or an argument, unless args are
+// known from elsewhere).
+static bool getObjects(const Value *ptr, std::set<const Value *> &objects,
+                       bool args = false) {
+    std::vector<const Value *> queue{ptr};
+    std::set<const Value *> seen;
+    bool known = true;
+    while (!queue.empty()) {
+        const Value *v = queue.back()->stripPointerCasts();
+        queue.pop_back();
+        if (!seen.insert(v).second)
+            continue;
+
+        if (isa<GlobalVariable>(v) || isa<AllocaInst>(v) || isAllocation(v)) {
+            objects.insert(v);
+        } else if (auto *GEP = dyn_cast<GEPOperator>(v)) {
+            queue.push_back(GEP->getPointerOperand());
+        } else if (auto *phi = dyn_cast<PHINode>(v)) {
+            for (const Value *in : phi->incoming_values())
+                queue.push_back(in);
+        } else if (auto *sel = dyn_cast<SelectInst>(v)) {
+            queue.push_back(sel->getTrueValue());
+            queue.push_back(sel->getFalseValue());
+        } else if (!isa<ConstantPointerNull>(v) && !isa<UndefValue>(v) &&
+                   !(args && isa<Argument>(v))) {
+            known = false;
+        }
+    }
+    return known;
+}
+
+// What one part of a split transaction may execute and access, so that
+// it gets only the preloads of the site that it needs.
+struct SitePart {
+    const Function *F;
+    std::set<const BasicBlock *> blocks;
+    // the functions called from the part (transitively)
+    std::set<const Function *> callees;
+    // the memory objects accessed by the part and its callees
+    std::set<const Value *> objects;
+    bool unknownCallee{false};
+    bool unknownObject{false};
+
+    SitePart(const Function *fun) : F(fun) {}
+
+    // the pointer arguments of the callees are those passed by the calls
+    // in the part, which are added there
+    void addPointer(const Value *ptr, bool inCallee) {
+        if (!getObjects(ptr, objects, inCallee))
+            unknownObject = true;
+    }
+
+    void addInstruction(const Instruction &I, bool inCallee,
+                        std::vector<const Function *> &queue) {
+        if (isCapeRuntimeCall(&I) || isa<DbgInfoIntrinsic>(I))
+            return;
+
+        if (auto *LI = dyn_cast<LoadInst>(&I)) {
+            addPointer(LI->getPointerOperand(), inCallee);
+        } else if (auto *SI = dyn_cast<StoreInst>(&I)) {
+            addPointer(SI->getPointerOperand(), inCallee);
+        } else if (auto *RMW = dyn_cast<AtomicRMWInst>(&I)) {
+            addPointer(RMW->getPointerOperand(), inCallee);
+        } else if (auto *CX = dyn_cast<AtomicCmpXchgInst>(&I)) {
+            addPointer(CX->getPointerOperand(), inCallee);
+        } else if (auto *CI = dyn_cast<CallInst>(&I)) {
+            const Function *callee = CI->getCalledFunction();
+            if (!callee) {
+                unknownCallee = unknownObject = true;
+                return;
+            }
+            if (CI->doesNotAccessMemory())
+                return;
+            for (unsigned i = 0; i < CI->getNumArgOperands(); ++i) {
+                const Value *arg = CI->getArgOperand(i);
+                if (arg->getType()->isPointerTy())
+                    addPointer(arg, inCallee);
+            }
+            if (!callee->isIntrinsic() && callees.insert(callee).second)
+                queue.push_back(callee);
+        }
+    }
+
+    void addCallees(std::vector<const Function *> &queue) {
+        while (!queue.empty()) {
+            const Function *callee = queue.back();
+            queue.pop_back();
+            for (const BasicBlock &B : *callee)
+                for (const Instruction &I : B)
+                    addInstruction(I, true, queue);
+        }
+    }
+
+    bool accesses(const std::set<const Value *> &objs) const {
+        if (unknownObject)
+            return true;
+        for (const Value *o : objs)
+            if (objects.count(o) > 0)
+                return true;
+        return false;
+    }
+
+    bool runs(const Function *fun) const {
+        return fun == F || unknownCallee || callees.count(fun) > 0;
+    }
+
+    bool runs(const BasicBlock *B) const {
+        return B->getParent() == F ? blocks.count(B) > 0 : runs(B->getParent());
+    }
+};
+
+static std::string getNameArg(const CallInst *CI) {
+    auto *GV = dyn_cast<GlobalVariable>(CI->getArgOperand(0)->stripPointerCasts());
+    auto *str = GV && GV->hasInitializer()
+                        ? dyn_cast<ConstantDataSequential>(GV->getInitializer())
+                        : nullptr;
+    return str && str->isCString() ? str->getAsCString().str() : std::string();
+}
+
+// the buffer id of a preload of stack or heap objects (see Slicing.h)
+static const ConstantInt *getBufferId(const CallInst *CI) {
+    return dyn_cast<ConstantInt>(CI->getArgOperand(0));
+}
+
+// Does the part need the preload? When in doubt, it does.
+static bool needsPreload(const SitePart &part, const CallInst *P,
+                         const std::map<uint64_t, std::set<const Value *>> &buffers) {
+    StringRef name = P->getCalledFunction()->getName();
+    if (name == "_Z15preloadInstAddrPc") {
+        const Function *fun = P->getModule()->getFunction(getNameArg(P));
+        return !fun || part.runs(fun);
+    }
+    if (name == "_Z16preloadBlockAddrPcPvS0_") {
+        auto *BA = dyn_cast<BlockAddress>(P->getArgOperand(1)->stripPointerCasts());
+        return !BA || part.runs(BA->getBasicBlock());
+    }
+    if (name == "_Z13iterateGlobaliPv" || name == "_Z14iterateGlobalWiPv") {
+        std::set<const Value *> objs;
+        return !getObjects(P->getArgOperand(1), objs) || part.accesses(objs);
+    }
+
+    // iterateAllocStack, iterateMallocSet and their W variants
+    const ConstantInt *bid = getBufferId(P);
+    auto it = bid ? buffers.find(bid->getZExtValue()) : buffers.end();
+    return it == buffers.end() || part.accesses(it->second);
+}
+
+// The objects recorded under each buffer id by pushAllocStack and
+// insertMallocSet, or by capeArenaMalloc. The ids with an object that
+// cannot be found are left out.
+static std::map<uint64_t, std::set<const Value *>> getBufferObjects(Module &M) {
+    std::map<uint64_t, std::set<const Value *>> buffers;
+    std::set<uint64_t> unknown;
+    for (Function &F : M) {
+        for (BasicBlock &B : F) {
+            for (Instruction &I : B) {
+                auto *CI = dyn_cast<CallInst>(&I);
+                Function *callee = CI ? CI->getCalledFunction() : nullptr;
+                if (!callee)
+                    continue;
+
+                const Value *ptr = nullptr;
+                if (callee->getName() == "_Z14pushAllocStackiliPv")
+                    ptr = CI->getArgOperand(3);
+                else if (callee->getName() == "_Z15insertMallocSetiiPv")
+                    ptr = CI->getArgOperand(2);
+                else if (callee->getName() == "_Z15capeArenaMallocim")
+                    ptr = CI;
+                else
+                    continue;
+
+                const ConstantInt *bid = getBufferId(CI);
+                if (!bid)
+                    continue;
+                if (!getObjects(ptr, buffers[bid->getZExtValue()]))
+                    unknown.insert(bid->getZExtValue());
+            }
+        }
+    }
+
+    for (uint64_t bid : unknown)
+        buffers.erase(bid);
+    return buffers;
+}
+
+// End the transaction at the start of B and begin a new one there. Each
+// part keeps only the preloads of the site of the code it runs and the
+// objects it (or its callees) may access; anything that cannot be told
+// apart stays in both. Returns the new xbegin.
+static CallInst *splitSite(const TransactionRegion &T, BasicBlock *B) {
+    Function *F = T.xbegin->getFunction();
+    DominatorTree DT(*F);
+    auto buffers = getBufferObjects(*F->getParent());
+
+    SitePart first(F), second(F);
+    std::vector<const Function *> queue1, queue2;
+    for (Instruction *I : T.partial) {
+        SitePart &part = I->getParent() == T.xbegin->getParent() ? first : second;
+        part.blocks.insert(I->getParent());
+        part.addInstruction(*I, false,
+                            I->getParent() == T.xbegin->getParent() ? queue1 : queue2);
+    }
+    for (BasicBlock *C : T.blocks) {
+        bool after = DT.dominates(B, C);
+        SitePart &part = after ? second : first;
+        part.blocks.insert(C);
+        for (Instruction &I : *C)
+            part.addInstruction(I, false, after ? queue2 : queue1);
+    }
+    first.addCallees(queue1);
+    second.addCallees(queue2);
+
+    std::vector<CallInst *> preloads;
+    for (Instruction *I = T.xbegin->getNextNode(); I && I != T.xend; I = I->getNextNode()) {
+        if (isPreloadCall(I))
+            preloads.push_back(cast<CallInst>(I));
+    }
+
+    Instruction *at = &*B->getFirstInsertionPt();
+    T.xend->clone()->insertBefore(at);
+    auto *xbegin = cast<CallInst>(T.xbegin->clone());
+    clearTransactionSiteId(xbegin);
+    xbegin->insertBefore(at);
+
+    // the start block dominates B, so the arguments are available there
+    for (CallInst *P : preloads) {
+        if (needsPreload(second, P, buffers))
+            P->clone()->insertBefore(at);
+    }
+    for (CallInst *P : preloads) {
+        if (!needsPreload(first, P, buffers))
+            P->eraseFromParent();
+    }
+
+    return xbegin;
+}
+
+// Get the endTransaction call that closely precedes xbegin in its block.
+static CallInst *getPrecedingEnd(CallInst *xbegin) {
+    unsigned gap = 0;
+    for (Instruction *I = xbegin->getPrevNode(); I; I = I->getPrevNode()) {
+        if (isa<DbgInfoIntrinsic>(I))
+            continue;
+        if (auto *CI = dyn_cast<CallInst>(I)) {
+            Function *F = CI->getCalledFunction();
+            return F && F->getName() == "_Z14endTransactionv" ? CI : nullptr;
+        }
+        if (++gap > maxMergeGap)
+            return nullptr;
+    }
+    return nullptr;
+}
+
+static bool isCheap(const SiteProfile &P, const CapeOptions &opts) {
+    return P.commits > 0 && P.capacity == 0 &&
+           P.cyclesPerCommit() < opts.profileMergeCycles &&
+           P.abortRatio() < opts.profileWarmUpAborts;
+}
+
+static void splitSites(Module &M, const Profile &profile, const CapeOptions &opts,
+                       std::set<unsigned> &warm) {
+    std::vector<std::pair<unsigned, CallInst *>> splits;
+    auto sites = getTransactionSites(M);
+    for (unsigned id = 0; id < sites.size(); ++id) {
+        auto it = profile.find(id);
+        if (!sites[id] || it == profile.end() ||
+            it->second.capacityRatio() < opts.profileSplitCapacity)
+            continue;
+
+        TransactionRegion T = getTransactionRegion(sites[id]);
+        BasicBlock *B = T.blocks.empty() ? nullptr : findSplitBlock(T);
+        if (!B) {
+            errs() << "site " << id << " aborts on capacity in "
+                   << static_cast<unsigned>(it->second.capacityRatio() * 100)
+                   << "% of attempts, but cannot be split outside of its branches\n";
+            continue;
+        }
+        splits.emplace_back(id, splitSite(T, B));
+    }
+
+    // number the new sites, they warm up like the sites they come from
+    getTransactionSites(M);
+    for (auto &split : splits) {
+        unsigned id = getTransactionSiteId(split.second);
+        errs() << "split site " << split.first << " into sites " << split.first
+               << " and " << id << "\n";
+        if (warm.count(split.first) > 0)
+            warm.insert(id);
+    }
+}
+
+static void mergeSites(Module &M, const Profile &profile, const CapeOptions &opts,
+                       std::set<unsigned> &warm) {
+    const unsigned ambiguous = ~0u;
+    auto sites = getTransactionSites(M);
+
+    // the site that each endTransaction call ends
+    std::map<const CallInst *, unsigned> endOf;
+    std::vector<CallInst *> ends(sites.size(), nullptr);
+    for (unsigned id = 0; id < sites.size(); ++id) {
+        if (!sites[id])
+            continue;
+        ends[id] = getTransactionRegion(sites[id]).xend;
+        if (!ends[id])
+            continue;
+        auto ret = endOf.emplace(ends[id], id);
+        if (!ret.second)
+            ret.first->second = ambiguous;
+    }
+
+    Profile merged(profile);
+    for (unsigned id = 0; id < sites.size(); ++id) {
+        auto it = profile.find(id);
+        if (!sites[id] || it == profile.end() || !isCheap(it->second, opts))
+            continue;
+
+        CallInst *xend = getPrecedingEnd(sites[id]);
+        auto prev = xend ? endOf.find(xend) : endOf.end();
+        if (prev == endOf.end() || prev->second == ambiguous)
+            continue;
+
+        unsigned into = prev->second;
+        auto intoIt = merged.find(into);
+        if (intoIt == merged.end())
+            continue;
+        SiteProfile P = intoIt->second;
+        P += it->second;
+        if (!isCheap(P, opts))
+            continue;
+
+        // the site now ends where the merged one ended
+        intoIt->second = P;
+        endOf.erase(prev);
+        if (ends[id] && endOf[ends[id]] == id)
+            endOf[ends[id]] = into;
+        xend->eraseFromParent();
+        sites[id]->eraseFromParent();
+        warm.erase(id);
+        errs() << "merged site " << id << " into site " << into << "\n";
+    }
+}
+
+std::set<unsigned> applyProfile(Module &M, const Profile &profile,
+                                const CapeOptions &opts) {
+    std::set<unsigned> warm;
+    for (auto &it : profile) {
+        if (it.second.abortRatio() < opts.profileWarmUpAborts)
+            continue;
+        warm.insert(it.first);
+        errs() << "warm-up pays off at site " << it.first << " ("
+               << static_cast<unsigned>(it.second.abortRatio() * 100)
+               << "% of attempts abort)\n";
+    }
+
+    splitSites(M, profile, opts, warm);
+    mergeSites(M, profile, opts, warm);
+    return warm;
+}
+
+} // namespace llvmdg
+} // namespace dg
@@ -0,0 +1,216 @@
+#include <map>
+#include <set>
+#include <utility>
+
+// ignore unused parameters in LLVM libraries
+#if (__clang__)
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wunused-parameter"
+#else
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+#endif
+
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/DataLayout.h>
+#include <llvm/IR/GlobalVariable.h>
+#include <llvm/IR/IntrinsicInst.h>
+#include <llvm/IR/Metadata.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Operator.h>
+
+#if (__clang__)
+#pragma clang diagnostic pop // ignore -Wunused-parameter
+#else
+#pragma GCC diagnostic pop
+#endif
+
+#include "dg/llvm/Cape/SecretAnnotations.h"
+#include "dg/llvm/PointerAnalysis/PointerAnalysis.h"
+
+namespace dg {
+namespace llvmdg {
+
+using namespace llvm;
+
+static const char *secretMDName = "cape.secret";
+static const char *secretBytesMDName = "cape.secret.bytes";
+
+// The annotation string of llvm.var.annotation or llvm.ptr.annotation.
+static bool isSecretAnnotation(const IntrinsicInst *II) {
+    auto *GV = dyn_cast<GlobalVariable>(II->getArgOperand(1)->stripPointerCasts());
+    if (!GV || !GV->hasInitializer())
+        return false;
+    auto *str = dyn_cast<ConstantDataArray>(GV->getInitializer());
+    return str && str->isCString() && str->getAsCString() == "secret";
+}
+
+std::vector<Value *> findSecretAnnotations(Module &M) {
+    std::vector<Value *> secrets;
+    std::set<const Value *> seen;
+    MDNode *tag = MDNode::get(M.getContext(), {});
+
+    for (Function &F : M) {
+        for (Argument &A : F.args()) {
+            if (isSecretParam(&A))
+                secrets.push_back(&A);
+        }
+
+        for (BasicBlock &B : F) {
+            for (Instruction &I : B) {
+                auto *II = dyn_cast<IntrinsicInst>(&I);
+                if (!II)
+                    continue;
+
+                Instruction *secret = nullptr;
+                if (II->getIntrinsicID() == Intrinsic::var_annotation) {
+                    // the annotated local (a bitcast of it at the call)
+                    secret = dyn_cast<Instruction>(II->getArgOperand(0)->stripPointerCasts());
+                } else if (II->getIntrinsicID() == Intrinsic::ptr_annotation) {
+                    // the pointer to the field, the call returns it
+                    secret = II;
+                }
+                if (!secret || !isSecretAnnotation(II))
+                    continue;
+
+                // a local may be annotated more times
+                if (!seen.insert(secret).second)
+                    continue;
+                // the checks see the memory objects, so only a local is
+                // tagged; the object of a field gets its secret bytes
+                // in addSecretFieldBytes
+                if (secret != II)
+                    secret->setMetadata(secretMDName, tag);
+                secrets.push_back(secret);
+            }
+        }
+    }
+    return secrets;
+}
+
+bool isSecretParam(const Argument *A) {
+    const Function *F = A->getParent();
+    return F && F->getAttributes().getParamAttr(A->getArgNo(), "secret").isValid();
+}
+
+bool isSecret(const Value *V) {
+    if (auto *GV = dyn_cast<GlobalVariable>(V))
+        return GV->hasAttribute("secret");
+    if (auto *I = dyn_cast<Instruction>(V))
+        return I->getMetadata(secretMDName) != nullptr;
+    if (auto *A = dyn_cast<Argument>(V))
+        return isSecretParam(A);
+    return false;
+}
+
+// [begin, end) of the secret bytes of an object
+using ByteRange = std::pair<uint64_t, uint64_t>;
+
+static const ByteRange allBytes{0, ~static_cast<uint64_t>(0)};
+
+// The pointer to the annotated field, without the casts to i8*.
+static Value *getFieldPointer(IntrinsicInst *II) {
+    Value *ptr = II->getArgOperand(0);
+    while (auto *BC = dyn_cast<BitCastOperator>(ptr))
+        ptr = BC->getOperand(0);
+    return ptr;
+}
+
+// The type of the annotated field. The constant folder turns the cast of
+// a field pointer of a global into the index of the field's first byte,
+// which is dropped here (an annotated first element of an aggregate field
+// then stands for the whole field, which is safe).
+static Type *getFieldType(Value *field) {
+    auto *GEP = dyn_cast<GEPOperator>(field);
+    if (!GEP || !isa<Constant>(field))
+        return field->getType()->getPointerElementType();
+
+    SmallVector<Value *, 4> idxs(GEP->idx_begin(), GEP->idx_end());
+    while (idxs.size() > 2 && isa<ConstantInt>(idxs.back()) &&
+           cast<ConstantInt>(idxs.back())->isZero())
+        idxs.pop_back();
+    return GetElementPtrInst::getIndexedType(GEP->getSourceElementType(), idxs);
+}
+
+static ByteRange getRange(const Offset &offset, uint64_t len) {
+    if (offset.isUnknown() || *offset > allBytes.second - len)
+        return allBytes;
+    return {*offset, *offset + len};
+}
+
+static void setSecretBytes(Value *obj, const std::vector<ByteRange> &ranges) {
+    LLVMContext &C = obj->getContext();
+    Type *Int64Ty = Type::getInt64Ty(C);
+    std::vector<Metadata *> ops;
+    for (const auto &range : ranges) {
+        ops.push_back(ConstantAsMetadata::get(ConstantInt::get(Int64Ty, range.first)));
+        ops.push_back(ConstantAsMetadata::get(ConstantInt::get(Int64Ty, range.second)));
+    }
+    MDNode *bytes = MDNode::get(C, ops);
+    if (auto *GO = dyn_cast<GlobalObject>(obj))
+        GO->setMetadata(secretBytesMDName, bytes);
+    else if (auto *I = dyn_cast<Instruction>(obj))
+        I->setMetadata(secretBytesMDName, bytes);
+}
+
+static const MDNode *getSecretBytes(const Value *V) {
+    if (auto *GO = dyn_cast<GlobalObject>(V))
+        return GO->getMetadata(secretBytesMDName);
+    if (auto *I = dyn_cast<Instruction>(V))
+        return I->getMetadata(secretBytesMDName);
+    return nullptr;
+}
+
+unsigned addSecretFieldBytes(Module &M, LLVMPointerAnalysis *PTA,
+                             const std::vector<Value *> &secrets) {
+    const DataLayout &DL = M.getDataLayout();
+    std::map<Value *, std::vector<ByteRange>> bytes;
+
+    for (Value *V : secrets) {
+        auto *II = dyn_cast<IntrinsicInst>(V);
+        if (!II || II->getIntrinsicID() != Intrinsic::ptr_annotation)
+            continue;
+
+        Value *field = getFieldPointer(II);
+        uint64_t len = DL.getTypeStoreSize(getFieldType(field));
+        auto pts = PTA->getLLVMPointsToChecked(field);
+        if (pts.first && !pts.second.empty()) {
+            for (const auto &ptr : pts.second)
+                bytes[ptr.value].push_back(getRange(ptr.offset, len));
+            continue;
+        }
+
+        // PTA has no node for the constant field pointers of globals
+        APInt offset(DL.getPointerSizeInBits(), 0);
+        Value *obj = field->stripAndAccumulateInBoundsConstantOffsets(DL, offset);
+        if (isa<GlobalVariable>(obj) || isa<AllocaInst>(obj))
+            bytes[obj].push_back(getRange(Offset(offset.getZExtValue()), len));
+    }
+
+    for (const auto &it : bytes)
+        setSecretBytes(it.first, it.second);
+    return bytes.size();
+}
+
+bool mayHoldSecret(const Value *V, const Offset &offset, uint64_t len) {
+    if (isSecret(V))
+        return true;
+    const MDNode *bytes = getSecretBytes(V);
+    if (!bytes)
+        return false;
+    if (offset.isUnknown())
+        return true;
+
+    uint64_t begin = *offset;
+    uint64_t end = len == 0 || begin > allBytes.second - len ? allBytes.second : begin + len;
+    for (unsigned i = 0; i + 1 < bytes->getNumOperands(); i += 2) {
+        uint64_t b = mdconst::extract<ConstantInt>(bytes->getOperand(i))->getZExtValue();
+        uint64_t e = mdconst::extract<ConstantInt>(bytes->getOperand(i + 1))->getZExtValue();
+        if (begin < e && b < end)
+            return true;
+    }
+    return false;
+}
+
+} // namespace llvmdg
+} // namespace dg
@@ -0,0 +1,384 @@
+#include <map>
+#include <set>
+#include <vector>
+
+// ignore unused parameters in LLVM libraries
+#if (__clang__)
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wunused-parameter"
+#else
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+#endif
+
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/IntrinsicInst.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/raw_ostream.h>
+
+#if (__clang__)
+#pragma clang diagnostic pop // ignore -Wunused-parameter
+#else
+#pragma GCC diagnostic pop
+#endif
+
+#include "dg/llvm/Cape/SecretAnnotations.h"
+#include "dg/llvm/Cape/SecretScope.h"
+#include "dg/llvm/PointerAnalysis/PointerAnalysis.h"
+
+namespace dg {
+namespace llvmdg {
+
+using namespace llvm;
+
+class SecretScopeAnalysis {
+    Module &M;
+    LLVMPointerAnalysis *PTA;
+    const Function *entry;
+
+    // the call graph of the functions reachable from entry
+    std::vector<const Function *> reachable;
+    std::map<const Function *, std::set<const Function *>> callees;
+    std::map<const Function *, std::set<const Function *>> callers;
+
+    // values that depend on a secret
+    std::set<const Value *> tainted;
+    // memory objects that may hold a secret-derived value
+    std::set<const Value *> secretMem;
+    // memory objects accessed at secret-dependent addresses
+    std::set<const Value *> sensitiveMem;
+    // functions that touch secret-derived values
+    std::set<const Function *> touching;
+    // functions that run under secret-dependent control flow
+    std::set<const Function *> whole;
+    // a secret-derived value may be stored to unknown memory
+    bool unknownSecret{false};
+
+    // Get the objects that ptr may point to.
+    // Returns false if it may point to unknown memory.
+    bool getObjects(const Value *ptr, std::vector<const Value *> &objects) {
+        auto pts = PTA->getLLVMPointsToChecked(ptr);
+        for (const auto &p : pts.second) {
+            if (p.value)
+                objects.push_back(p.value);
+        }
+        return pts.first && !pts.second.hasUnknown();
+    }
+
+    bool mayPointTo(const Value *ptr, const std::set<const Value *> &mem) {
+        if (mem.empty())
+            return false;
+        std::vector<const Value *> objects;
+        if (!getObjects(ptr, objects))
+            return true;
+        for (const Value *obj : objects) {
+            if (mem.count(obj) > 0)
+                return true;
+        }
+        return false;
+    }
+
+    // May the len bytes at ptr (0 - up to the end of the object) be the
+    // secret bytes of an object with annotated fields?
+    bool mayAccessSecretBytes(const Value *ptr, uint64_t len) {
+        auto pts = PTA->getLLVMPointsToChecked(ptr);
+        for (const auto &p : pts.second) {
+            if (p.value && mayHoldSecret(p.value, p.offset, len))
+                return true;
+        }
+        return false;
+    }
+
+    bool addObjects(const Value *ptr, std::set<const Value *> &mem) {
+        std::vector<const Value *> objects;
+        bool known = getObjects(ptr, objects);
+        mem.insert(objects.begin(), objects.end());
+        return known;
+    }
+
+    void taint(const Instruction *I) {
+        tainted.insert(I);
+        touching.insert(I->getFunction());
+    }
+
+    bool anyOperandTainted(const Instruction &I) const {
+        for (const Value *op : I.operands()) {
+            if (tainted.count(op) > 0)
+                return true;
+        }
+        return false;
+    }
+
+    std::vector<const Function *> getCallees(const CallInst *CI) {
+        std::vector<const Function *> ret;
+        const Value *called = CI->getCalledValue()->stripPointerCasts();
+        if (auto *F = dyn_cast<Function>(called)) {
+            ret.push_back(F);
+        } else if (!CI->isInlineAsm()) {
+            for (const Function *F : getCalledFunctions(called, PTA))
+                ret.push_back(F);
+        }
+
+        // functions passed to undefined functions, e.g., pthread_create
+        for (auto it = CI->arg_begin(), et = CI->arg_end(); it != et; ++it) {
+            const Value *arg = *it;
+            if (!arg->getType()->isPointerTy())
+                continue;
+            if (auto *F = dyn_cast<Function>(arg->stripPointerCasts())) {
+                ret.push_back(F);
+            } else if (isa<Function>(called) && cast<Function>(called)->isDeclaration()) {
+                for (const Function *G : getCalledFunctions(arg, PTA))
+                    ret.push_back(G);
+            }
+        }
+        return ret;
+    }
+
+    void buildCallGraph() {
+        std::set<const Function *> seen{entry};
+        reachable.push_back(entry);
+        for (size_t i = 0; i < reachable.size(); ++i) {
+            const Function *F = reachable[i];
+            for (const BasicBlock &B : *F) {
+                for (const Instruction &I : B) {
+                    auto *CI = dyn_cast<CallInst>(&I);
+                    if (!CI)
+                        continue;
+                    for (const Function *G : getCallees(CI)) {
+                        if (G->isDeclaration())
+                            continue;
+                        callees[F].insert(G);
+                        callers[G].insert(F);
+                        if (seen.insert(G).second)
+                            reachable.push_back(G);
+                    }
+                }
+            }
+        }
+    }
+
+    void addSeeds() {
+        for (GlobalVariable &GV : M.globals()) {
+            if (GV.hasAttribute("secret"))
+                secretMem.insert(&GV);
+        }
+
+        // the annotated locals hold the secret, the objects of the
+        // annotated fields only the bytes of the fields, the secret
+        // parameters are secret values
+        auto secrets = findSecretAnnotations(M);
+        addSecretFieldBytes(M, PTA, secrets);
+        for (const Value *V : secrets) {
+            if (auto *A = dyn_cast<Argument>(V)) {
+                tainted.insert(A);
+                touching.insert(A->getParent());
+            } else if (auto *II = dyn_cast<IntrinsicInst>(V)) {
+                touching.insert(II->getFunction());
+                // a field of unknown memory
+                std::vector<const Value *> objects;
+                if (!getObjects(II->getArgOperand(0), objects))
+                    unknownSecret = true;
+            } else {
+                touching.insert(cast<Instruction>(V)->getFunction());
+                secretMem.insert(V);
+            }
+        }
+
+        // LLVMDependenceGraph::getSecretNodes starts at the memcpy
+        // that copies the secret in the entry function
+        for (const BasicBlock &B : *entry) {
+            for (const Instruction &I : B) {
+                auto *CI = dyn_cast<CallInst>(&I);
+                const Function *F = CI ? CI->getCalledFunction() : nullptr;
+                if (F && F->getName().equals("llvm.memcpy.p0i8.p0i8.i64")) {
+                    touching.insert(entry);
+                    if (!addObjects(CI->getArgOperand(0), secretMem))
+                        unknownSecret = true;
+                }
+            }
+        }
+    }
+
+    void handleCall(const CallInst *CI) {
+        if (isa<DbgInfoIntrinsic>(CI))
+            return;
+        // the annotations only return their pointer, they neither read
+        // nor copy the memory (the secret field would make every
+        // object of their arguments secret)
+        if (auto *II = dyn_cast<IntrinsicInst>(CI)) {
+            if (II->getIntrinsicID() == Intrinsic::var_annotation)
+                return;
+            if (II->getIntrinsicID() == Intrinsic::ptr_annotation) {
+                if (tainted.count(II->getArgOperand(0)) > 0)
+                    taint(II);
+                return;
+            }
+        }
+
+        bool taintedArgs = false;
+        bool secretArgs = false;
+        bool sensitiveArgs = false;
+        for (auto it = CI->arg_begin(), et = CI->arg_end(); it != et; ++it) {
+            const Value *arg = *it;
+            if (tainted.count(arg) > 0)
+                taintedArgs = true;
+            if (!arg->getType()->isPointerTy())
+                continue;
+            if (mayPointTo(arg, secretMem) || mayAccessSecretBytes(arg, 0))
+                secretArgs = true;
+            else if (mayPointTo(arg, sensitiveMem))
+                sensitiveArgs = true;
+        }
+        // this covers also the frees of the secret and sensitive objects
+        if (taintedArgs || secretArgs || sensitiveArgs)
+            touching.insert(CI->getFunction());
+
+        for (const Function *F : getCallees(CI)) {
+            if (F->isDeclaration()) {
+                if (!taintedArgs && !secretArgs)
+                    continue;
+                // an undefined function may return the secret or
+                // copy it to any memory that its arguments point to
+                taint(CI);
+                for (auto it = CI->arg_begin(), et = CI->arg_end(); it != et; ++it) {
+                    if ((*it)->getType()->isPointerTy() && !addObjects(*it, secretMem))
+                        unknownSecret = true;
+                }
+                continue;
+            }
+
+            auto actual = CI->arg_begin();
+            for (auto it = F->arg_begin(), et = F->arg_end();
+                 it != et && actual != CI->arg_end(); ++it, ++actual) {
+                if (tainted.count(*actual) > 0) {
+                    tainted.insert(&*it);
+                    touching.insert(F);
+                }
+            }
+            for (const BasicBlock &B : *F) {
+                auto *RI = dyn_cast<ReturnInst>(B.getTerminator());
+                if (RI && RI->getReturnValue() && tainted.count(RI->getReturnValue()) > 0)
+                    taint(CI);
+            }
+        }
+    }
+
+    void handleInstruction(const Instruction &I) {
+        if (auto *LI = dyn_cast<LoadInst>(&I)) {
+            const Value *ptr = LI->getPointerOperand();
+            if (tainted.count(ptr) > 0) {
+                addObjects(ptr, sensitiveMem);
+                taint(LI);
+            } else if (mayPointTo(ptr, secretMem) ||
+                       mayAccessSecretBytes(ptr, M.getDataLayout().getTypeStoreSize(LI->getType()))) {
+                taint(LI);
+            }
+        } else if (auto *SI = dyn_cast<StoreInst>(&I)) {
+            const Value *ptr = SI->getPointerOperand();
+            if (tainted.count(ptr) > 0) {
+                addObjects(ptr, sensitiveMem);
+                touching.insert(SI->getFunction());
+            }
+            if (tainted.count(SI->getValueOperand()) > 0) {
+                touching.insert(SI->getFunction());
+                if (!addObjects(ptr, secretMem))
+                    unknownSecret = true;
+            }
+        } else if (auto *CI = dyn_cast<CallInst>(&I)) {
+            handleCall(CI);
+        } else if (isa<BranchInst>(&I) || isa<SwitchInst>(&I) || isa<IndirectBrInst>(&I)) {
+            // everything that the branch controls depends on the secret
+            if (anyOperandTainted(I))
+                whole.insert(I.getFunction());
+        } else if (!I.getType()->isVoidTy() && anyOperandTainted(I)) {
+            taint(&I);
+        }
+    }
+
+    // Everything in F depends on the secret.
+    void handleWhole(const Function *F) {
+        touching.insert(F);
+        for (const BasicBlock &B : *F) {
+            for (const Instruction &I : B) {
+                if (!I.getType()->isVoidTy())
+                    tainted.insert(&I);
+                if (auto *SI = dyn_cast<StoreInst>(&I)) {
+                    if (!addObjects(SI->getPointerOperand(), secretMem))
+                        unknownSecret = true;
+                }
+            }
+        }
+        for (const Function *G : callees[F])
+            whole.insert(G);
+    }
+
+    size_t getSize() const {
+        return tainted.size() + secretMem.size() + sensitiveMem.size() +
+               touching.size() + whole.size();
+    }
+
+    void addClosure(std::set<const Function *> &scope, const Function *F,
+                    std::map<const Function *, std::set<const Function *>> &edges) {
+        std::vector<const Function *> queue{F};
+        while (!queue.empty()) {
+            const Function *G = queue.back();
+            queue.pop_back();
+            for (const Function *H : edges[G]) {
+                if (scope.insert(H).second)
+                    queue.push_back(H);
+            }
+        }
+    }
+
+public:
+    SecretScopeAnalysis(Module &m, LLVMPointerAnalysis *pta, const Function *e)
+        : M(m), PTA(pta), entry(e) {}
+
+    std::set<const Function *> run() {
+        buildCallGraph();
+        addSeeds();
+
+        // iterate until nothing changes
+        size_t size;
+        do {
+            size = getSize();
+            for (const Function *F : reachable) {
+                if (whole.count(F) > 0) {
+                    handleWhole(F);
+                    continue;
+                }
+                for (const BasicBlock &B : *F) {
+                    for (const Instruction &I : B)
+                        handleInstruction(I);
+                }
+            }
+        } while (!unknownSecret && size != getSize());
+
+        if (unknownSecret) {
+            errs() << "secret scope: a secret may be stored to unknown memory, "
+                   << "building the graph for all the functions\n";
+            return std::set<const Function *>(reachable.begin(), reachable.end());
+        }
+
+        std::set<const Function *> scope{entry};
+        for (const Function *F : reachable) {
+            if (touching.count(F) == 0 && whole.count(F) == 0)
+                continue;
+            scope.insert(F);
+            addClosure(scope, F, callees);
+            addClosure(scope, F, callers);
+        }
+
+        errs() << "secret scope: building the graph for " << scope.size()
+               << " of " << reachable.size() << " functions\n";
+        return scope;
+    }
+};
+
+std::set<const Function *> getSecretScope(Module &M, LLVMPointerAnalysis *PTA,
+                                          const Function *entry) {
+    return SecretScopeAnalysis(M, PTA, entry).run();
+}
+
+} // namespace llvmdg
+} // namespace dg
@@ -0,0 +1,152 @@
+#include <iterator>
+
+// ignore unused parameters in LLVM libraries
+#if (__clang__)
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wunused-parameter"
+#else
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+#endif
+
+#include <llvm/Analysis/ValueTracking.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/IntrinsicInst.h>
+#include <llvm/IR/Module.h>
+
+#if (__clang__)
+#pragma clang diagnostic pop // ignore -Wunused-parameter
+#else
+#pragma GCC diagnostic pop
+#endif
+
+#include "dg/llvm/Cape/SecretAnnotations.h"
+#include "dg/llvm/Cape/SecretTaint.h"
+
+namespace dg {
+namespace llvmdg {
+
+using namespace llvm;
+
+const Value *SecretTaint::getObject(const Value *ptr) const {
+#if LLVM_VERSION_MAJOR >= 12
+    return getUnderlyingObject(ptr);
+#else
+    return GetUnderlyingObject(const_cast<Value *>(ptr), DL);
+#endif
+}
+
+bool SecretTaint::pointsToSecret(const Value *ptr) const {
+    return secretMem.count(getObject(ptr)) > 0;
+}
+
+bool SecretTaint::anyOperandTainted(const Instruction &I) const {
+    for (const Value *op : I.operands()) {
+        if (isTainted(op))
+            return true;
+    }
+    return false;
+}
+
+bool SecretTaint::isSecretBranch(const BasicBlock *B) const {
+    auto *br = B ? dyn_cast<BranchInst>(B->getTerminator()) : nullptr;
+    return br && br->isConditional() && isTainted(br->getCondition());
+}
+
+// A phi node that merges the paths of a secret-dependent branch
+// depends on the secret even if its incoming values do not.
+// We look only at the branches in the incoming blocks and in
+// their unique predecessors, which covers triangles and diamonds.
+bool SecretTaint::mergesSecretPaths(const PHINode *phi) const {
+    for (const BasicBlock *P : phi->blocks()) {
+        if (isSecretBranch(P) || isSecretBranch(P->getSinglePredecessor()))
+            return true;
+    }
+    return false;
+}
+
+void SecretTaint::handleCall(const CallInst *CI) {
+    const Function *F = CI->getCalledFunction();
+    bool taintRet = false;
+    unsigned i = 0;
+    for (auto it = CI->arg_begin(), et = CI->arg_end(); it != et; ++it, ++i) {
+        const Value *arg = *it;
+        bool t = isTainted(arg);
+        bool p = pointsToSecret(arg);
+        if (F && !F->isDeclaration() && i < F->arg_size()) {
+            const Argument *formal = &*std::next(F->arg_begin(), i);
+            if (t)
+                tainted.insert(formal);
+            if (p)
+                secretMem.insert(formal);
+        } else if (t || p) {
+            // we do not know what an undefined function returns
+            taintRet = true;
+        }
+    }
+
+    if (F && !F->isDeclaration()) {
+        for (const BasicBlock &B : *F) {
+            if (auto *RI = dyn_cast<ReturnInst>(B.getTerminator()))
+                if (RI->getReturnValue() && isTainted(RI->getReturnValue()))
+                    taintRet = true;
+        }
+    }
+
+    if (taintRet)
+        tainted.insert(CI);
+}
+
+void SecretTaint::handleInstruction(const Instruction &I) {
+    if (auto *phi = dyn_cast<PHINode>(&I)) {
+        if (anyOperandTainted(I) || mergesSecretPaths(phi))
+            tainted.insert(phi);
+    } else if (auto *LI = dyn_cast<LoadInst>(&I)) {
+        if (pointsToSecret(LI->getPointerOperand()) ||
+            isTainted(LI->getPointerOperand()))
+            tainted.insert(LI);
+    } else if (auto *SI = dyn_cast<StoreInst>(&I)) {
+        if (isTainted(SI->getValueOperand()))
+            secretMem.insert(getObject(SI->getPointerOperand()));
+    } else if (auto *CI = dyn_cast<CallInst>(&I)) {
+        handleCall(CI);
+    } else if (!I.getType()->isVoidTy() && anyOperandTainted(I)) {
+        tainted.insert(&I);
+    }
+}
+
+SecretTaint::SecretTaint(Module &M) : DL(M.getDataLayout()) {
+    for (GlobalVariable &GV : M.globals()) {
+        if (GV.hasAttribute("secret"))
+            secretMem.insert(&GV);
+    }
+    for (const Value *V : findSecretAnnotations(M)) {
+        if (auto *A = dyn_cast<Argument>(V)) {
+            // the memory that a secret pointer points to holds the secret
+            if (A->getType()->isPointerTy())
+                secretMem.insert(A);
+            else
+                tainted.insert(A);
+        } else if (auto *II = dyn_cast<IntrinsicInst>(V)) {
+            // the field of the object
+            secretMem.insert(getObject(II->getArgOperand(0)));
+        } else {
+            secretMem.insert(V);
+        }
+    }
+
+    // iterate until nothing changes
+    size_t size;
+    do {
+        size = tainted.size() + secretMem.size();
+        for (Function &F : M) {
+            for (BasicBlock &B : F) {
+                for (Instruction &I : B)
+                    handleInstruction(I);
+            }
+        }
+    } while (size != tainted.size() + secretMem.size());
+}
+
+} // namespace llvmdg
+} // namespace dg
@@ -0,0 +1,239 @@
+#include <set>
+#include <vector>
+
+// ignore unused parameters in LLVM libraries
+#if (__clang__)
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wunused-parameter"
+#else
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+#endif
+
+#include <llvm/IR/CFG.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Metadata.h>
+#include <llvm/IR/Module.h>
+
+#if (__clang__)
+#pragma clang diagnostic pop // ignore -Wunused-parameter
+#else
+#pragma GCC diagnostic pop
+#endif
+
+#include "dg/llvm/Cape/Sites.h"
+
+namespace dg {
+namespace llvmdg {
+
+using namespace llvm;
+
+static const char *siteMDName = "cape.site";
+
+static const char *preloadFuncNames[] = {
+    "_Z15preloadInstAddrPc",
+    "_Z16preloadBlockAddrPcPvS0_",
+    "_Z17iterateAllocStacki",
+    "_Z16iterateMallocSeti",
+    "_Z13iterateGlobaliPv",
+    "_Z18iterateAllocStackWi",
+    "_Z17iterateMallocSetWi",
+    "_Z14iterateGlobalWiPv",
+};
+
+int getTransactionSiteId(const CallInst *CI) {
+    MDNode *MD = CI->getMetadata(siteMDName);
+    if (!MD)
+        return -1;
+
+    auto *C = mdconst::dyn_extract<ConstantInt>(MD->getOperand(0));
+    return C ? static_cast<int>(C->getZExtValue()) : -1;
+}
+
+void clearTransactionSiteId(CallInst *CI) {
+    CI->setMetadata(siteMDName, nullptr);
+}
+
+std::vector<CallInst *> getTransactionSites(Module &M) {
+    std::vector<CallInst *> sites;
+    Function *xbegin = M.getFunction("_Z16startTransactionv");
+    if (!xbegin)
+        return sites;
+
+    std::vector<CallInst *> calls;
+    unsigned next = 0;
+    for (Function &F : M) {
+        for (inst_iterator I = inst_begin(F), E = inst_end(F); I != E; ++I) {
+            auto *CI = dyn_cast<CallInst>(&*I);
+            if (!CI || CI->getCalledFunction() != xbegin)
+                continue;
+
+            calls.push_back(CI);
+            int id = getTransactionSiteId(CI);
+            if (id >= 0 && static_cast<unsigned>(id) >= next)
+                next = id + 1;
+        }
+    }
+
+    sites.resize(next);
+    for (CallInst *CI : calls) {
+        int id = getTransactionSiteId(CI);
+        if (id < 0) {
+            auto *num = ConstantInt::get(Type::getInt32Ty(M.getContext()), next);
+            CI->setMetadata(siteMDName,
+                            MDNode::get(M.getContext(), ConstantAsMetadata::get(num)));
+            sites.push_back(CI);
+            ++next;
+        } else {
+            sites[id] = CI;
+        }
+    }
+
+    return sites;
+}
+
+bool isPreloadCall(const Instruction *I) {
+    auto *CI = dyn_cast<CallInst>(I);
+    if (!CI || !CI->getCalledFunction())
+        return false;
+    for (const char *name : preloadFuncNames) {
+        if (CI->getCalledFunction()->getName() == name)
+            return true;
+    }
+    return false;
+}
+
+bool isCapeRuntimeCall(const Instruction *I) {
+    if (isPreloadCall(I))
+        return true;
+    auto *CI = dyn_cast<CallInst>(I);
+    if (!CI || !CI->getCalledFunction())
+        return false;
+    auto name = CI->getCalledFunction()->getName();
+    return name == "_Z16startTransactionv" || name == "_Z14endTransactionv";
+}
+
+// an operand of a call in the block of b that is defined in another
+// block dominates the whole block, so it is available before b as well
+static bool isAvailableBefore(const Instruction *a, const Instruction *b) {
+    if (a->getParent() != b->getParent())
+        return true;
+    for (const Instruction *I = a; I; I = I->getNextNode()) {
+        if (I == b)
+            return true;
+    }
+    return false;
+}
+
+// the call can be repeated before xbegin if all its arguments
+// are available there
+static bool canHoistBefore(const CallInst *CI, const Instruction *xbegin) {
+    for (auto it = CI->arg_begin(), et = CI->arg_end(); it != et; ++it) {
+        const Value *op = *it;
+        if (isa<Constant>(op) || isa<Argument>(op))
+            continue;
+        auto *opI = dyn_cast<Instruction>(op);
+        if (!opI || !isAvailableBefore(opI, xbegin))
+            return false;
+    }
+    return true;
+}
+
+std::vector<CallInst *> getSitePreloads(CallInst *xbegin) {
+    std::vector<CallInst *> preloads;
+    Function *xend = xbegin->getModule()->getFunction("_Z14endTransactionv");
+
+    for (Instruction *I = xbegin->getNextNode(); I; I = I->getNextNode()) {
+        auto *CI = dyn_cast<CallInst>(I);
+        if (CI && xend && CI->getCalledFunction() == xend)
+            break;
+        if (isPreloadCall(I) && canHoistBefore(CI, xbegin))
+            preloads.push_back(CI);
+    }
+    return preloads;
+}
+
+bool TransactionRegion::contains(const Instruction *I) const {
+    return blockSet.count(I->getParent()) > 0 || partialSet.count(I) > 0;
+}
+
+static CallInst *findCall(BasicBlock::iterator it, BasicBlock::iterator et,
+                          const Function *F) {
+    for (; it != et; ++it) {
+        auto *CI = dyn_cast<CallInst>(&*it);
+        if (CI && F && CI->getCalledFunction() == F)
+            return CI;
+    }
+    return nullptr;
+}
+
+static void addPartial(TransactionRegion &T, BasicBlock::iterator it,
+                       BasicBlock::iterator et) {
+    for (; it != et; ++it) {
+        T.partial.push_back(&*it);
+        T.partialSet.insert(&*it);
+    }
+}
+
+static bool writesMemory(const Instruction &I) {
+    return I.mayWriteToMemory() && !isCapeRuntimeCall(&I);
+}
+
+TransactionRegion getTransactionRegion(CallInst *xbegin) {
+    TransactionRegion T;
+    T.xbegin = xbegin;
+    Function *xendF = xbegin->getModule()->getFunction("_Z14endTransactionv");
+
+    BasicBlock *start = xbegin->getParent();
+    auto first = ++xbegin->getIterator();
+    if (CallInst *xend = findCall(first, start->end(), xendF)) {
+        T.xend = xend;
+        addPartial(T, first, xend->getIterator());
+    } else {
+        addPartial(T, first, start->end());
+
+        std::vector<BasicBlock *> queue;
+        std::set<BasicBlock *> seen{start};
+        for (BasicBlock *succ : successors(start))
+            if (seen.insert(succ).second)
+                queue.push_back(succ);
+
+        while (!queue.empty()) {
+            BasicBlock *B = queue.back();
+            queue.pop_back();
+
+            if (CallInst *xend = findCall(B->begin(), B->end(), xendF)) {
+                // more exits would need more checks, keep it simple
+                if (T.xend && T.xend != xend) {
+                    TransactionRegion none;
+                    none.xbegin = xbegin;
+                    return none;
+                }
+                T.xend = xend;
+                continue;
+            }
+
+            T.blocks.push_back(B);
+            T.blockSet.insert(B);
+            for (BasicBlock *succ : successors(B))
+                if (seen.insert(succ).second)
+                    queue.push_back(succ);
+        }
+
+        if (T.xend)
+            addPartial(T, T.xend->getParent()->begin(), T.xend->getIterator());
+    }
+
+    for (BasicBlock *B : T.blocks)
+        for (Instruction &I : *B)
+            T.writesMemory |= writesMemory(I);
+    for (Instruction *I : T.partial)
+        T.writesMemory |= writesMemory(*I);
+
+    return T;
+}
+
+} // namespace llvmdg
+} // namespace dg
@@ -0,0 +1,178 @@
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+
+#include <sys/resource.h>
+
+// ignore unused parameters in LLVM libraries
+#if (__clang__)
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wunused-parameter"
+#else
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+#endif
+
+#include <llvm/IR/InstIterator.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/Format.h>
+#include <llvm/Support/raw_os_ostream.h>
+#include <llvm/Support/raw_ostream.h>
+
+#if (__clang__)
+#pragma clang diagnostic pop // ignore -Wunused-parameter
+#else
+#pragma GCC diagnostic pop
+#endif
+
+#include "dg/llvm/Cape/Sites.h"
+#include "dg/llvm/Cape/Stats.h"
+
+namespace dg {
+namespace llvmdg {
+
+using namespace llvm;
+
+CapeStats::CapeStats() : start(sample()) {}
+
+CapeStats::Sample CapeStats::sample() {
+    Sample s;
+    s.wall = std::chrono::duration<double>(
+                 std::chrono::steady_clock::now().time_since_epoch())
+                 .count();
+
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) == 0) {
+        s.cpu = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 +
+                ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+        s.peakRSS = ru.ru_maxrss;
+    }
+    return s;
+}
+
+CapeStats::Phase &CapeStats::getPhase(const std::string &name) {
+    for (Phase &phase : phases) {
+        if (phase.name == name)
+            return phase;
+    }
+    phases.emplace_back();
+    phases.back().name = name;
+    return phases.back();
+}
+
+void CapeStats::begin(const std::string &name) {
+    // create it now, so that the phases are in the order they started
+    getPhase(name);
+    running[name] = sample();
+}
+
+void CapeStats::end(const std::string &name) {
+    auto it = running.find(name);
+    if (it == running.end())
+        return;
+
+    Sample now = sample();
+    Phase &phase = getPhase(name);
+    ++phase.runs;
+    phase.wallTime += now.wall - it->second.wall;
+    phase.cpuTime += now.cpu - it->second.cpu;
+    phase.peakRSS = std::max(phase.peakRSS, now.peakRSS);
+    running.erase(it);
+}
+
+void CapeStats::countModule(Module &M) {
+    uint64_t sites = 0;
+    for (CallInst *CI : getTransactionSites(M)) {
+        if (CI)
+            ++sites;
+    }
+
+    uint64_t preloads = 0;
+    uint64_t ends = 0;
+    for (Function &F : M) {
+        for (inst_iterator I = inst_begin(F), E = inst_end(F); I != E; ++I) {
+            if (isPreloadCall(&*I)) {
+                ++preloads;
+            } else if (auto *CI = dyn_cast<CallInst>(&*I)) {
+                Function *callee = CI->getCalledFunction();
+                if (callee && callee->getName() == "_Z14endTransactionv")
+                    ++ends;
+            }
+        }
+    }
+
+    setCount("transaction_sites", sites);
+    setCount("transaction_ends", ends);
+    setCount("preload_calls", preloads);
+}
+
+static void writeString(raw_ostream &out, const std::string &str) {
+    out << '"';
+    for (char c : str) {
+        if (c == '"' || c == '\\')
+            out << '\\' << c;
+        else if (static_cast<unsigned char>(c) < 0x20)
+            out << format("\\u%04x", c);
+        else
+            out << c;
+    }
+    out << '"';
+}
+
+static void writeTimes(raw_ostream &out, double wall, double cpu, long peakRSS) {
+    out << "\"wall_s\": " << format("%.6f", wall)
+        << ", \"cpu_s\": " << format("%.6f", cpu)
+        << ", \"peak_rss_kb\": " << peakRSS;
+}
+
+void CapeStats::writeJSON(raw_ostream &out) const {
+    out << "{\n  \"info\": {";
+    const char *sep = "";
+    for (const auto &it : info) {
+        out << sep << "\n    ";
+        writeString(out, it.first);
+        out << ": ";
+        writeString(out, it.second);
+        sep = ",";
+    }
+    out << "\n  },\n  \"phases\": [";
+
+    sep = "";
+    for (const Phase &phase : phases) {
+        out << sep << "\n    {\"name\": ";
+        writeString(out, phase.name);
+        out << ", \"runs\": " << phase.runs << ", ";
+        writeTimes(out, phase.wallTime, phase.cpuTime, phase.peakRSS);
+        out << "}";
+        sep = ",";
+    }
+
+    Sample now = sample();
+    out << "\n  ],\n  \"total\": {";
+    writeTimes(out, now.wall - start.wall, now.cpu - start.cpu, now.peakRSS);
+    out << "},\n  \"counts\": {";
+
+    sep = "";
+    for (const auto &it : counts) {
+        out << sep << "\n    ";
+        writeString(out, it.first);
+        out << ": " << it.second;
+        sep = ",";
+    }
+    out << "\n  }\n}\n";
+}
+
+bool CapeStats::writeJSON(const std::string &file) const {
+    std::ofstream ofs(file);
+    if (!ofs) {
+        errs() << "ERROR: cannot write statistics to " << file << "\n";
+        return false;
+    }
+    raw_os_ostream out(ofs);
+    writeJSON(out);
+    return true;
+}
+
+} // namespace llvmdg
+} // namespace dg
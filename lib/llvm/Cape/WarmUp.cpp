@@ -0,0 +1,72 @@
+#include <set>
+#include <vector>
+
+// ignore unused parameters in LLVM libraries
+#if (__clang__)
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wunused-parameter"
+#else
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+#endif
+
+#include <llvm/IR/DebugInfoMetadata.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Transforms/Utils/BasicBlockUtils.h>
+
+#if (__clang__)
+#pragma clang diagnostic pop // ignore -Wunused-parameter
+#else
+#pragma GCC diagnostic pop
+#endif
+
+#include "dg/llvm/Cape/Sites.h"
+#include "dg/llvm/Cape/WarmUp.h"
+
+namespace dg {
+namespace llvmdg {
+
+using namespace llvm;
+
+unsigned addWarmUp(Module &M, const std::set<unsigned> *only) {
+    unsigned num = 0;
+    auto sites = getTransactionSites(M);
+
+    for (unsigned id = 0; id < sites.size(); ++id) {
+        CallInst *xbegin = sites[id];
+        if (!xbegin || (only && only->count(id) == 0))
+            continue;
+        auto preloads = getSitePreloads(xbegin);
+        if (preloads.empty())
+            continue;
+
+        IRBuilder<> builder(xbegin);
+        auto c = M.getOrInsertFunction("_Z17capeWarmUpEnabledi", builder.getInt1Ty(),
+                                       builder.getInt32Ty());
+        Function *enabled = cast<Function>(c);
+        auto cond = builder.CreateCall(enabled, {builder.getInt32(id)});
+        cond->setDebugLoc(xbegin->getDebugLoc());
+
+        // if (capeWarmUpEnabled(id)) { preloads }; xbegin; preloads
+        Instruction *term = SplitBlockAndInsertIfThen(cond, xbegin, false);
+        for (CallInst *CI : preloads) {
+            Instruction *clone = CI->clone();
+            clone->insertBefore(term);
+        }
+
+        errs() << "warm-up added to site " << id << " in "
+               << xbegin->getFunction()->getName();
+        if (const DebugLoc &DL = xbegin->getDebugLoc())
+            errs() << " (line " << DL.getLine() << ")";
+        errs() << "\n";
+        ++num;
+    }
+
+    return num;
+}
+
+} // namespace llvmdg
+} // namespace dg
@@ -0,0 +1,393 @@
+#include <cctype>
+#include <fstream>
+#include <map>
+#include <set>
+#include <sstream>
+
+// ignore unused parameters in LLVM libraries
+#if (__clang__)
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wunused-parameter"
+#else
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+#endif
+
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/GlobalAlias.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Metadata.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/IRReader/IRReader.h>
+#include <llvm/Linker/Linker.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/SourceMgr.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+
+#if (__clang__)
+#pragma clang diagnostic pop // ignore -Wunused-parameter
+#else
+#pragma GCC diagnostic pop
+#endif
+
+#include "dg/llvm/Cape/WholeProgram.h"
+
+namespace dg {
+namespace llvmdg {
+
+using namespace llvm;
+
+// !cape.unit !{!"file", !"source file name"} on the definitions
+static const char *unitMDName = "cape.unit";
+// !cape.name !{!"name"} on the local definitions, the linker renames
+// them when another unit has a local of the same name (e.g., .str)
+static const char *nameMDName = "cape.name";
+// the list of the units, in the order of the files
+static const char *unitsMDName = "cape.units";
+
+static MDNode *getUnit(const GlobalValue *GV) {
+    if (auto *GA = dyn_cast<GlobalAlias>(GV))
+#if LLVM_VERSION_MAJOR >= 14
+        GV = GA->getAliaseeObject();
+#else
+        GV = GA->getBaseObject();
+#endif
+    auto *GO = dyn_cast_or_null<GlobalObject>(GV);
+    return GO ? GO->getMetadata(unitMDName) : nullptr;
+}
+
+static std::string getUnitString(const MDNode *unit, unsigned idx) {
+    return cast<MDString>(unit->getOperand(idx))->getString().str();
+}
+
+// The name of GO in its unit (it may be renamed in the linked module).
+static std::string getUnitName(const GlobalObject *GO) {
+    if (MDNode *name = GO->getMetadata(nameMDName))
+        return cast<MDString>(name->getOperand(0))->getString().str();
+    return GO->getName().str();
+}
+
+static void tagDefinition(GlobalObject &GO, MDNode *unit) {
+    GO.setMetadata(unitMDName, unit);
+    if (GO.hasLocalLinkage() && GO.hasName()) {
+        LLVMContext &ctx = GO.getContext();
+        GO.setMetadata(nameMDName, MDNode::get(ctx, MDString::get(ctx, GO.getName())));
+    }
+}
+
+std::unique_ptr<Module> linkUnits(LLVMContext &ctx, const std::vector<std::string> &files) {
+    std::unique_ptr<Module> M;
+    std::vector<MDNode *> units;
+    for (const std::string &file : files) {
+        SMDiagnostic SMD;
+        // the linker reads only the bodies that it links
+        auto unit = getLazyIRFileModule(file, SMD, ctx);
+        if (!unit) {
+            errs() << "Failed parsing '" << file << "' file:\n";
+            SMD.print("llvm-dg-dump", errs());
+            return nullptr;
+        }
+
+        MDNode *tag = MDNode::get(ctx, {MDString::get(ctx, file),
+                                        MDString::get(ctx, unit->getSourceFileName())});
+        units.push_back(tag);
+        for (Function &F : *unit) {
+            if (!F.isDeclaration())
+                tagDefinition(F, tag);
+        }
+        for (GlobalVariable &GV : unit->globals()) {
+            if (!GV.isDeclaration())
+                tagDefinition(GV, tag);
+        }
+
+        if (!M) {
+            if (Error E = unit->materializeAll()) {
+                errs() << "ERROR: cannot load " << file << ": "
+                       << toString(std::move(E)) << "\n";
+                return nullptr;
+            }
+            M = std::move(unit);
+            continue;
+        }
+
+        if (Linker::linkModules(*M, std::move(unit))) {
+            errs() << "ERROR: cannot link " << file << "\n";
+            return nullptr;
+        }
+    }
+
+    if (M) {
+        NamedMDNode *list = M->getOrInsertNamedMetadata(unitsMDName);
+        for (MDNode *tag : units)
+            list->addOperand(tag);
+    }
+    return M;
+}
+
+// Add the units of the code that uses V (through constants, too).
+static void getUserUnits(const Value *V, std::set<const MDNode *> &units,
+                         std::set<const Value *> &visited) {
+    for (const User *U : V->users()) {
+        if (!visited.insert(U).second)
+            continue;
+        if (auto *I = dyn_cast<Instruction>(U)) {
+            units.insert(getUnit(I->getFunction()));
+        } else if (auto *GV = dyn_cast<GlobalValue>(U)) {
+            units.insert(getUnit(GV));
+        } else if (isa<Constant>(U)) {
+            getUserUnits(U, units, visited);
+        }
+    }
+}
+
+// The ids of the units in the names of the promoted symbols: the name of
+// the source file without its directory (so that the symbols do not
+// depend on where and how the files were given), with the characters
+// other than letters and digits replaced by '_', and with the index of
+// the unit if more units have the same name.
+using UnitIds = std::map<const MDNode *, std::string>;
+
+static UnitIds getUnitIds(const NamedMDNode *list) {
+    UnitIds ids;
+    std::map<std::string, unsigned> counts;
+    for (const MDNode *unit : list->operands()) {
+        std::string id = sys::path::filename(getUnitString(unit, 1)).str();
+        if (id.empty())
+            id = "unit";
+        for (char &c : id) {
+            if (!isalnum(static_cast<unsigned char>(c)))
+                c = '_';
+        }
+        ++counts[id];
+        ids[unit] = id;
+    }
+
+    unsigned idx = 0;
+    for (const MDNode *unit : list->operands()) {
+        if (counts[ids[unit]] > 1)
+            ids[unit] += "." + std::to_string(idx);
+        ++idx;
+    }
+    return ids;
+}
+
+// Make GV linkable from the other units of the program. A local gets
+// the name that it has in its unit prefixed by the id of the unit, so
+// that the name does not depend on the other units.
+static void promote(GlobalValue &GV, const UnitIds &ids, unsigned &unnamed) {
+    if (GV.hasLocalLinkage()) {
+        auto id = ids.find(getUnit(&GV));
+        std::string name = "cape." + (id != ids.end() ? id->second : std::string("main")) + ".";
+        auto *GO = dyn_cast<GlobalObject>(&GV);
+        if (GO && GO->getMetadata(nameMDName))
+            name += getUnitName(GO);
+        else if (GV.hasName())
+            name += GV.getName().str();
+        else
+            name += "anon." + std::to_string(unnamed++);
+        GV.setName(name);
+        GV.setLinkage(GlobalValue::ExternalLinkage);
+        GV.setVisibility(GlobalValue::HiddenVisibility);
+    } else if (GV.hasLinkOnceODRLinkage()) {
+        GV.setLinkage(GlobalValue::WeakODRLinkage);
+    } else if (GV.hasLinkOnceLinkage()) {
+        GV.setLinkage(GlobalValue::WeakAnyLinkage);
+    }
+}
+
+// Give every definition a unit and promote what other units use.
+static void assignUnits(Module &M, MDNode *mainUnit, const UnitIds &ids) {
+    std::vector<GlobalObject *> objects;
+    for (Function &F : M)
+        objects.push_back(&F);
+    for (GlobalVariable &GV : M.globals())
+        objects.push_back(&GV);
+
+    for (GlobalObject *GO : objects) {
+        if (!GO->isDeclaration() && !GO->getMetadata(unitMDName))
+            GO->setMetadata(unitMDName, mainUnit);
+    }
+
+    std::vector<GlobalValue *> values(objects.begin(), objects.end());
+    for (GlobalAlias &GA : M.aliases())
+        values.push_back(&GA);
+
+    std::map<const MDNode *, unsigned> unnamed;
+    for (GlobalValue *GV : values) {
+        // e.g., llvm.global_ctors stays in one unit as a whole
+        if (GV->isDeclaration() || GV->hasAppendingLinkage() ||
+            GV->hasAvailableExternallyLinkage())
+            continue;
+        GV->removeDeadConstantUsers();
+
+        std::set<const MDNode *> units;
+        std::set<const Value *> visited;
+        getUserUnits(GV, units, visited);
+        const MDNode *owner = getUnit(GV);
+        for (const MDNode *unit : units) {
+            if (unit && unit != owner) {
+                promote(*GV, ids, unnamed[owner]);
+                break;
+            }
+        }
+    }
+}
+
+// Turn the definitions of the other units into declarations and give
+// the locals of the unit back their names.
+static void extractUnit(Module &M, const MDNode *unit) {
+    unsigned kind = M.getContext().getMDKindID(unitMDName);
+    unsigned nameKind = M.getContext().getMDKindID(nameMDName);
+    std::vector<std::pair<GlobalObject *, std::string>> locals;
+    auto keep = [&](GlobalObject &GO) {
+        if (GO.hasLocalLinkage() && GO.getMetadata(nameKind))
+            locals.emplace_back(&GO, getUnitName(&GO));
+        GO.eraseMetadata(kind);
+        GO.eraseMetadata(nameKind);
+    };
+
+    for (Function &F : M) {
+        if (F.isDeclaration())
+            continue;
+        if (getUnit(&F) == unit) {
+            keep(F);
+            continue;
+        }
+        // also drops the metadata
+        F.deleteBody();
+        F.setComdat(nullptr);
+    }
+
+    std::vector<GlobalVariable *> appending;
+    for (GlobalVariable &GV : M.globals()) {
+        if (GV.isDeclaration())
+            continue;
+        if (getUnit(&GV) == unit) {
+            keep(GV);
+            continue;
+        }
+        if (GV.hasAppendingLinkage()) {
+            appending.push_back(&GV);
+            continue;
+        }
+        GV.setInitializer(nullptr);
+        GV.setLinkage(GlobalValue::ExternalLinkage);
+        GV.setComdat(nullptr);
+        GV.eraseMetadata(kind);
+        GV.eraseMetadata(nameKind);
+        GV.eraseMetadata(LLVMContext::MD_dbg);
+    }
+    for (GlobalVariable *GV : appending)
+        GV->eraseFromParent();
+
+    std::vector<GlobalAlias *> aliases;
+    for (GlobalAlias &GA : M.aliases()) {
+        if (getUnit(&GA) != unit)
+            aliases.push_back(&GA);
+    }
+    for (GlobalAlias *GA : aliases) {
+        GlobalValue *decl;
+        if (auto *FT = dyn_cast<FunctionType>(GA->getValueType()))
+            decl = Function::Create(FT, GlobalValue::ExternalLinkage, "", &M);
+        else
+            decl = new GlobalVariable(M, GA->getValueType(), false,
+                                      GlobalValue::ExternalLinkage, nullptr);
+        decl->takeName(GA);
+        GA->replaceAllUsesWith(ConstantExpr::getBitCast(decl, GA->getType()));
+        GA->eraseFromParent();
+    }
+
+    // the declarations that only the other units needed
+    std::vector<GlobalValue *> unused;
+    for (Function &F : M) {
+        F.removeDeadConstantUsers();
+        if (F.isDeclaration() && F.use_empty())
+            unused.push_back(&F);
+    }
+    for (GlobalVariable &GV : M.globals()) {
+        GV.removeDeadConstantUsers();
+        if (GV.isDeclaration() && GV.use_empty())
+            unused.push_back(&GV);
+    }
+    for (GlobalValue *GV : unused)
+        GV->eraseFromParent();
+
+    // the names were unique in the unit, free them all first so that
+    // e.g. .str.1 -> .str and .str.3 -> .str.1 do not collide
+    for (auto &local : locals)
+        local.first->setName("");
+    for (auto &local : locals)
+        local.first->setName(local.second);
+
+    if (NamedMDNode *list = M.getNamedMetadata(unitsMDName))
+        M.eraseNamedMetadata(list);
+}
+
+static bool sameContents(const std::string &file, const std::string &text) {
+    std::ifstream ifs(file);
+    if (!ifs)
+        return false;
+    std::stringstream ss;
+    ss << ifs.rdbuf();
+    return ss.str() == text;
+}
+
+bool writeUnits(Module &M, const std::string &entry, unsigned *written) {
+    *written = 0;
+    NamedMDNode *list = M.getNamedMetadata(unitsMDName);
+    if (!list || list->getNumOperands() == 0) {
+        errs() << "ERROR: the module is not linked from units\n";
+        return false;
+    }
+
+    MDNode *mainUnit = list->getOperand(0);
+    if (Function *F = M.getFunction(entry)) {
+        if (MDNode *unit = getUnit(F))
+            mainUnit = unit;
+    }
+    assignUnits(M, mainUnit, getUnitIds(list));
+
+    for (MDNode *unit : list->operands()) {
+        std::string file = getUnitString(unit, 0);
+#if LLVM_VERSION_MAJOR >= 7
+        std::unique_ptr<Module> part = CloneModule(M);
+#else
+        std::unique_ptr<Module> part = CloneModule(&M);
+#endif
+        extractUnit(*part, unit);
+        // like the names, the text does not depend on the path
+        part->setModuleIdentifier(sys::path::filename(file));
+        part->setSourceFileName(getUnitString(unit, 1));
+
+        if (verifyModule(*part, &errs())) {
+            errs() << "ERROR: the instrumented unit " << file << " is broken\n";
+            return false;
+        }
+
+        std::string text;
+        {
+            raw_string_ostream out(text);
+            part->print(out, nullptr);
+        }
+
+        std::string outName = file + "_ac.ll";
+        if (sameContents(outName, text))
+            continue;
+
+        std::ofstream ofs(outName);
+        if (!ofs) {
+            errs() << "ERROR: cannot write " << outName << "\n";
+            return false;
+        }
+        ofs << text;
+        ++*written;
+    }
+    return true;
+}
+
+} // namespace llvmdg
+} // namespace dg
@@ -140,7 +140,11 @@ void LLVMDefUseAnalysis::addDataDependencies(LLVMNode *node) {
             // We need to add interprocedural edge
             llvm::Function *F = llvm::cast<llvm::Instruction>(def)->getParent()->getParent();
             LLVMNode *entryNode = dg->getGlobalNode(F);
-            assert(entryNode && "Don't have built function");
+            if (!entryNode) {
+                // the function is out of the scope of the graph
+                // (LLVMDependenceGraph::setFunctionScope)
+                continue;
+            }
 
             // get the graph where the node lives
             LLVMDependenceGraph *graph = entryNode->getDG();
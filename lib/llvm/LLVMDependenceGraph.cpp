@@ -67,21 +67,6 @@ namespace dg {
 //  -- LLVMDependenceGraph
 /// ------------------------------------------------------------------
 
-std::vector<llvm::CallInst *> allFreeCalls;
-
-const std::vector<llvm::CallInst *> *getAllFreeCalls() {
-    return &allFreeCalls;
-}
-
-// map of all constructed functions
-std::map<llvm::Value *, LLVMDependenceGraph *> constructedFunctions;
-
-const std::map<llvm::Value *,
-               LLVMDependenceGraph *> &
-getConstructedFunctions() {
-    return constructedFunctions;
-}
-
 LLVMDependenceGraph::~LLVMDependenceGraph() {
     // delete nodes
     for (auto I = begin(), E = end(); I != E; ++I) {
@@ -270,7 +255,7 @@ LLVMDependenceGraph::buildSubgraph(LLVMNode *node, llvm::Function *callFunc, boo
 
     // if we don't have this subgraph constructed, construct it
     // else just add call edge
-    LLVMDependenceGraph *&subgraph = constructedFunctions[callFunc];
+    LLVMDependenceGraph *&subgraph = moduleGraphs->constructedFunctions[callFunc];
     if (!subgraph) {
         // since we have reference the the pointer in
         // constructedFunctions, we can assing to it
@@ -278,9 +263,11 @@ LLVMDependenceGraph::buildSubgraph(LLVMNode *node, llvm::Function *callFunc, boo
         // set global nodes to this one, so that
         // we'll share them
         subgraph->setGlobalNodes(getGlobalNodes());
+        subgraph->moduleGraphs = moduleGraphs;
         subgraph->module = module;
         subgraph->PTA = PTA;
         subgraph->threads = this->threads;
+        subgraph->functionScope = this->functionScope;
         // make subgraphs gather the call-sites too
         subgraph->gatherCallsites(gather_callsites, gatheredCallsites);
 
@@ -444,14 +431,14 @@ void LLVMDependenceGraph::handleInstruction(llvm::Value *val,
                 // vararg may introduce imprecision here, so we
                 // must check that it is really pointer to a function
                 Function *F = dyn_cast<Function>(ptr.value);
-                if (!F)
+                if (!F || !isInScope(F))
                     continue;
 
                 if (F->size() == 0 || !llvmutils::callIsCompatible(F, CInst)) {
                     if (threads && F && F->getName() == "pthread_create") {
                         auto possibleFunctions = getCalledFunctions(CInst->getArgOperand(2), PTA);
                         for (auto &function : possibleFunctions) {
-                            if (function->size() > 0) {
+                            if (function->size() > 0 && isInScope(function)) {
                                 LLVMDependenceGraph *subg = buildSubgraph(node,
                                                                           const_cast<llvm::Function *>(function),
                                                                           true /*this is fork*/);
@@ -475,7 +462,7 @@ void LLVMDependenceGraph::handleInstruction(llvm::Value *val,
             gatheredCallsites->insert(node);
         }
 
-        if (is_func_defined(func)) {
+        if (is_func_defined(func) && isInScope(func)) {
             LLVMDependenceGraph *subg = buildSubgraph(node, func);
             node->addSubgraph(subg);
         }
@@ -491,6 +478,8 @@ void LLVMDependenceGraph::handleInstruction(llvm::Value *val,
         if (threads && func && func->getName() == "pthread_create") {
             auto possibleFunctions = getCalledFunctions(CInst->getArgOperand(2), PTA);
             for (auto &function : possibleFunctions) {
+                if (!isInScope(function))
+                    continue;
                 auto *subg = buildSubgraph(node,
                                            const_cast<llvm::Function *>(function),
                                            true /*this is fork*/);
@@ -504,7 +493,7 @@ void LLVMDependenceGraph::handleInstruction(llvm::Value *val,
 
         if (func) {
             if (func->getName().equals("free")) {
-                allFreeCalls.push_back(CInst);
+                moduleGraphs->freeCalls.push_back(CInst);
             }
             // else if (func->getName().contains("startTransaction")) {
             //     txnBeginCallNodes.push_back(node);
@@ -697,7 +686,7 @@ bool LLVMDependenceGraph::build(llvm::Function *func) {
     if (func->size() == 0)
         return false;
 
-    constructedFunctions.insert(make_pair(func, this));
+    moduleGraphs->constructedFunctions.insert(make_pair(func, this));
 
     // create entry node
     LLVMNode *entry = new LLVMNode(func);
@@ -912,7 +901,7 @@ bool LLVMDependenceGraph::getCallSites(const char *name, std::set<LLVMNode *> *c
 
 bool LLVMDependenceGraph::getCallSites(const char *names[],
                                        std::set<LLVMNode *> *callsites) {
-    for (auto &F : constructedFunctions) {
+    for (auto &F : getConstructedFunctions()) {
         for (auto &I : F.second->getBlocks()) {
             LLVMBBlock *BB = I.second;
             for (LLVMNode *n : BB->getNodes()) {
@@ -929,7 +918,7 @@ bool LLVMDependenceGraph::getCallSites(const char *names[],
 
 bool LLVMDependenceGraph::getCallSites(const std::vector<std::string> &names,
                                        std::set<LLVMNode *> *callsites) {
-    for (const auto &F : constructedFunctions) {
+    for (const auto &F : getConstructedFunctions()) {
         for (const auto &I : F.second->getBlocks()) {
             LLVMBBlock *BB = I.second;
             for (LLVMNode *n : BB->getNodes()) {
@@ -979,6 +968,25 @@ bool LLVMDependenceGraph::getSecretNodes(llvm::Value *vl,
     return callsites->size() != 0;
 }
 
+bool LLVMDependenceGraph::getAnnotatedSecretNodes(const std::vector<llvm::Value *> &secrets,
+                                                  std::set<LLVMNode *> *callsites) {
+    const auto &CF = getConstructedFunctions();
+    for (llvm::Value *vl : secrets) {
+        if (auto *I = llvm::dyn_cast<llvm::Instruction>(vl)) {
+            if (LLVMNode *nd = findInstruction(I, CF))
+                callsites->insert(nd);
+            continue;
+        }
+        // the parameter has no node of its own
+        for (llvm::User *U : vl->users()) {
+            auto *I = llvm::dyn_cast<llvm::Instruction>(U);
+            if (LLVMNode *nd = I ? findInstruction(I, CF) : nullptr)
+                callsites->insert(nd);
+        }
+    }
+    return callsites->size() != 0;
+}
+
 void LLVMDependenceGraph::computeNTSCD(const LLVMControlDependenceAnalysisOptions &opts) {
     DBG_SECTION_BEGIN(llvmdg, "Filling in CDA edges (NTSCD)");
     dg::llvmdg::NTSCD ntscd(this->module, opts);
@@ -1071,10 +1079,14 @@ void LLVMDependenceGraph::computeInterferenceDependentEdges(ControlFlowGraph *co
 void LLVMDependenceGraph::computeForkJoinDependencies(ControlFlowGraph *controlFlowGraph) {
     auto joins = controlFlowGraph->getJoins();
     for (const auto &join : joins) {
-        auto joinNode = findInstruction(castToLLVMInstruction(join), constructedFunctions);
+        auto joinNode = findInstruction(castToLLVMInstruction(join), getConstructedFunctions());
+        // the join is in a function out of the scope of the graph
+        if (!joinNode)
+            continue;
         for (const auto &fork : controlFlowGraph->getCorrespondingForks(join)) {
-            auto forkNode = findInstruction(castToLLVMInstruction(fork), constructedFunctions);
-            joinNode->addControlDependence(forkNode);
+            auto forkNode = findInstruction(castToLLVMInstruction(fork), getConstructedFunctions());
+            if (forkNode)
+                joinNode->addControlDependence(forkNode);
         }
     }
 }
@@ -1083,11 +1095,14 @@ void LLVMDependenceGraph::computeCriticalSections(ControlFlowGraph *controlFlowG
     auto locks = controlFlowGraph->getLocks();
     for (auto lock : locks) {
         auto callLockInst = castToLLVMInstruction(lock);
-        auto lockNode = findInstruction(callLockInst, constructedFunctions);
+        auto lockNode = findInstruction(callLockInst, getConstructedFunctions());
+        // the lock is in a function out of the scope of the graph
+        if (!lockNode)
+            continue;
         auto correspondingNodes = controlFlowGraph->getCorrespondingCriticalSection(lock);
         for (auto correspondingNode : correspondingNodes) {
             auto node = castToLLVMInstruction(correspondingNode);
-            auto dependentNode = findInstruction(node, constructedFunctions);
+            auto dependentNode = findInstruction(node, getConstructedFunctions());
             if (dependentNode) {
                 lockNode->addControlDependence(dependentNode);
             } else {
@@ -1101,7 +1116,7 @@ void LLVMDependenceGraph::computeCriticalSections(ControlFlowGraph *controlFlowG
         auto correspondingUnlocks = controlFlowGraph->getCorrespongingUnlocks(lock);
         for (auto unlock : correspondingUnlocks) {
             auto node = castToLLVMInstruction(unlock);
-            auto unlockNode = findInstruction(node, constructedFunctions);
+            auto unlockNode = findInstruction(node, getConstructedFunctions());
             if (unlockNode) {
                 unlockNode->addControlDependence(lockNode);
             }
@@ -1114,8 +1129,8 @@ void LLVMDependenceGraph::computeInterferenceDependentEdges(const std::set<const
 
     for (const auto &load : loads) {
         auto *loadInst = const_cast<llvm::Instruction *>(load);
-        auto loadFunction = constructedFunctions.find(const_cast<llvm::Function *>(load->getParent()->getParent()));
-        if (loadFunction == constructedFunctions.end())
+        auto loadFunction = getConstructedFunctions().find(const_cast<llvm::Function *>(load->getParent()->getParent()));
+        if (loadFunction == getConstructedFunctions().end())
             continue;
         auto loadNode = loadFunction->second->findNode(loadInst);
         if (!loadNode)
@@ -1123,8 +1138,8 @@ void LLVMDependenceGraph::computeInterferenceDependentEdges(const std::set<const
 
         for (const auto &store : stores) {
             auto *storeInst = const_cast<llvm::Instruction *>(store);
-            auto storeFunction = constructedFunctions.find(const_cast<llvm::Function *>(store->getParent()->getParent()));
-            if (storeFunction == constructedFunctions.end())
+            auto storeFunction = getConstructedFunctions().find(const_cast<llvm::Function *>(store->getParent()->getParent()));
+            if (storeFunction == getConstructedFunctions().end())
                 continue;
             auto storeNode = storeFunction->second->findNode(storeInst);
             if (!storeNode)
@@ -1,6 +1,6 @@
 #include "common.h"
 
-__attribute__((annotate("secret"))) volatile int *rk;
+__attribute__((annotate("secret"))) CAPE_TLS volatile int *rk;
 
 #ifdef AES_LONG
 typedef unsigned long u32;
@@ -183,7 +183,7 @@ static const u64 Te[256] = {
  * in and out can overlap
  */
 // void AES_encrypt(const char *in, char *out, const AES_KEY *key)
-void AES_encrypt(const char *in, char *out) {
+__attribute__((noinline)) __attribute__((annotate("cloak"))) void AES_encrypt(const char *in, char *out) {
 
     // const u32 *rk;
     u32 s0, s1, s2, s3, t[4];
@@ -297,6 +297,37 @@ void AES_encrypt(const char *in, char *out) {
         rk[3];
 }
 
+#ifdef CAPE_THREADS
+#include "threads.h"
+
+const char *aesIn = "plaintext-2019-plaintext-2019-plaintext-2019-plaintext-2019-plaintext-2019-plaintext-2019-plaintext-2019-plaintext-2019";
+CAPE_TLS char *aesOut;
+CAPE_TLS volatile int *aesKeys;
+
+void aesInit(int tid) {
+    // numSecs round keys of 44 ints each
+    capeThreadSecs = new int[numSecs * 44];
+    capeGenerateThreadSecrets(tid, numSecs * 44, capeThreadSecs, RAND_MAX);
+    aesOut = (char *)malloc(100);
+    aesKeys = (int *)malloc(176); // 44 ints
+}
+
+void aesKernel(int tid, int i) {
+    rk = aesKeys;
+    for (int j = 0; j < 44; j++)
+        rk[j] = capeThreadSecs[(i % numSecs) * 44 + j];
+    AES_encrypt(aesIn, aesOut);
+}
+
+// aes infile.txt out.csv: run AES_encrypt on up to CAPE_MAX_THREADS threads
+int main(int argc, char *argv[]) {
+    FILE *fp = fopen(argv[1], "r");
+
+    loadInput(fp);
+
+    capeRunThreads("aes", capeMaxThreads(), iters, aesInit, aesKernel, argv[2]);
+}
+#else
 int main(int argc, char *argv[]) {
     char *in = "plaintext-2019-plaintext-2019-plaintext-2019-plaintext-2019-plaintext-2019-plaintext-2019-plaintext-2019-plaintext-2019";
     char *out = (char *)malloc(100);
@@ -320,10 +351,12 @@ int main(int argc, char *argv[]) {
     auto start_t = __parsec_roi_begin();
 
     for (int i = 0; i < iters; i++) {
+        capeIterBegin();
         for (int j = 0; j < 44; j++)
             rk[j] = secs[i][j];
         AES_encrypt(in, out);
         rk = oldrk;
+        capeIterEnd();
     }
 
     auto end_t = __parsec_roi_end();
@@ -332,3 +365,4 @@ int main(int argc, char *argv[]) {
 
     printCycles(time, argv[2]);
 }
+#endif
@@ -0,0 +1,62 @@
+#!/bin/bash
+
+# Run the benchmark binaries built by the "benchmark" CMake target
+# (<benchmark>_baseline, <benchmark>_cape, <benchmark>_nopreload in the
+# current directory) over a sweep of input sizes and collect one CSV row
+# per run (see capeWriteCsv in common.h).
+# Usage: ./bench.sh [-r runs] [-s "sizes"] [-i iters] [-o out.csv] [-p perf.csv] benchmark...
+#        (e.g., ./bench.sh -s "100 1000 10000" -o results.csv aes dtree)
+# The sizes and iterations replace the first two numbers of infile.txt.
+# -p collects the hardware counters of binaries built with -DCAPE_PERF
+# (see capePerfReport in common.h).
+
+RUNS=5
+SIZES="100 1000 10000"
+ITERS=10000
+OUT=results.csv
+PERF=
+INFILE=$(dirname $0)/infile.txt
+
+while getopts "r:s:i:o:p:" opt
+do
+        case $opt in
+        r) RUNS=$OPTARG ;;
+        s) SIZES=$OPTARG ;;
+        i) ITERS=$OPTARG ;;
+        o) OUT=$OPTARG ;;
+        p) PERF=$OPTARG ;;
+        *) exit 1 ;;
+        esac
+done
+shift $((OPTIND - 1))
+
+if [ ! -f $OUT ]; then
+        echo "bench,variant,size,iters,seconds,cycles,iters_per_s,p50_cycles,p90_cycles,p99_cycles,tx_attempts,tx_commits,attempts_per_commit" > $OUT
+fi
+
+if [ -n "$PERF" ]; then
+        if [ ! -f $PERF ]; then
+                echo "bench,variant,size,scope,event,value" > $PERF
+        fi
+        export CAPE_PERF_CSV=$PERF
+fi
+
+# the code range of infile.txt is kept for every size
+read -r _ _ CODE_START CODE_LENGTH < $INFILE
+
+for b in "$@"
+do
+        for size in $SIZES
+        do
+                echo "$size $ITERS $CODE_START $CODE_LENGTH" > $b\_in\_$size.txt
+                for v in baseline cape nopreload
+                do
+                        for ((i = 0; i < RUNS; i++))
+                        do
+                                CMD="CAPE_CSV=$OUT CAPE_BENCH=$b CAPE_VARIANT=$v ./$b\_$v $b\_in\_$size.txt $b\_$v.txt > /dev/null";
+                                echo $CMD;
+                                eval $CMD || echo "$b $v failed with size $size" >&2;
+                        done
+                done
+        done
+done
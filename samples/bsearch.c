@@ -18,7 +18,7 @@ __attribute__((annotate("secret"))) int g;
  * have to make lim 3, then halve, obtaining 1, so that we will only
  * look at item 3.
  */
-__attribute__((noinline)) void *
+__attribute__((noinline)) __attribute__((annotate("cloak"))) void *
 bsearch(const void *key, const void *base0,
         size_t nmemb, size_t size,
         int (*compar)(const int, const int)) {
@@ -104,9 +104,11 @@ int main(int argc, char *argv[]) {
     auto start_t = __parsec_roi_begin();
 
     for (int i = 0; i < iters; i++) {
+        capeIterBegin();
         g = secs[i % numSecs];
         int *item = (int *)bsearch(&g, values, size, sizeof(int), cmpfunc);
         sum += (item == NULL ? 0 : 1);
+        capeIterEnd();
     }
 
     auto end_t = __parsec_roi_end();
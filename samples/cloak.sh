@@ -0,0 +1,54 @@
+#!/bin/bash
+
+# Compare Cape's targeted preloading with Cloak-style transactions that
+# preload everything around the functions annotated "cloak".
+# Usage: ./cloak.sh [runs] benchmark...   (e.g., ./cloak.sh 10 aes dtree)
+# Both variants are built from the same bitcode. For every benchmark and
+# variant, prints the average time and the average ratio of transaction
+# attempts to commits (1.0 means no aborts).
+
+RUNS=5
+if [[ "$1" =~ ^[0-9]+$ ]]; then
+        RUNS=$1
+        shift
+fi
+
+for b in "$@"
+do
+        CMD="clang++-6.0 -emit-llvm -c $b.c -mrtm -O3 -DUSE_TX -fno-use-cxa-atexit -o $b\_tx.bc";
+        echo $CMD;
+        eval $CMD;
+
+        for v in cape cloak
+        do
+                if [ $v == "cloak" ]; then
+                        FLAGS="-cloak"
+                else
+                        FLAGS=""
+                fi
+
+                # llvm-dg-dump writes <input>_ac.ll, so give each variant its own input
+                cp $b\_tx.bc $b\_$v.bc
+
+                CMD="../build/tools/llvm-dg-dump $FLAGS $b\_$v.bc > $b\_ac\_$v.err 2>&1";
+                echo $CMD;
+                eval $CMD;
+
+                CMD="clang++-6.0 $b\_$v.bc_ac.ll -O3 -o $b\_$v";
+                echo $CMD;
+                eval $CMD;
+
+                rm -f $b\_$v.txt
+                START=$(date +%s.%N)
+                for ((i = 0; i < RUNS; i++))
+                do
+                        ./$b\_$v infile.txt $b\_$v.txt > /dev/null
+                done
+                END=$(date +%s.%N)
+
+                # printCycles appends "<roi time> <attempts/commits> "
+                awk -v b=$b -v v=$v -v wall=$(echo "$END - $START" | bc) -v runs=$RUNS \
+                    '{ for (i = 2; i <= NF; i += 2) { r += $i; n++ } }
+                     END { printf "%s %s: wall %.4f s/run, tx attempts/commits %.4f\n", b, v, wall / runs, n ? r / n : 0 }' $b\_$v.txt
+        done
+done
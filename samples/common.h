@@ -5,12 +5,17 @@
 #ifndef DG_COMMON_H
 #define DG_COMMON_H
 
+#include <algorithm>
 #include <chrono>
+#include <errno.h>
 #include <immintrin.h>
 #include <map>
 #include <set>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/types.h> /* size_t */
 #include <utility>     // std::pair, std::get
 #include <vector>
@@ -19,9 +24,17 @@
 using namespace std;
 using namespace std::chrono;
 
+// With CAPE_THREADS (see threads.h), the state of the runtime is per
+// thread, so that the threads do not share (and conflict on) it.
+#ifdef CAPE_THREADS
+#define CAPE_TLS thread_local
+#else
+#define CAPE_TLS
+#endif
+
 int size, iters;
 
-uintptr_t start, length;
+CAPE_TLS uintptr_t start, length;
 
 const int MAX_RETRIES = 200;
 
@@ -33,12 +46,141 @@ char prog[255] = {0};
 
 #ifdef USE_TX
 // const int RUNS = 5000000;
-int txAttempts = 0;
-int txCommitted = 0;
+CAPE_TLS int txAttempts = 0;
+CAPE_TLS int txCommitted = 0;
 #else
 // const int RUNS = 5;
 #endif
 
+// the transaction site that starts next, set by capeProfileEnter
+// (llvm-dg-dump -profile-gen), -1 if the module is not instrumented
+CAPE_TLS int capeSite = -1;
+
+// Software emulation of the transactions (-DEMULATE_TX, with USE_TX) for
+// hosts without TSX. start/endTransaction do not run _xbegin/_xend, but
+// collect the cache lines that the preload functions touch inside a
+// transaction: code, data read and data written (the write-intent
+// preloads). The transaction body itself is not instrumented, the
+// preloads stand for what it accesses. When the outermost transaction
+// ends, its footprint is checked against a model of the cache:
+//  - the written lines must fit into the L1D (CAPE_EMU_SETS sets of
+//    CAPE_EMU_WAYS ways, indexed by the virtual address),
+//  - the read lines must fit into CAPE_EMU_READ_LINES lines.
+// A transaction that does not fit is reported as "would have aborted
+// (capacity)", counted as one capacity abort and a retry (also in the
+// profile, with CAPE_PROFILE), and then commits, because nothing can be
+// rolled back. The totals are printed at exit.
+#ifndef USE_TX
+#undef EMULATE_TX
+#endif
+
+#ifdef EMULATE_TX
+#include <unordered_set>
+
+#ifndef CAPE_EMU_SETS
+#define CAPE_EMU_SETS 64
+#endif
+#ifndef CAPE_EMU_WAYS
+#define CAPE_EMU_WAYS 8
+#endif
+#ifndef CAPE_EMU_READ_LINES
+#define CAPE_EMU_READ_LINES (1 << 15)
+#endif
+// how many of the would-be aborts are reported one by one
+#define CAPE_EMU_MAX_REPORTS 10
+
+enum capeEmuKind { capeEmuCode, capeEmuRead, capeEmuWrite };
+
+CAPE_TLS int capeEmuDepth = 0;
+CAPE_TLS bool capeEmuOverflow = false;
+CAPE_TLS unordered_set<uintptr_t> *capeEmuLines[3];
+CAPE_TLS unsigned capeEmuWays[CAPE_EMU_SETS];
+
+// totals over all threads
+unsigned long capeEmuTransactions = 0;
+unsigned long capeEmuAborts = 0;
+unsigned long capeEmuMaxLines[3] = {0, 0, 0};
+
+__attribute__((noinline)) void capeEmuTouch(uintptr_t addr, capeEmuKind kind) {
+    if (capeEmuDepth == 0)
+        return;
+    uintptr_t line = addr & (~lineOffMask);
+    if (!capeEmuLines[kind]->insert(line).second)
+        return;
+
+    if (kind == capeEmuWrite) {
+        // a line that is written leaves the read set
+        capeEmuLines[capeEmuRead]->erase(line);
+        if (++capeEmuWays[(line >> 6) % CAPE_EMU_SETS] > CAPE_EMU_WAYS)
+            capeEmuOverflow = true;
+    } else if (kind == capeEmuRead) {
+        if (capeEmuLines[capeEmuWrite]->count(line) > 0)
+            capeEmuLines[capeEmuRead]->erase(line);
+        else if (capeEmuLines[capeEmuRead]->size() > CAPE_EMU_READ_LINES)
+            capeEmuOverflow = true;
+    }
+}
+
+__attribute__((noinline)) void capeEmuBegin() {
+    if (capeEmuDepth++ > 0)
+        return;
+    for (int k = 0; k < 3; k++) {
+        if (!capeEmuLines[k])
+            capeEmuLines[k] = new unordered_set<uintptr_t>();
+        capeEmuLines[k]->clear();
+    }
+    memset(capeEmuWays, 0, sizeof(capeEmuWays));
+    capeEmuOverflow = false;
+}
+
+// End a (nested) transaction. Returns true if the outermost transaction
+// ended and would have aborted on capacity.
+__attribute__((noinline)) bool capeEmuEnd() {
+    if (--capeEmuDepth > 0)
+        return false;
+
+    __atomic_add_fetch(&capeEmuTransactions, 1, __ATOMIC_RELAXED);
+    for (int k = 0; k < 3; k++) {
+        unsigned long n = capeEmuLines[k]->size();
+        unsigned long max = __atomic_load_n(&capeEmuMaxLines[k], __ATOMIC_RELAXED);
+        while (n > max && !__atomic_compare_exchange_n(&capeEmuMaxLines[k], &max, n, false,
+                                                       __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            ;
+    }
+    if (!capeEmuOverflow)
+        return false;
+
+    if (__atomic_add_fetch(&capeEmuAborts, 1, __ATOMIC_RELAXED) <= CAPE_EMU_MAX_REPORTS)
+        fprintf(stderr, "would have aborted (capacity): site %d, %lu read, %lu written, %lu code lines\n",
+                capeSite, (unsigned long)capeEmuLines[capeEmuRead]->size(),
+                (unsigned long)capeEmuLines[capeEmuWrite]->size(),
+                (unsigned long)capeEmuLines[capeEmuCode]->size());
+    return true;
+}
+
+__attribute__((destructor)) void capeEmuReport() {
+    fprintf(stderr, "emulated transactions: %lu; would have aborted (capacity): %lu; "
+                    "largest footprint: %lu read, %lu written, %lu code lines\n",
+            capeEmuTransactions, capeEmuAborts, capeEmuMaxLines[capeEmuRead],
+            capeEmuMaxLines[capeEmuWrite], capeEmuMaxLines[capeEmuCode]);
+}
+
+#define CAPE_EMU_TOUCH(addr, kind) capeEmuTouch((uintptr_t)(addr), kind)
+#else
+#define CAPE_EMU_TOUCH(addr, kind)
+#endif
+
+#ifdef USE_TX
+// _xtest, or whether an emulated transaction runs
+__attribute__((always_inline)) inline bool capeInTransaction() {
+#ifdef EMULATE_TX
+    return capeEmuDepth > 0;
+#else
+    return _xtest();
+#endif
+}
+#endif
+
 #ifndef USE_TX
 __attribute__((noinline))
 #endif
@@ -52,6 +194,7 @@ preloadInstAddr() {
     volatile int sum;
     for (; addr < uend; addr += 64) {
         sum = *((int *)addr);
+        CAPE_EMU_TOUCH(addr, capeEmuCode);
         // addr++;
         // printf("touched addr: %p ", addr);
     }
@@ -91,6 +234,7 @@ preloadInstAddr(char *fname) {
     // }
     for (; addr < uend; addr += 64) {
         sum = *((int *)addr);
+        CAPE_EMU_TOUCH(addr, capeEmuCode);
         // if (f)
         //     printf("touched addr: %lu \n", addr);
     }
@@ -114,6 +258,7 @@ preloadInstAddr(uintptr_t start, uintptr_t length) {
     volatile int sum;
     for (; addr < uend; addr += 64) {
         sum = *((int *)addr);
+        CAPE_EMU_TOUCH(addr, capeEmuCode);
         // addr++;
         // printf("touched addr: %p ", addr);
     }
@@ -122,6 +267,40 @@ preloadInstAddr(uintptr_t start, uintptr_t length) {
 #endif
 }
 
+#ifndef USE_TX
+__attribute__((noinline))
+#endif
+void
+preloadBlockAddr(char *fname, void *bstart, void *bend) {
+#ifndef NO_PRELD
+    // preload only the code of one block of fname, i.e., [bstart, bend).
+    // bend is null for the last block of the function.
+    uintptr_t ustart = (uintptr_t)bstart;
+    uintptr_t uend = (uintptr_t)bend;
+    auto it = funcMap.find(fname);
+    if (it != funcMap.end()) {
+        uintptr_t fstart = it->second.first;
+        uintptr_t fend = fstart + it->second.second;
+        if (uend == 0)
+            uend = fend;
+        // the block was moved out of the function or the blocks
+        // were reordered by the backend: preload the whole function
+        if (ustart < fstart || uend > fend)
+            uend = 0;
+    }
+    if (uend <= ustart) {
+        preloadInstAddr(fname);
+        return;
+    }
+    uintptr_t addr = (uintptr_t)(ustart & (~lineOffMask));
+    volatile int sum;
+    for (; addr < uend; addr += 64) {
+        sum = *((int *)addr);
+        CAPE_EMU_TOUCH(addr, capeEmuCode);
+    }
+#endif
+}
+
 #ifndef USE_TX
 __attribute__((noinline))
 #endif
@@ -138,22 +317,348 @@ preloadInstAddrForCloak() {
         volatile int sum;
         for (; addr < uend; addr += 64) {
             sum = *((int *)addr);
+            CAPE_EMU_TOUCH(addr, capeEmuCode);
+        }
+    }
+#endif
+}
+
+// Switch for the warm-up that llvm-dg-dump -warmup adds before each
+// transaction site. CAPE_WARMUP is "all" (the default), "none",
+// or a comma-separated list of the site numbers to warm up.
+#ifndef USE_TX
+__attribute__((noinline))
+#endif
+bool
+capeWarmUpEnabled(int site) {
+    static bool parsed = false;
+    static bool all = true;
+    static set<int> sites;
+    if (!parsed) {
+        parsed = true;
+        const char *env = getenv("CAPE_WARMUP");
+        if (env && strcmp(env, "all") != 0) {
+            all = false;
+            for (const char *p = env; *p;) {
+                char *end;
+                long id = strtol(p, &end, 10);
+                if (end == p) {
+                    ++p;
+                    continue;
+                }
+                sites.insert((int)id);
+                p = end;
+            }
+        }
+    }
+    return all || sites.count(site) > 0;
+}
+
+// Per-site profile for llvm-dg-dump -profile-use. A program built with
+// -DCAPE_PROFILE from a module instrumented with -profile-gen counts, for
+// every transaction site, the attempts, commits, aborts by cause and the
+// cycles from the first xbegin to the commit. At exit, the counts are
+// added to the profile in CAPE_PROFILE (cape.profile by default), so
+// several runs accumulate in one file (the format is in Profile.h).
+#ifdef CAPE_PROFILE
+#define CAPE_PROFILE_VERSION 1
+
+struct capeSiteProfile {
+    unsigned long attempts = 0, commits = 0;
+    unsigned long conflict = 0, capacity = 0, explicitAborts = 0, other = 0;
+    unsigned long cycles = 0;
+};
+
+// never freed, capeWriteProfile runs after the static destructors
+map<int, capeSiteProfile> &capeProfile = *new map<int, capeSiteProfile>();
+capeSiteProfile *capeCurrentSite = &capeProfile[-1];
+unsigned long long capeSiteStart;
+
+void capeRecordAbort(capeSiteProfile *prof, unsigned status) {
+    if (status & _XABORT_CAPACITY)
+        prof->capacity++;
+    else if (status & _XABORT_CONFLICT)
+        prof->conflict++;
+    else if (status & _XABORT_EXPLICIT)
+        prof->explicitAborts++;
+    else
+        prof->other++;
+}
+
+__attribute__((destructor)) void capeWriteProfile() {
+    const char *file = getenv("CAPE_PROFILE");
+    if (!file)
+        file = "cape.profile";
+
+    map<int, capeSiteProfile> merged;
+    FILE *fp = fopen(file, "r");
+    if (fp) {
+        char line[256];
+        int version = 0;
+        if (!fgets(line, sizeof(line), fp) ||
+            sscanf(line, "cape-profile %d", &version) != 1 ||
+            version != CAPE_PROFILE_VERSION) {
+            fprintf(stderr, "%s is not a Cape profile of version %d, not writing it.\n",
+                    file, CAPE_PROFILE_VERSION);
+            fclose(fp);
+            return;
+        }
+        while (fgets(line, sizeof(line), fp)) {
+            int site;
+            capeSiteProfile p;
+            if (line[0] == '#' ||
+                sscanf(line, "%d %lu %lu %lu %lu %lu %lu %lu", &site, &p.attempts,
+                       &p.commits, &p.conflict, &p.capacity, &p.explicitAborts,
+                       &p.other, &p.cycles) != 8)
+                continue;
+            merged[site] = p;
         }
+        fclose(fp);
+    }
+
+    for (auto &it : capeProfile) {
+        if (it.first < 0 || it.second.attempts == 0)
+            continue;
+        capeSiteProfile &p = merged[it.first];
+        p.attempts += it.second.attempts;
+        p.commits += it.second.commits;
+        p.conflict += it.second.conflict;
+        p.capacity += it.second.capacity;
+        p.explicitAborts += it.second.explicitAborts;
+        p.other += it.second.other;
+        p.cycles += it.second.cycles;
+    }
+
+    fp = fopen(file, "w");
+    if (!fp) {
+        fprintf(stderr, "Cannot write the Cape profile to %s.\n", file);
+        return;
+    }
+    fprintf(fp, "cape-profile %d\n", CAPE_PROFILE_VERSION);
+    fprintf(fp, "# site attempts commits conflict capacity explicit other cycles\n");
+    for (auto &it : merged) {
+        const capeSiteProfile &p = it.second;
+        fprintf(fp, "%d %lu %lu %lu %lu %lu %lu %lu\n", it.first, p.attempts, p.commits,
+                p.conflict, p.capacity, p.explicitAborts, p.other, p.cycles);
     }
+    fclose(fp);
+}
+#endif
+
+// Tells the profile which transaction site starts next.
+#ifndef USE_TX
+__attribute__((noinline))
+#endif
+void
+capeProfileEnter(int site) {
+    capeSite = site;
+#ifdef CAPE_PROFILE
+    capeCurrentSite = &capeProfile[site];
 #endif
 }
 
+// Hardware counters (-DCAPE_PERF), opened with perf_event_open for the
+// calling thread (so they are per process, like CAPE_PROFILE, and not
+// meant for CAPE_THREADS). They count the region of interest and, if
+// CAPE_PERF_SITES is set, every transaction from the first attempt to
+// the commit, per site (the sites are known with -profile-gen). A site
+// costs two reads of every counter, outside of the transaction.
+// The RTM events are taken from the kernel's description of the PMU
+// (/sys/bus/event_source/devices/cpu/events), the events that cannot be
+// opened are reported as "n/a". printCycles prints the counts and
+// appends them to the CSV in CAPE_PERF_CSV:
+// bench,variant,size,scope,event,value (scope is "roi" or the site)
+#ifdef CAPE_PERF
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+struct capePerfEvent {
+    const char *name;
+    uint32_t type;
+    uint64_t config;
+    const char *sysfs; // the name of the event in sysfs, if any
+};
+
+const capePerfEvent capePerfEvents[] = {
+    {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, nullptr},
+    {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, nullptr},
+    {"l1d_misses", PERF_TYPE_HW_CACHE,
+     PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+         (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+     nullptr},
+    {"llc_misses", PERF_TYPE_HW_CACHE,
+     PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+         (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+     nullptr},
+    {"rtm_start", PERF_TYPE_RAW, 0, "tx-start"},
+    {"rtm_commit", PERF_TYPE_RAW, 0, "tx-commit"},
+    {"rtm_abort", PERF_TYPE_RAW, 0, "tx-abort"},
+    {"rtm_capacity", PERF_TYPE_RAW, 0, "tx-capacity"},
+    {"rtm_conflict", PERF_TYPE_RAW, 0, "tx-conflict"},
+};
+#define CAPE_PERF_EVENTS (sizeof(capePerfEvents) / sizeof(capePerfEvents[0]))
+
+struct capePerfCounts {
+    unsigned long long value[CAPE_PERF_EVENTS] = {};
+};
+
+int capePerfFd[CAPE_PERF_EVENTS];
+bool capePerfOpened = false;
+bool capePerfSites = false;
+capePerfCounts capePerfRoi;
+map<int, capePerfCounts> &capePerfSite = *new map<int, capePerfCounts>();
+capePerfCounts capePerfSiteStart;
+
+// Parse "event=0xc9,umask=0x1" from sysfs, false for other terms.
+bool capePerfSysfsConfig(const char *event, __u64 *config) {
+    char path[256], buf[256];
+    snprintf(path, sizeof(path), "/sys/bus/event_source/devices/cpu/events/%s", event);
+    FILE *fp = fopen(path, "r");
+    if (!fp)
+        return false;
+    bool ok = fgets(buf, sizeof(buf), fp) != nullptr;
+    fclose(fp);
+
+    *config = 0;
+    for (char *term = strtok(buf, ",\n"); ok && term; term = strtok(nullptr, ",\n")) {
+        unsigned long val;
+        if (sscanf(term, "event=%lx", &val) == 1)
+            *config |= val;
+        else if (sscanf(term, "umask=%lx", &val) == 1)
+            *config |= val << 8;
+        else
+            ok = false;
+    }
+    return ok;
+}
+
+void capePerfOpen() {
+    capePerfOpened = true;
+    capePerfSites = getenv("CAPE_PERF_SITES") != nullptr;
+    for (unsigned i = 0; i < CAPE_PERF_EVENTS; i++) {
+        const capePerfEvent &E = capePerfEvents[i];
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = E.type;
+        attr.config = E.config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        // the counters are multiplexed if there are not enough of them
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        capePerfFd[i] = -1;
+        if (!E.sysfs || capePerfSysfsConfig(E.sysfs, &attr.config))
+            capePerfFd[i] = (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+        if (capePerfFd[i] < 0)
+            fprintf(stderr, "perf: %s is not available.\n", E.name);
+    }
+}
+
+void capePerfRead(capePerfCounts *C) {
+    for (unsigned i = 0; i < CAPE_PERF_EVENTS; i++) {
+        uint64_t buf[3]; // value, time enabled, time running
+        if (capePerfFd[i] < 0 || read(capePerfFd[i], buf, sizeof(buf)) != sizeof(buf)) {
+            C->value[i] = 0;
+            continue;
+        }
+        C->value[i] = buf[2] == 0 ? 0 : (unsigned long long)(buf[0] * ((double)buf[1] / buf[2]));
+    }
+}
+
+void capePerfEnable(bool enable) {
+    for (unsigned i = 0; i < CAPE_PERF_EVENTS; i++) {
+        if (capePerfFd[i] < 0)
+            continue;
+        if (enable)
+            ioctl(capePerfFd[i], PERF_EVENT_IOC_RESET, 0);
+        ioctl(capePerfFd[i], enable ? PERF_EVENT_IOC_ENABLE : PERF_EVENT_IOC_DISABLE, 0);
+    }
+}
+
+__attribute__((noinline)) void capePerfSiteBegin() {
+    if (capePerfSites)
+        capePerfRead(&capePerfSiteStart);
+}
+
+__attribute__((noinline)) void capePerfSiteEnd() {
+    if (!capePerfSites)
+        return;
+    capePerfCounts now;
+    capePerfRead(&now);
+    capePerfCounts &C = capePerfSite[capeSite];
+    for (unsigned i = 0; i < CAPE_PERF_EVENTS; i++)
+        C.value[i] += now.value[i] - capePerfSiteStart.value[i];
+}
+
+void capePerfPrint(const char *scope, const capePerfCounts &C, FILE *csv,
+                   const char *bench, const char *variant) {
+    printf("perf %s:", scope);
+    for (unsigned i = 0; i < CAPE_PERF_EVENTS; i++) {
+        if (capePerfFd[i] < 0) {
+            printf(" %s n/a", capePerfEvents[i].name);
+            if (csv)
+                fprintf(csv, "%s,%s,%d,%s,%s,n/a\n", bench, variant, size, scope,
+                        capePerfEvents[i].name);
+            continue;
+        }
+        printf(" %s %llu", capePerfEvents[i].name, C.value[i]);
+        if (csv)
+            fprintf(csv, "%s,%s,%d,%s,%s,%llu\n", bench, variant, size, scope,
+                    capePerfEvents[i].name, C.value[i]);
+    }
+    printf("\n");
+}
+
+void capePerfReport() {
+    if (!capePerfOpened)
+        return;
+    const char *bench = getenv("CAPE_BENCH");
+    const char *variant = getenv("CAPE_VARIANT");
+    const char *file = getenv("CAPE_PERF_CSV");
+    FILE *csv = file ? fopen(file, "a") : nullptr;
+    if (file && !csv)
+        fprintf(stderr, "Cannot write to %s.\n", file);
+
+    capePerfPrint("roi", capePerfRoi, csv, bench ? bench : "-", variant ? variant : "-");
+    for (auto &it : capePerfSite) {
+        char scope[32];
+        snprintf(scope, sizeof(scope), "%d", it.first);
+        capePerfPrint(scope, it.second, csv, bench ? bench : "-", variant ? variant : "-");
+    }
+    if (csv)
+        fclose(csv);
+}
+#endif
+
 #define SLOWDOWN 512
 
 #ifdef USE_TX
 __attribute__((always_inline)) void startTransaction() {
 #ifndef NO_TX
     // printf("startTransaction\n");
+    txAttempts += 1;
+#ifdef CAPE_PROFILE
+    capeSiteStart = __rdtsc();
+    capeCurrentSite->attempts++;
+#endif
+#ifdef CAPE_PERF
+    capePerfSiteBegin();
+#endif
+#ifdef EMULATE_TX
+    capeEmuBegin();
+#else
     unsigned status;
     int retries = 0;
-    txAttempts += 1;
     while ((status = _xbegin()) != _XBEGIN_STARTED) {
         txAttempts++;
+#ifdef CAPE_PROFILE
+        capeRecordAbort(capeCurrentSite, status);
+        capeCurrentSite->attempts++;
+#endif
         if (retries++ >= MAX_RETRIES) {
             fprintf(stderr, "Terminate the program since transactions failed with status: %x.\n", status);
             exit(status);
@@ -166,13 +671,32 @@ __attribute__((always_inline)) void startTransaction() {
         // fprintf(stderr, "Retrying transacstion: %d...\n", retries);
     }
 #endif
+#endif
 }
 
 __attribute__((always_inline)) void endTransaction() {
 #ifndef NO_TX
-    if (_xtest()) {
+    if (capeInTransaction()) {
+#ifdef EMULATE_TX
+        if (capeEmuEnd()) {
+            // the attempt that would have aborted and its retry
+            txAttempts++;
+#ifdef CAPE_PROFILE
+            capeRecordAbort(capeCurrentSite, _XABORT_CAPACITY);
+            capeCurrentSite->attempts++;
+#endif
+        }
+#else
         _xend();
+#endif
         txCommitted += 1;
+#ifdef CAPE_PROFILE
+        capeCurrentSite->commits++;
+        capeCurrentSite->cycles += __rdtsc() - capeSiteStart;
+#endif
+#ifdef CAPE_PERF
+        capePerfSiteEnd();
+#endif
     }
 #endif
 }
@@ -195,8 +719,8 @@ struct mallocInst {
     void *array[20000];
 };
 
-std::map<int, allocInst> allocMap;
-std::map<int, mallocInst> mallocMap;
+CAPE_TLS std::map<int, allocInst> allocMap;
+CAPE_TLS std::map<int, mallocInst> mallocMap;
 
 // mallocInst mallocMap[10];
 
@@ -210,14 +734,238 @@ insertMallocSet(int idx, int size, void *pt) {
     // (E->array)[E->len++] = pt;
 }
 
+// A contiguous arena for the objects of one sensitive malloc site
+// (see llvm-dg-dump -heap-arena). Objects are served from fixed-size
+// slots, freed slots are reused. Objects that do not fit into a slot
+// or into the arena fall back to malloc and are kept in mallocMap.
+struct capeArena {
+    char *base = nullptr;
+    size_t used = 0;
+    size_t slot = 0;
+    vector<void *> freeSlots;
+};
+
+// address space reserved for one arena (backed lazily)
+const size_t ARENA_SIZE = 64 << 20;
+
+CAPE_TLS std::map<int, capeArena> arenaMap;
+
+#ifdef CAPE_HUGE_PAGES
+// Back the sensitive data by 2 MB pages, so that the preload set of a
+// transaction needs only a few TLB entries. hugetlbfs pages are used
+// when some are reserved (vm.nr_hugepages), otherwise transparent huge
+// pages are requested with madvise. If neither works, the data stays
+// on base pages.
+const size_t HUGE_PAGE_SIZE = 2 << 20;
+
+// map anonymous memory (at addr if not null) backed by huge pages if possible
+void *capeMapHuge(void *addr, size_t len) {
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS | (addr ? MAP_FIXED : 0);
+    // reserve the huge pages now (no MAP_NORESERVE),
+    // so that a shortage shows up here and not as SIGBUS later
+    void *mem = mmap(addr, len, PROT_READ | PROT_WRITE, flags | MAP_HUGETLB, -1, 0);
+    if (mem != MAP_FAILED)
+        return mem;
+
+    flags |= MAP_NORESERVE;
+
+    if (addr) {
+        mem = mmap(addr, len, PROT_READ | PROT_WRITE, flags, -1, 0);
+    } else {
+        // over-allocate so that the huge page aligned part has len bytes
+        mem = mmap(nullptr, len + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, flags, -1, 0);
+        if (mem != MAP_FAILED)
+            mem = (void *)(((uintptr_t)mem + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1));
+    }
+    if (mem == MAP_FAILED)
+        return nullptr;
+    if (madvise(mem, len, MADV_HUGEPAGE) != 0)
+        fprintf(stderr, "cannot use huge pages at %p, using base pages.\n", mem);
+    return mem;
+}
+
+// The sections are created by llvm-dg-dump -huge-pages
+// (aligned and padded to huge pages).
+extern "C" char __start_cape_data[] __attribute__((weak));
+extern "C" char __stop_cape_data[] __attribute__((weak));
+extern "C" char __start_cape_rodata[] __attribute__((weak));
+extern "C" char __stop_cape_rodata[] __attribute__((weak));
+
+// remap [start, stop) to huge pages keeping its content
+void capeRemapHuge(char *start, char *stop, bool readOnly) {
+    size_t len = stop - start;
+    if (!start || len == 0)
+        return;
+    if (((uintptr_t)start | len) & (HUGE_PAGE_SIZE - 1)) {
+        fprintf(stderr, "section at %p is not aligned to huge pages, using base pages.\n", start);
+        return;
+    }
+
+    char *copy = (char *)malloc(len);
+    if (!copy)
+        return;
+    memcpy(copy, start, len);
+    if (readOnly)
+        mprotect(start, len, PROT_READ | PROT_WRITE);
+    if (!capeMapHuge(start, len)) {
+        fprintf(stderr, "cannot remap section at %p.\n", start);
+        exit(-1);
+    }
+    memcpy(start, copy, len);
+    if (readOnly)
+        mprotect(start, len, PROT_READ);
+    free(copy);
+}
+
+__attribute__((constructor)) void capeRemapSectionsHuge() {
+    capeRemapHuge(__start_cape_data, __stop_cape_data, false);
+    capeRemapHuge(__start_cape_rodata, __stop_cape_rodata, true);
+}
+#endif
+
+#ifndef USE_TX
+__attribute__((noinline))
+#endif
+void *
+capeArenaMalloc(int idx, size_t size) {
+    capeArena *A = &arenaMap[idx];
+    if (!A->base) {
+#ifdef CAPE_HUGE_PAGES
+        void *mem = capeMapHuge(nullptr, ARENA_SIZE);
+#else
+        void *mem = mmap(nullptr, ARENA_SIZE, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (mem == MAP_FAILED)
+            mem = nullptr;
+#endif
+        A->base = (char *)mem;
+        // keep 16-byte alignment of malloc
+        A->slot = (size + 15) & ~((size_t)15);
+    }
+
+    if (A->base && size <= A->slot) {
+        if (!A->freeSlots.empty()) {
+            void *pt = A->freeSlots.back();
+            A->freeSlots.pop_back();
+            return pt;
+        }
+        if (A->used + A->slot <= ARENA_SIZE) {
+            void *pt = A->base + A->used;
+            A->used += A->slot;
+            return pt;
+        }
+    }
+
+    void *pt = malloc(size);
+    mallocInst *E = &mallocMap[idx];
+    if (pt && E->len < (int)(sizeof(E->array) / sizeof(E->array[0]))) {
+        E->size = size;
+        E->array[E->len++] = pt;
+    }
+    return pt;
+}
+
+#ifndef USE_TX
+__attribute__((noinline))
+#endif
+void
+capeArenaFree(void *pt) {
+    for (auto &e : arenaMap) {
+        capeArena *A = &e.second;
+        if (A->base && (char *)pt >= A->base && (char *)pt < A->base + A->used) {
+            A->freeSlots.push_back(pt);
+            return;
+        }
+    }
+
+    // an object that was not allocated from an arena
+    for (auto &e : mallocMap) {
+        mallocInst *E = &e.second;
+        for (int i = 0; i < E->len; ++i) {
+            if (E->array[i] == pt) {
+                E->array[i] = E->array[--E->len];
+                break;
+            }
+        }
+    }
+    free(pt);
+}
+
+// realloc() of an object that may come from an arena: an arena object
+// keeps its slot if the new size fits, otherwise it is moved (still
+// through capeArenaMalloc, so it stays preloaded).
+#ifndef USE_TX
+__attribute__((noinline))
+#endif
+void *
+capeArenaRealloc(void *pt, size_t size) {
+    if (pt && size == 0) {
+        capeArenaFree(pt);
+        return nullptr;
+    }
+
+    for (auto &e : arenaMap) {
+        capeArena *A = &e.second;
+        if (A->base && (char *)pt >= A->base && (char *)pt < A->base + A->used) {
+            if (size <= A->slot)
+                return pt;
+            void *npt = capeArenaMalloc(e.first, size);
+            if (!npt)
+                return nullptr;
+            memcpy(npt, pt, A->slot);
+            A->freeSlots.push_back(pt);
+            return npt;
+        }
+    }
+
+    void *npt = realloc(pt, size);
+    if (!npt || !pt)
+        return npt;
+    // an object that fell back to malloc, keep preloading it
+    for (auto &e : mallocMap) {
+        mallocInst *E = &e.second;
+        for (int i = 0; i < E->len; ++i) {
+            if (E->array[i] == pt) {
+                E->array[i] = npt;
+                if ((size_t)E->size < size)
+                    E->size = size;
+                break;
+            }
+        }
+    }
+    return npt;
+}
+
+#ifndef USE_TX
+__attribute__((noinline))
+#endif
+void *
+capeArenaReallocArray(void *pt, size_t num, size_t size) {
+    if (size != 0 && num > SIZE_MAX / size) {
+        errno = ENOMEM;
+        return nullptr;
+    }
+    return capeArenaRealloc(pt, num * size);
+}
+
 #ifndef USE_TX
 __attribute__((noinline))
 #endif
 void
 iterateMallocSet(int idx) {
 #ifndef NO_PRELD
-    auto *E = &mallocMap[idx];
     volatile int sum;
+    auto A = arenaMap.find(idx);
+    if (A != arenaMap.end() && A->second.base) {
+        uintptr_t ustart = (uintptr_t)A->second.base;
+        uintptr_t uend = ustart + A->second.used;
+        for (; ustart < uend; ustart += 64) {
+            sum = *(int *)(ustart);
+            CAPE_EMU_TOUCH(ustart, capeEmuRead);
+        }
+    }
+
+    auto *E = &mallocMap[idx];
     auto array = E->array;
     int l = E->len;
     for (int i = 0; i < l; ++i) {
@@ -226,6 +974,7 @@ iterateMallocSet(int idx) {
         uintptr_t uend = (uintptr_t)(ptr) + E->size;
         for (; ustart < uend; ustart += 64) {
             sum = *(int *)(ustart);
+            CAPE_EMU_TOUCH(ustart, capeEmuRead);
             //printf("loading allocMap[%d] at addr: %d\t", idx, ustart);
         }
         //printf("\n");
@@ -254,6 +1003,7 @@ iterateGlobal(int size, void *pt) {
     uintptr_t uend = (uintptr_t)((int *)pt) + size;
     for (; ustart < uend; ustart += 64) {
         sum = *(int *)(ustart);
+        CAPE_EMU_TOUCH(ustart, capeEmuRead);
         // printf("loading allocMap[%d] at addr: %d\t", idx, ustart);
     }
     // printf("\n");
@@ -298,6 +1048,7 @@ iterateAllocStack(int idx) {
         uintptr_t uend = (uintptr_t)(*i) + E->size;
         for (; ustart < uend; ustart += 64) {
             sum = *(int *)(ustart);
+            CAPE_EMU_TOUCH(ustart, capeEmuRead);
             // printf("loading allocMap[%d] at addr: %d\t", idx, ustart);
         }
         // printf("\n");
@@ -320,6 +1071,87 @@ popAllocStack(int idx) {
     // printf("\n");
 }
 
+// Write-intent variants of the preload functions, used for the objects
+// that the transaction writes to (llvm-dg-dump -write-intent). Inside a
+// transaction, every line is written with its own value, which puts the
+// line into the write set in the Modified state. Outside of a hardware
+// transaction (e.g., in the warm-up or in an emulated one), a store could
+// overwrite a concurrent update, so the line is only prefetched for
+// writing.
+__attribute__((always_inline)) inline void
+preloadRangeForWrite(uintptr_t ustart, uintptr_t uend) {
+    // start at the object itself, not before it
+    for (uintptr_t addr = ustart; addr < uend; addr = (addr & (~lineOffMask)) + 64) {
+#ifdef USE_TX
+#ifdef EMULATE_TX
+        // an emulated transaction is not atomic, the store could lose an
+        // update of another thread
+        if (capeInTransaction()) {
+            __builtin_prefetch((void *)addr, 1, 3);
+            CAPE_EMU_TOUCH(addr, capeEmuWrite);
+            continue;
+        }
+#else
+        if (_xtest()) {
+            volatile char *p = (volatile char *)addr;
+            *p = *p;
+            continue;
+        }
+#endif
+#endif
+        __builtin_prefetch((void *)addr, 1, 3);
+    }
+}
+
+#ifndef USE_TX
+__attribute__((noinline))
+#endif
+void
+iterateMallocSetW(int idx) {
+#ifndef NO_PRELD
+    auto A = arenaMap.find(idx);
+    if (A != arenaMap.end() && A->second.base) {
+        uintptr_t ustart = (uintptr_t)A->second.base;
+        preloadRangeForWrite(ustart, ustart + A->second.used);
+    }
+
+    auto *E = &mallocMap[idx];
+    for (int i = 0; i < E->len; ++i) {
+        uintptr_t ustart = (uintptr_t)E->array[i];
+        preloadRangeForWrite(ustart, ustart + E->size);
+    }
+#endif
+}
+
+#ifndef USE_TX
+__attribute__((noinline))
+#endif
+void
+iterateGlobalW(int size, void *pt) {
+#ifndef NO_PRELD
+    preloadRangeForWrite((uintptr_t)pt, (uintptr_t)pt + size);
+#endif
+}
+
+#ifndef USE_TX
+__attribute__((noinline))
+#endif
+void
+iterateAllocStackW(int idx) {
+#ifndef NO_PRELD
+    allocInst *E = &allocMap[idx];
+    for (auto i = E->stack.begin(); i != E->stack.end(); ++i) {
+        preloadRangeForWrite((uintptr_t)(*i), (uintptr_t)(*i) + E->size);
+    }
+#endif
+}
+
+// The region of interest. Both functions return the seconds of a steady
+// clock, so that end - begin is the ROI time that printCycles reports,
+// and count the cycles of the ROI with the TSC.
+unsigned long long capeRoiStart = 0;
+unsigned long long capeRoiCycles = 0;
+
 #ifndef USE_TX
 __attribute__((noinline))
 #else
@@ -328,10 +1160,13 @@ __attribute__((always_inline))
 double
 __parsec_roi_begin() {
     asm("");
-    return 0;
-    // auto current_time = high_resolution_clock::now();
-    // auto duration_in_seconds = std::chrono::duration<double>(current_time.time_since_epoch());
-    // return duration_in_seconds.count();
+#ifdef CAPE_PERF
+    if (!capePerfOpened)
+        capePerfOpen();
+    capePerfEnable(true);
+#endif
+    capeRoiStart = __rdtsc();
+    return duration<double>(steady_clock::now().time_since_epoch()).count();
 }
 
 #ifndef USE_TX
@@ -342,10 +1177,75 @@ __attribute__((always_inline))
 double
 __parsec_roi_end() {
     asm("");
-    return 0;
-    // auto current_time = high_resolution_clock::now();
-    // auto duration_in_seconds = std::chrono::duration<double>(current_time.time_since_epoch());
-    // return duration_in_seconds.count();
+    capeRoiCycles = __rdtsc() - capeRoiStart;
+#ifdef CAPE_PERF
+    capePerfRead(&capePerfRoi);
+    capePerfEnable(false);
+#endif
+    return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+// Cycles of every iteration of the ROI loop (capeIterBegin/capeIterEnd
+// around its body), for the latency percentiles in the CSV.
+#define CAPE_MAX_LATENCIES (1 << 20)
+unsigned long long capeLatencies[CAPE_MAX_LATENCIES];
+unsigned long capeNumLatencies = 0;
+unsigned long long capeIterStart;
+
+#ifndef USE_TX
+__attribute__((noinline))
+#else
+__attribute__((always_inline))
+#endif
+void
+capeIterBegin() {
+    capeIterStart = __rdtsc();
+}
+
+#ifndef USE_TX
+__attribute__((noinline))
+#else
+__attribute__((always_inline))
+#endif
+void
+capeIterEnd() {
+    if (capeNumLatencies < CAPE_MAX_LATENCIES)
+        capeLatencies[capeNumLatencies++] = __rdtsc() - capeIterStart;
+}
+
+unsigned long long capeLatencyPercentile(unsigned pct) {
+    if (capeNumLatencies == 0)
+        return 0;
+    // nearest rank, capeLatencies are sorted
+    unsigned long rank = (pct * capeNumLatencies + 99) / 100;
+    return capeLatencies[rank == 0 ? 0 : rank - 1];
+}
+
+// Append one row to the CSV file in CAPE_CSV (see samples/bench.sh):
+// bench,variant,size,iters,seconds,cycles,iters_per_s,
+// p50_cycles,p90_cycles,p99_cycles,tx_attempts,tx_commits,attempts_per_commit
+// CAPE_BENCH and CAPE_VARIANT name the program and how it was built.
+void capeWriteCsv(const char *csvFile, double time) {
+    long attempts = 0, commits = 0;
+#ifdef USE_TX
+    attempts = txAttempts;
+    commits = txCommitted;
+#endif
+    const char *bench = getenv("CAPE_BENCH");
+    const char *variant = getenv("CAPE_VARIANT");
+    sort(capeLatencies, capeLatencies + capeNumLatencies);
+
+    FILE *fp = fopen(csvFile, "a");
+    if (!fp) {
+        fprintf(stderr, "Cannot write to %s.\n", csvFile);
+        return;
+    }
+    fprintf(fp, "%s,%s,%d,%d,%f,%llu,%f,%llu,%llu,%llu,%ld,%ld,%f\n",
+            bench ? bench : "-", variant ? variant : "-", size, iters, time,
+            capeRoiCycles, time > 0 ? iters / time : 0.0,
+            capeLatencyPercentile(50), capeLatencyPercentile(90), capeLatencyPercentile(99),
+            attempts, commits, commits ? attempts * 1.0 / commits : 0.0);
+    fclose(fp);
 }
 
 void printCycles(double time, char *dstFile) {
@@ -362,6 +1262,11 @@ void printCycles(double time, char *dstFile) {
     printf("txAttempts: %d; txCommitted: %d; ratio: %f\n", txAttempts, txCommitted, r);
 #else
     printf("It took me %f seconds.\n", time);
+#endif
+    if (const char *csv = getenv("CAPE_CSV"))
+        capeWriteCsv(csv, time);
+#ifdef CAPE_PERF
+    capePerfReport();
 #endif
 }
 
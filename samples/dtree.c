@@ -13,7 +13,7 @@ typedef uint16_t *LeafIds;
 
 // void lookup_leafids(Nodes& nodes, Queries& queries, LeafIds& leafids) {
 //for (auto size_t i = 0; i < = queries.entries(); i++) {
-__attribute__((noinline)) void lookup_leafids(Nodes nodes, LeafIds leafids) {
+__attribute__((noinline)) __attribute__((annotate("cloak"))) void lookup_leafids(Nodes nodes, LeafIds leafids) {
     size_t node = 0;
     size_t left, right;
     //if (sec > 43)
@@ -82,8 +82,10 @@ int main(int argc, char *argv[]) {
     auto start_t = __parsec_roi_begin();
 
     for (int i = 0; i < iters; i++) {
+        capeIterBegin();
         sec = secs[i % numSecs];
         lookup_leafids(nodes, leafids);
+        capeIterEnd();
     }
     auto end_t = __parsec_roi_end();
     auto time_span = end_t - start_t;
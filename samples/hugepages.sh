@@ -0,0 +1,55 @@
+#!/bin/bash
+
+# Compare Cape with the sensitive data on base pages and on huge pages.
+# Usage: ./hugepages.sh [runs] benchmark...   (e.g., ./hugepages.sh 10 aes dtree)
+# For every benchmark and variant, prints the average time and the average
+# ratio of transaction attempts to commits (1.0 means no aborts).
+# Huge pages come from hugetlbfs if some are reserved
+# (echo 64 > /proc/sys/vm/nr_hugepages), otherwise from transparent
+# huge pages (madvise mode is enough).
+
+RUNS=5
+if [[ "$1" =~ ^[0-9]+$ ]]; then
+        RUNS=$1
+        shift
+fi
+
+for b in "$@"
+do
+        for v in base huge
+        do
+                if [ $v == "huge" ]; then
+                        FLAGS="-heap-arena -huge-pages"
+                        DEFS="-DCAPE_HUGE_PAGES"
+                else
+                        FLAGS="-heap-arena -pack-globals"
+                        DEFS=""
+                fi
+
+                # the runtime in common.h is compiled into the bitcode
+                CMD="clang++-6.0 -emit-llvm -c $b.c -mrtm -O3 -DUSE_TX $DEFS -fno-use-cxa-atexit -o $b\_$v.bc";
+                echo $CMD;
+                eval $CMD;
+
+                CMD="../build/tools/llvm-dg-dump $FLAGS $b\_$v.bc > $b\_ac\_$v.err 2>&1";
+                echo $CMD;
+                eval $CMD;
+
+                CMD="clang++-6.0 $b\_$v.bc_ac.ll -O3 -o $b\_cape\_$v";
+                echo $CMD;
+                eval $CMD;
+
+                rm -f $b\_$v.txt
+                START=$(date +%s.%N)
+                for ((i = 0; i < RUNS; i++))
+                do
+                        ./$b\_cape\_$v infile.txt $b\_$v.txt > /dev/null
+                done
+                END=$(date +%s.%N)
+
+                # printCycles appends "<roi time> <attempts/commits> "
+                awk -v b=$b -v v=$v -v wall=$(echo "$END - $START" | bc) -v runs=$RUNS \
+                    '{ for (i = 2; i <= NF; i += 2) { r += $i; n++ } }
+                     END { printf "%s %s: wall %.4f s/run, tx attempts/commits %.4f\n", b, v, wall / runs, n ? r / n : 0 }' $b\_$v.txt
+        done
+done
@@ -13,7 +13,7 @@ struct nelem_t {
 
 typedef struct nelem_t *node_p;
 
-__attribute__((noinline)) void lookup_leafids(node_p root, int *leaf) {
+__attribute__((noinline)) __attribute__((annotate("cloak"))) void lookup_leafids(node_p root, int *leaf) {
     node_p cur = root;
     // SENSITIVE: the whole loop is sensitive since its exit is dependent on the sercet 'sec'.
     while (cur != NULL) {
@@ -67,9 +67,11 @@ int main(int argc, char *argv[]) {
     auto start_t = __parsec_roi_begin();
 
     for (int i = 0; i < iters; i++) {
+        capeIterBegin();
         sec = secs[i % numSecs];
         lookup_leafids(root, &leafids);
         //printf("%d\n", leafids);
+        capeIterEnd();
     }
 
     auto end_t = __parsec_roi_end();
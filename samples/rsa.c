@@ -10,7 +10,7 @@
 #include <unistd.h>
 
 volatile size_t x = 3;
-__attribute__((annotate("secret"))) volatile size_t k;
+__attribute__((annotate("secret"))) CAPE_TLS volatile size_t k;
 
 extern "C" __attribute__((noinline)) size_t square(size_t res, size_t x) {
     for (register size_t j = 0; j < SLOWDOWN; ++j)
@@ -28,7 +28,7 @@ extern "C" __attribute__((noinline)) size_t multiply(size_t res, size_t x) {
     return res;
 }
 
-size_t exp() {
+__attribute__((noinline)) __attribute__((annotate("cloak"))) size_t exp() {
     unsigned status = 0;
     size_t res = 1;
     for (ssize_t i = 63; i >= 0; --i) {
@@ -40,6 +40,29 @@ size_t exp() {
     return res;
 }
 
+#ifdef CAPE_THREADS
+#include "threads.h"
+
+void rsaInit(int tid) {
+    capeThreadSecs = new int[numSecs];
+    capeGenerateThreadSecrets(tid, numSecs, capeThreadSecs, 2 * size);
+}
+
+void rsaKernel(int tid, int i) {
+    k = (size_t)capeThreadSecs[i % numSecs];
+    volatile size_t res = exp();
+}
+
+// rsa infile.txt out.csv: run exp on up to CAPE_MAX_THREADS threads
+int main(int argc, char **argv) {
+    FILE *fp = fopen(argv[1], "r");
+
+    loadInput(fp);
+
+    capeRunThreads("rsa", capeMaxThreads(), iters, rsaInit, rsaKernel, argv[2]);
+    return 0;
+}
+#else
 int main(int argc, char **argv) {
     FILE *fp = fopen(argv[1], "r");
 
@@ -54,8 +77,10 @@ int main(int argc, char **argv) {
     auto start_t = __parsec_roi_begin();
 
     for (int i = 0; i < iters; i++) {
+        capeIterBegin();
         k = (size_t)secs[i % numSecs];
         volatile size_t res = exp();
+        capeIterEnd();
     }
 
     auto end_t = __parsec_roi_end();
@@ -65,3 +90,4 @@ int main(int argc, char **argv) {
     printCycles(time, argv[2]);
     return 0;
 }
+#endif
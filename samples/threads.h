@@ -0,0 +1,152 @@
+//
+// Multi-threaded driver for the Cape-protected kernels (aes.c and rsa.c
+// built with -DCAPE_THREADS). Every thread has its own secrets and work
+// queue, and its own runtime state (CAPE_TLS in common.h). The kernel is
+// run on 1, 2, 4, ... up to the given number of threads, so that the
+// throughput and the abort rates can be plotted against the number of
+// threads. CAPE_PROFILE is per process, do not combine it with threads.
+//
+
+#ifndef DG_THREADS_H
+#define DG_THREADS_H
+
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include "common.h"
+
+// the work queue of a thread: the secrets it processes, in order
+CAPE_TLS int *capeThreadSecs;
+
+struct capeThreadResult {
+    double seconds = 0;
+    long attempts = 0;
+    long commits = 0;
+};
+
+// all threads start the measured loop together
+struct capeBarrier {
+    pthread_barrier_t barrier;
+    capeBarrier(unsigned n) { pthread_barrier_init(&barrier, nullptr, n); }
+    ~capeBarrier() { pthread_barrier_destroy(&barrier); }
+    void wait() { pthread_barrier_wait(&barrier); }
+};
+
+// Thread-safe generateSecrets: each thread gets its own sequence.
+void capeGenerateThreadSecrets(int tid, int n, int *secs, int range) {
+    unsigned seed = (unsigned)time(NULL) ^ (unsigned)(tid * 2654435761u);
+    for (int i = 0; i < n; i++) {
+        secs[i] = rand_r(&seed) % range;
+    }
+}
+
+void capePinThread(int tid) {
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (ncpus <= 0)
+        return;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(tid % ncpus, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+struct capeThreadArgs {
+    int tid;
+    int iters;
+    void (*init)(int);
+    void (*kernel)(int, int);
+    capeBarrier *barrier;
+    capeThreadResult *result;
+};
+
+// pthreads (not std::thread), so that llvm-dg-dump -threads sees the
+// kernel called from the thread
+void *capeThreadMain(void *arg) {
+    capeThreadArgs *a = (capeThreadArgs *)arg;
+    capePinThread(a->tid);
+    a->init(a->tid);
+    a->barrier->wait();
+
+    auto start_t = steady_clock::now();
+    for (int i = 0; i < a->iters; i++)
+        a->kernel(a->tid, i);
+    auto end_t = steady_clock::now();
+
+    a->result->seconds = duration<double>(end_t - start_t).count();
+#ifdef USE_TX
+    a->result->attempts = txAttempts;
+    a->result->commits = txCommitted;
+#endif
+    return nullptr;
+}
+
+// Run init(tid) and then iters times kernel(tid, i) on each of nthreads
+// threads, return what every thread measured.
+vector<capeThreadResult> capeRunOnThreads(int nthreads, int iters,
+                                          void (*init)(int), void (*kernel)(int, int)) {
+    vector<capeThreadResult> results(nthreads);
+    vector<capeThreadArgs> args(nthreads);
+    vector<pthread_t> threads(nthreads);
+    capeBarrier barrier(nthreads);
+
+    for (int tid = 0; tid < nthreads; tid++) {
+        args[tid] = {tid, iters, init, kernel, &barrier, &results[tid]};
+        if (pthread_create(&threads[tid], nullptr, capeThreadMain, &args[tid]) != 0) {
+            fprintf(stderr, "Cannot create thread %d.\n", tid);
+            exit(-1);
+        }
+    }
+    for (int tid = 0; tid < nthreads; tid++)
+        pthread_join(threads[tid], nullptr);
+
+    return results;
+}
+
+// Run the kernel on 1, 2, 4, ... maxThreads threads. For every number of
+// threads, print the total throughput and append to csvFile one row per
+// thread and one "all" row:
+// bench,threads,thread,iters,seconds,iters_per_s,tx_attempts,tx_commits,abort_rate
+void capeRunThreads(const char *bench, int maxThreads, int iters,
+                    void (*init)(int), void (*kernel)(int, int), const char *csvFile) {
+    FILE *fp = fopen(csvFile, "a");
+    if (!fp) {
+        fprintf(stderr, "Cannot write to %s.\n", csvFile);
+        return;
+    }
+
+    for (int n = 1;; n = min(n * 2, maxThreads)) {
+        auto results = capeRunOnThreads(n, iters, init, kernel);
+
+        double slowest = 0;
+        long attempts = 0, commits = 0;
+        for (int tid = 0; tid < n; tid++) {
+            const capeThreadResult &r = results[tid];
+            fprintf(fp, "%s,%d,%d,%d,%f,%f,%ld,%ld,%f\n", bench, n, tid, iters, r.seconds,
+                    r.seconds > 0 ? iters / r.seconds : 0.0, r.attempts, r.commits,
+                    r.attempts ? (r.attempts - r.commits) * 1.0 / r.attempts : 0.0);
+            slowest = max(slowest, r.seconds);
+            attempts += r.attempts;
+            commits += r.commits;
+        }
+
+        double throughput = slowest > 0 ? (double)iters * n / slowest : 0.0;
+        double abortRate = attempts ? (attempts - commits) * 1.0 / attempts : 0.0;
+        fprintf(fp, "%s,%d,all,%d,%f,%f,%ld,%ld,%f\n", bench, n, iters, slowest,
+                throughput, attempts, commits, abortRate);
+        printf("%s: %d threads: %f iterations/s, abort rate %f\n", bench, n, throughput, abortRate);
+        if (n == maxThreads)
+            break;
+    }
+
+    fclose(fp);
+}
+
+// The number of threads from CAPE_MAX_THREADS, all cores by default.
+int capeMaxThreads() {
+    if (const char *env = getenv("CAPE_MAX_THREADS"))
+        return max(1, atoi(env));
+    return max(1L, sysconf(_SC_NPROCESSORS_ONLN));
+}
+
+#endif // DG_THREADS_H
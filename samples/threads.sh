@@ -0,0 +1,49 @@
+#!/bin/bash
+
+# Run the thread benchmarks built by the "benchmark-threads" CMake target
+# (<benchmark>_mt_baseline and <benchmark>_mt_cape in the current
+# directory) and collect their scaling curves in one CSV
+# (see capeRunThreads in threads.h).
+# Usage: ./threads.sh [-t max threads] [-i iters] [-o out.csv] benchmark...
+#        (e.g., ./threads.sh -t 16 -o threads.csv aes rsa)
+# -t 0 (the default) runs up to the number of cores.
+
+THREADS=0
+ITERS=10000
+OUT=threads.csv
+INFILE=$(dirname $0)/infile.txt
+
+while getopts "t:i:o:" opt
+do
+        case $opt in
+        t) THREADS=$OPTARG ;;
+        i) ITERS=$OPTARG ;;
+        o) OUT=$OPTARG ;;
+        *) exit 1 ;;
+        esac
+done
+shift $((OPTIND - 1))
+
+if [ ! -f $OUT ]; then
+        echo "bench,variant,threads,thread,iters,seconds,iters_per_s,tx_attempts,tx_commits,abort_rate" > $OUT
+fi
+
+if [ $THREADS != 0 ]; then
+        export CAPE_MAX_THREADS=$THREADS
+fi
+
+read -r SIZE _ CODE_START CODE_LENGTH < $INFILE
+echo "$SIZE $ITERS $CODE_START $CODE_LENGTH" > threads\_in.txt
+
+for b in "$@"
+do
+        for v in baseline cape
+        do
+                rm -f $b\_mt\_$v.csv
+                CMD="./$b\_mt\_$v threads_in.txt $b\_mt\_$v.csv";
+                echo $CMD;
+                eval $CMD || echo "$b $v failed" >&2;
+                # add the variant after the benchmark name
+                sed "s/^$b,/$b,$v,/" $b\_mt\_$v.csv >> $OUT
+        done
+done
@@ -0,0 +1,41 @@
+; The secrets besides the secret globals (findSecretAnnotations).
+;
+; @main has a local %k annotated "secret" (llvm.var.annotation) and a
+; struct %s whose second field is annotated (llvm.ptr.annotation), and
+; @f has a parameter with the "secret" attribute. The local and the
+; parameter are secret as a whole. The field pointer is not a memory
+; object, so only the bytes 4 to 8 of %s become secret, not its first
+; field.
+
+%struct.Key = type { i32, i32 }
+
+@.str = private unnamed_addr constant [7 x i8] c"secret\00", section "llvm.metadata"
+@.file = private unnamed_addr constant [4 x i8] c"a.c\00", section "llvm.metadata"
+
+declare void @llvm.var.annotation(i8*, i8*, i8*, i32)
+declare i8* @llvm.ptr.annotation.p0i8(i8*, i8*, i8*, i32)
+
+define i32 @f(i32 "secret" %p) {
+entry:
+  %r = mul i32 %p, 3
+  ret i32 %r
+}
+
+define i32 @main() {
+entry:
+  %k = alloca i32
+  %k8 = bitcast i32* %k to i8*
+  call void @llvm.var.annotation(i8* %k8, i8* getelementptr ([7 x i8], [7 x i8]* @.str, i32 0, i32 0), i8* getelementptr ([4 x i8], [4 x i8]* @.file, i32 0, i32 0), i32 3)
+  store i32 42, i32* %k
+  %s = alloca %struct.Key
+  %field = getelementptr %struct.Key, %struct.Key* %s, i32 0, i32 1
+  %field8 = bitcast i32* %field to i8*
+  %a = call i8* @llvm.ptr.annotation.p0i8(i8* %field8, i8* getelementptr ([7 x i8], [7 x i8]* @.str, i32 0, i32 0), i8* getelementptr ([4 x i8], [4 x i8]* @.file, i32 0, i32 0), i32 5)
+  %secret = bitcast i8* %a to i32*
+  store i32 7, i32* %secret
+  %pub = getelementptr %struct.Key, %struct.Key* %s, i32 0, i32 0
+  store i32 1, i32* %pub
+  %v = load i32, i32* %k
+  %r = call i32 @f(i32 %v)
+  ret i32 %r
+}
@@ -0,0 +1,43 @@
+; The code that a transaction preloads block by block (-bb-preload).
+;
+; The branch on the secret @key starts a transaction in the entry block
+; of @main that ends in %join. The region is entry, %then, %else and
+; %join: the block addresses of every one of them are preloaded once.
+; The entry block starts at @main, and %join is the last block, so its
+; end is left to the bounds of the function. @ext, called in the
+; region, is preloaded as a whole.
+
+@key = global i32 5 #0
+@T = global [256 x i32] zeroinitializer
+@U = global [256 x i32] zeroinitializer
+
+define i32 @ext(i32 %x) {
+entry:
+  %y = add i32 %x, 1
+  ret i32 %y
+}
+
+define i32 @main() {
+entry:
+  %k = load i32, i32* @key
+  %c = icmp sgt i32 %k, 3
+  br i1 %c, label %then, label %else
+
+then:
+  %i = and i32 %k, 255
+  %p = getelementptr [256 x i32], [256 x i32]* @T, i32 0, i32 %i
+  %v = load i32, i32* %p
+  %w = call i32 @ext(i32 %v)
+  %q = getelementptr [256 x i32], [256 x i32]* @U, i32 0, i32 %i
+  store i32 %w, i32* %q
+  br label %join
+
+else:
+  br label %join
+
+join:
+  %r = phi i32 [ %v, %then ], [ 0, %else ]
+  ret i32 %r
+}
+
+attributes #0 = { "secret" }
@@ -0,0 +1,43 @@
+; The bytes of a table that an access may reach (-bound-preloads).
+;
+; @masked indexes @T by s & 0xff (the first 256 elements), @guarded by
+; an i checked by i < 16 before, @unbounded by any i (the whole table).
+
+@T = global [1024 x i32] zeroinitializer
+
+define i32 @masked(i32 %s) {
+entry:
+  %m = and i32 %s, 255
+  %idx = zext i32 %m to i64
+  %p = getelementptr [1024 x i32], [1024 x i32]* @T, i64 0, i64 %idx
+  %v = load i32, i32* %p
+  ret i32 %v
+}
+
+define i32 @guarded(i32 %i) {
+entry:
+  %c = icmp slt i32 %i, 16
+  br i1 %c, label %then, label %else
+
+then:
+  %idx = sext i32 %i to i64
+  %p = getelementptr [1024 x i32], [1024 x i32]* @T, i64 0, i64 %idx
+  %v = load i32, i32* %p
+  ret i32 %v
+
+else:
+  ret i32 0
+}
+
+define i32 @unbounded(i64 %i) {
+entry:
+  %p = getelementptr [1024 x i32], [1024 x i32]* @T, i64 0, i64 %i
+  %v = load i32, i32* %p
+  ret i32 %v
+}
+
+define i32 @constant() {
+entry:
+  %v = load i32, i32* getelementptr ([1024 x i32], [1024 x i32]* @T, i64 0, i64 10)
+  ret i32 %v
+}
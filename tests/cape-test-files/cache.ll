@@ -0,0 +1,56 @@
+; A program for the analysis cache (-cache).
+;
+; @main calls @f, which calls @h, @g, @k and @u. @g stores to @S, which
+; @k loads. The test pretends that the graph marked nodes of @f. As long
+; as no function changes, the graph is needed only for @f, its callee @h
+; and its caller @main. A change of @g rebuilds @g, its caller @main and
+; @k, which shares @S with it; @u stays reused.
+
+@T = global [16 x i32] zeroinitializer
+@S = global i32 0
+@U = global i32 0
+
+define i32 @h(i32 %x) {
+entry:
+  %i = and i32 %x, 15
+  %p = getelementptr [16 x i32], [16 x i32]* @T, i32 0, i32 %i
+  %v = load i32, i32* %p
+  ret i32 %v
+}
+
+define i32 @f(i32 %x) {
+entry:
+  %v = call i32 @h(i32 %x)
+  ret i32 %v
+}
+
+define i32 @g(i32 %x) {
+entry:
+  %y = mul i32 %x, 3
+  store i32 %y, i32* @S
+  ret i32 %y
+}
+
+define i32 @k() {
+entry:
+  %v = load i32, i32* @S
+  ret i32 %v
+}
+
+define i32 @u(i32 %x) {
+entry:
+  store i32 %x, i32* @U
+  ret i32 %x
+}
+
+define i32 @main() {
+entry:
+  %a = call i32 @f(i32 1)
+  %b = call i32 @g(i32 2)
+  %c = call i32 @k()
+  %d = call i32 @u(i32 4)
+  %r = add i32 %a, %b
+  %s = add i32 %r, %c
+  %t = add i32 %s, %d
+  ret i32 %t
+}
@@ -0,0 +1,53 @@
+; The secret scope of a struct with one secret field (-secret-scope).
+;
+; @init annotates the second field of @K as secret. @useSecret indexes
+; @T by that field, @usePub by the first one. Only the accesses of the
+; secret bytes start the slice, so @usePub is not in the scope even
+; though it reads @K (and @T).
+
+%struct.Key = type { i32, i32 }
+
+@K = global %struct.Key zeroinitializer
+@T = global [256 x i32] zeroinitializer
+@Out = global i32 0
+@Out2 = global i32 0
+@.str = private unnamed_addr constant [7 x i8] c"secret\00", section "llvm.metadata"
+@.file = private unnamed_addr constant [4 x i8] c"a.c\00", section "llvm.metadata"
+
+declare i8* @llvm.ptr.annotation.p0i8(i8*, i8*, i8*, i32)
+
+define void @init() {
+entry:
+  %a = call i8* @llvm.ptr.annotation.p0i8(i8* bitcast (i32* getelementptr (%struct.Key, %struct.Key* @K, i32 0, i32 1) to i8*), i8* getelementptr ([7 x i8], [7 x i8]* @.str, i32 0, i32 0), i8* getelementptr ([4 x i8], [4 x i8]* @.file, i32 0, i32 0), i32 5)
+  %p = bitcast i8* %a to i32*
+  store i32 7, i32* %p
+  ret void
+}
+
+define void @useSecret() {
+entry:
+  %k = load i32, i32* getelementptr (%struct.Key, %struct.Key* @K, i32 0, i32 1)
+  %i = and i32 %k, 255
+  %p = getelementptr [256 x i32], [256 x i32]* @T, i32 0, i32 %i
+  %v = load i32, i32* %p
+  store i32 %v, i32* @Out
+  ret void
+}
+
+define void @usePub() {
+entry:
+  %k = load i32, i32* getelementptr (%struct.Key, %struct.Key* @K, i32 0, i32 0)
+  %i = and i32 %k, 255
+  %p = getelementptr [256 x i32], [256 x i32]* @T, i32 0, i32 %i
+  %v = load i32, i32* %p
+  store i32 %v, i32* @Out2
+  ret void
+}
+
+define i32 @main() {
+entry:
+  call void @init()
+  call void @useSecret()
+  call void @usePub()
+  ret i32 0
+}
@@ -0,0 +1,29 @@
+; The frees of a module with an arena buffer (-heap-arena).
+;
+; @f frees its sensitive object through a table of allocator functions
+; in @A. @B holds the address of free, too. The arena runtime
+; (capeArenaFree) is the only code that keeps calling free.
+
+%struct.Alloc = type { void (i8*)* }
+
+@A = global %struct.Alloc { void (i8*)* @free }
+@B = global i8* bitcast (void (i8*)* @free to i8*)
+
+declare i8* @malloc(i64)
+declare void @free(i8*)
+declare void @_Z15insertMallocSetiiPv(i32, i32, i8*)
+
+define void @_Z13capeArenaFreePv(i8* %p) {
+entry:
+  call void @free(i8* %p)
+  ret void
+}
+
+define void @f() {
+entry:
+  %m = call i8* @malloc(i64 64)
+  call void @_Z15insertMallocSetiiPv(i32 1, i32 64, i8* %m)
+  %fp = load void (i8*)*, void (i8*)** getelementptr (%struct.Alloc, %struct.Alloc* @A, i32 0, i32 0)
+  call void %fp(i8* %m)
+  ret void
+}
@@ -0,0 +1,53 @@
+; Hoisting out of a transaction that ends in the block where it starts.
+;
+; In @f, hoistOutOfTransactions() moves %idx above xbegin and %out below
+; xend, keeps %k and %m (secret) and %p (the transaction writes memory)
+; inside, and leaves %later in %exit, which is after the transaction.
+;
+; In @g, the store after xbegin in the first block makes the transaction
+; write memory, so %p stays in %body.
+
+@key = global i32 0 #0
+@pub = global i32 0
+
+declare void @_Z16startTransactionv()
+declare void @_Z14endTransactionv()
+
+define i32 @f(i32 %a, i32 %b) {
+entry:
+  %pre = add i32 %a, 2
+  call void @_Z16startTransactionv()
+  %idx = add i32 %a, 1
+  %k = load i32, i32* @key
+  %m = xor i32 %k, %idx
+  %p = load i32, i32* @pub
+  store i32 %pre, i32* @pub
+  %out = mul i32 %p, %b
+  call void @_Z14endTransactionv()
+  br label %exit
+
+exit:
+  %later = mul i32 %b, 5
+  %r = add i32 %m, %out
+  %s = add i32 %r, %later
+  ret i32 %s
+}
+
+define i32 @g(i32 %a) {
+entry:
+  call void @_Z16startTransactionv()
+  store i32 %a, i32* @pub
+  br label %body
+
+body:
+  %p = load i32, i32* @pub
+  %k = load i32, i32* @key
+  %x = add i32 %p, %k
+  br label %end
+
+end:
+  call void @_Z14endTransactionv()
+  ret i32 %x
+}
+
+attributes #0 = { "secret" }
@@ -0,0 +1,27 @@
+; The second unit of the program of link-main.ll.
+;
+; Its @.str and @.str.1 are renamed when linked after link-main.ll, but
+; the written unit must have them (and so its text) as here, whatever
+; the other units contain.
+
+source_filename = "link-lib.c"
+
+@.str = private unnamed_addr constant [4 x i8] c"lib\00"
+@.str.1 = private unnamed_addr constant [4 x i8] c"get\00"
+@count = internal global i32 0
+
+define internal i32 @get() {
+entry:
+  %c = load i32, i32* @count
+  ret i32 %c
+}
+
+define i32 @lib(i8* %s) {
+entry:
+  %c = call i32 @get()
+  %a = load i8, i8* getelementptr ([4 x i8], [4 x i8]* @.str, i32 0, i32 0)
+  %b = load i8, i8* getelementptr ([4 x i8], [4 x i8]* @.str.1, i32 0, i32 0)
+  %x = zext i8 %a to i32
+  %r = add i32 %c, %x
+  ret i32 %r
+}
@@ -0,0 +1,18 @@
+; The unit with the entry of a program linked by linkUnits() (-link).
+;
+; Both units have a private @.str, so the linker renames the one of
+; link-lib.ll. The test adds a call of the internal @get of link-lib.ll
+; to @main, like an instrumentation that preloads a callee, so @get is
+; promoted to cape.link_lib_c.get, by the source file of link-lib.ll.
+
+source_filename = "link-main.c"
+
+@.str = private unnamed_addr constant [5 x i8] c"main\00"
+
+declare i32 @lib(i8*)
+
+define i32 @main() {
+entry:
+  %r = call i32 @lib(i8* getelementptr ([5 x i8], [5 x i8]* @.str, i32 0, i32 0))
+  ret i32 %r
+}
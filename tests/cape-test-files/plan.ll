@@ -0,0 +1,44 @@
+; A function for the round trip of an instrumentation plan (-plan and
+; -apply-plan).
+;
+; The test makes a plan with every kind of action, including a preload
+; of only bytes 16 to 1040 of @T (-bound-preloads), writes it, reads it
+; back for a fresh copy of the module and applies both. The two results
+; must be the same IR. @g has a PHI, which no action may be put before.
+
+@T = global [1024 x i32] zeroinitializer
+
+declare i8* @malloc(i64)
+declare void @free(i8*)
+
+define i32 @f(i32 %s) {
+entry:
+  %buf = alloca [16 x i32]
+  %m = call i8* @malloc(i64 64)
+  br label %body
+
+body:
+  %i = and i32 %s, 255
+  %j = add i32 %i, 4
+  %p = getelementptr [1024 x i32], [1024 x i32]* @T, i32 0, i32 %j
+  %v = load i32, i32* %p
+  br label %exit
+
+exit:
+  call void @free(i8* %m)
+  ret i32 %v
+}
+
+define i32 @g(i32 %n) {
+entry:
+  br label %loop
+
+loop:
+  %x = phi i32 [ 0, %entry ], [ %y, %loop ]
+  %y = add i32 %x, 1
+  %c = icmp slt i32 %y, %n
+  br i1 %c, label %loop, label %done
+
+done:
+  ret i32 %y
+}
@@ -0,0 +1,60 @@
+; Splitting a site that aborts on capacity (-profile-use).
+;
+; Site 0 in @f preloads @T1 and @T2 (1 KB each), reads @T1 before %mid
+; and @T2 from %mid on. applyProfile() splits it at %mid, and each part
+; preloads only its table, so neither needs more than 1 KB.
+;
+; Site 1 in @g reads @T1 before %mid and calls through a pointer after
+; it, which may access anything, so the second part keeps both preloads
+; while the first one drops @T2.
+
+@T1 = global [256 x i32] zeroinitializer
+@T2 = global [256 x i32] zeroinitializer
+
+declare void @_Z16startTransactionv()
+declare void @_Z14endTransactionv()
+declare void @_Z13iterateGlobaliPv(i32, i8*)
+
+define i32 @f(i32 %a, i32 %b) {
+entry:
+  call void @_Z16startTransactionv()
+  call void @_Z13iterateGlobaliPv(i32 1024, i8* bitcast ([256 x i32]* @T1 to i8*))
+  call void @_Z13iterateGlobaliPv(i32 1024, i8* bitcast ([256 x i32]* @T2 to i8*))
+  br label %first
+
+first:
+  %pa = getelementptr [256 x i32], [256 x i32]* @T1, i32 0, i32 %a
+  %x = load i32, i32* %pa
+  br label %mid
+
+mid:
+  %pb = getelementptr [256 x i32], [256 x i32]* @T2, i32 0, i32 %b
+  %y = load i32, i32* %pb
+  br label %end
+
+end:
+  call void @_Z14endTransactionv()
+  %r = add i32 %x, %y
+  ret i32 %r
+}
+
+define i32 @g(i32 %a, void ()* %fp) {
+entry:
+  call void @_Z16startTransactionv()
+  call void @_Z13iterateGlobaliPv(i32 1024, i8* bitcast ([256 x i32]* @T1 to i8*))
+  call void @_Z13iterateGlobaliPv(i32 1024, i8* bitcast ([256 x i32]* @T2 to i8*))
+  br label %first
+
+first:
+  %pa = getelementptr [256 x i32], [256 x i32]* @T1, i32 0, i32 %a
+  %x = load i32, i32* %pa
+  br label %mid
+
+mid:
+  call void %fp()
+  br label %end
+
+end:
+  call void @_Z14endTransactionv()
+  ret i32 %x
+}
@@ -0,0 +1,692 @@
+#include "catch.hpp"
+
+// ignore unused parameters in LLVM libraries
+#if (__clang__)
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wunused-parameter"
+#else
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+#endif
+
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/IRReader/IRReader.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/SourceMgr.h>
+#include <llvm/Support/raw_ostream.h>
+
+#if (__clang__)
+#pragma clang diagnostic pop // ignore -Wunused-parameter
+#else
+#pragma GCC diagnostic pop
+#endif
+
+#include <fstream>
+#include <functional>
+#include <map>
+#include <memory>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "dg/llvm/Cape/AnalysisCache.h"
+#include "dg/llvm/Cape/CapeOptions.h"
+#include "dg/llvm/Cape/HeapArena.h"
+#include "dg/llvm/Cape/Hoisting.h"
+#include "dg/llvm/Cape/Plan.h"
+#include "dg/llvm/Cape/PreloadBounds.h"
+#include "dg/llvm/Cape/Profile.h"
+#include "dg/llvm/Cape/SecretAnnotations.h"
+#include "dg/llvm/Cape/SecretScope.h"
+#include "dg/llvm/Cape/Sites.h"
+#include "dg/llvm/Cape/WholeProgram.h"
+#include "dg/llvm/LLVMDependenceGraphBuilder.h"
+#include "dg/llvm/LLVMSlicer.h"
+#include "dg/llvm/PointerAnalysis/PointerAnalysis.h"
+
+using namespace dg::llvmdg;
+using namespace llvm;
+
+// the IR files are in cape-test-files, each describes what is expected
+static std::unique_ptr<Module> loadModule(LLVMContext &ctx, const char *name) {
+    SMDiagnostic err;
+    auto M = parseIRFile(std::string(CAPE_TEST_FILES) + "/" + name, err, ctx);
+    if (!M)
+        err.print("cape-test", errs());
+    REQUIRE(M);
+    return M;
+}
+
+static Instruction *getInst(Module &M, const char *func, const char *name) {
+    Function *F = M.getFunction(func);
+    REQUIRE(F);
+    for (inst_iterator I = inst_begin(F), E = inst_end(F); I != E; ++I) {
+        if (I->getName() == name)
+            return &*I;
+    }
+    FAIL("no instruction %" << name << " in " << func);
+    return nullptr;
+}
+
+static CallInst *getCall(Module &M, const char *func, const char *callee) {
+    Function *F = M.getFunction(func);
+    REQUIRE(F);
+    for (inst_iterator I = inst_begin(F), E = inst_end(F); I != E; ++I) {
+        auto *CI = dyn_cast<CallInst>(&*I);
+        if (CI && CI->getCalledFunction() && CI->getCalledFunction()->getName() == callee)
+            return CI;
+    }
+    FAIL("no call of " << callee << " in " << func);
+    return nullptr;
+}
+
+// a precedes b in the same block
+static bool precedes(const Instruction *a, const Instruction *b) {
+    if (a->getParent() != b->getParent())
+        return false;
+    for (const Instruction *I = a->getNextNode(); I; I = I->getNextNode()) {
+        if (I == b)
+            return true;
+    }
+    return false;
+}
+
+TEST_CASE("Hoisting out of a transaction in one block", "[cape][hoisting]") {
+    LLVMContext ctx;
+    auto M = loadModule(ctx, "hoist-same-block.ll");
+    hoistOutOfTransactions(*M, [](const Instruction *) { return false; });
+
+    SECTION("straight-line transaction") {
+        auto *xbegin = getCall(*M, "f", "_Z16startTransactionv");
+        auto *xend = getCall(*M, "f", "_Z14endTransactionv");
+        auto inside = [&](const char *name) {
+            Instruction *I = getInst(*M, "f", name);
+            return precedes(xbegin, I) && precedes(I, xend);
+        };
+
+        REQUIRE(precedes(getInst(*M, "f", "idx"), xbegin));
+        REQUIRE(precedes(xend, getInst(*M, "f", "out")));
+        REQUIRE(inside("k"));
+        REQUIRE(inside("m"));
+        REQUIRE(inside("p"));
+        REQUIRE(getInst(*M, "f", "later")->getParent()->getName() == "exit");
+    }
+
+    SECTION("stores in the block of xbegin") {
+        REQUIRE(getInst(*M, "g", "p")->getParent()->getName() == "body");
+    }
+}
+
+// the globals preloaded right after xbegin and their size in bytes
+static uint64_t getPreloadedGlobals(const CallInst *xbegin, std::set<std::string> &globals) {
+    uint64_t bytes = 0;
+    for (const Instruction *I = xbegin->getNextNode(); I && isPreloadCall(I);
+         I = I->getNextNode()) {
+        auto *CI = cast<CallInst>(I);
+        auto *size = dyn_cast<ConstantInt>(CI->getArgOperand(0));
+        REQUIRE(size);
+        bytes += size->getZExtValue();
+        globals.insert(CI->getArgOperand(1)->stripPointerCasts()->getName().str());
+    }
+    return bytes;
+}
+
+TEST_CASE("Splitting a site by the profile", "[cape][profile]") {
+    LLVMContext ctx;
+    auto M = loadModule(ctx, "split-site.ll");
+
+    // half of the attempts abort on capacity
+    SiteProfile P;
+    P.attempts = 100;
+    P.commits = 50;
+    P.capacity = 50;
+    P.cycles = 50000;
+    Profile profile{{0, P}, {1, P}};
+    dg::CapeOptions opts;
+    applyProfile(*M, profile, opts);
+
+    // the new sites are in the functions of the split ones
+    auto sites = getTransactionSites(*M);
+    REQUIRE(sites.size() == 4);
+    std::set<std::string> globals;
+
+    SECTION("each part preloads its table") {
+        REQUIRE(sites[0]->getFunction()->getName() == "f");
+        REQUIRE(sites[2]->getFunction()->getName() == "f");
+        REQUIRE(getPreloadedGlobals(sites[0], globals) == 1024);
+        REQUIRE(globals == std::set<std::string>{"T1"});
+        globals.clear();
+        REQUIRE(getPreloadedGlobals(sites[2], globals) == 1024);
+        REQUIRE(globals == std::set<std::string>{"T2"});
+    }
+
+    SECTION("an indirect call keeps all preloads") {
+        REQUIRE(sites[1]->getFunction()->getName() == "g");
+        REQUIRE(sites[3]->getFunction()->getName() == "g");
+        REQUIRE(getPreloadedGlobals(sites[1], globals) == 1024);
+        REQUIRE(globals == std::set<std::string>{"T1"});
+        globals.clear();
+        REQUIRE(getPreloadedGlobals(sites[3], globals) == 2048);
+        REQUIRE(globals == std::set<std::string>{"T1", "T2"});
+    }
+}
+
+static std::string readFile(const std::string &file) {
+    std::ifstream ifs(file);
+    REQUIRE(ifs);
+    std::stringstream ss;
+    ss << ifs.rdbuf();
+    return ss.str();
+}
+
+static std::string getString(Module &M, const char *global) {
+    GlobalVariable *GV = M.getNamedGlobal(global);
+    REQUIRE(GV);
+    REQUIRE(GV->hasPrivateLinkage());
+    return cast<ConstantDataSequential>(GV->getInitializer())->getAsCString().str();
+}
+
+TEST_CASE("Writing the units of a linked program", "[cape][link]") {
+    // the units are written next to the files, so work on copies
+    SmallString<128> dir;
+    REQUIRE(!sys::fs::createUniqueDirectory("cape-test", dir));
+    std::string mainFile = (dir + "/link-main.ll").str();
+    std::string libFile = (dir + "/link-lib.ll").str();
+    REQUIRE(!sys::fs::copy_file(std::string(CAPE_TEST_FILES) + "/link-main.ll", mainFile));
+    REQUIRE(!sys::fs::copy_file(std::string(CAPE_TEST_FILES) + "/link-lib.ll", libFile));
+
+    // link the units, call @get of the other unit from @main and write
+    auto run = [&](const std::string &lib) {
+        LLVMContext ctx;
+        auto M = linkUnits(ctx, {mainFile, lib});
+        REQUIRE(M);
+        Function *get = M->getFunction("get");
+        REQUIRE(get);
+        IRBuilder<> B(M->getFunction("main")->getEntryBlock().getTerminator());
+        B.CreateCall(get);
+
+        unsigned written;
+        REQUIRE(writeUnits(*M, "main", &written));
+        return written;
+    };
+
+    REQUIRE(run(libFile) == 2);
+    std::string libText = readFile(libFile + "_ac.ll");
+    // the name of the source file, not the path on the command line
+    std::string promoted = "cape.link_lib_c.get";
+
+    SECTION("the units keep their names") {
+        LLVMContext ctx;
+        SMDiagnostic err;
+        auto lib = parseIRFile(libFile + "_ac.ll", err, ctx);
+        REQUIRE(lib);
+        REQUIRE(getString(*lib, ".str") == "lib");
+        REQUIRE(getString(*lib, ".str.1") == "get");
+        REQUIRE(lib->getNamedGlobal("count")->hasInternalLinkage());
+
+        Function *get = lib->getFunction(promoted);
+        REQUIRE(get);
+        REQUIRE(!get->isDeclaration());
+        REQUIRE(get->hasHiddenVisibility());
+
+        auto main = parseIRFile(mainFile + "_ac.ll", err, ctx);
+        REQUIRE(main);
+        REQUIRE(getString(*main, ".str") == "main");
+        REQUIRE(main->getFunction(promoted));
+        REQUIRE(main->getFunction(promoted)->isDeclaration());
+    }
+
+    SECTION("only the edited unit is written again") {
+        // a new string shifts the names that the linker gives to the
+        // strings of link-lib.ll
+        {
+            std::ofstream ofs(mainFile, std::ios::app);
+            ofs << "@.str.1 = private unnamed_addr constant [5 x i8] c\"more\\00\"\n";
+        }
+        REQUIRE(run(libFile) == 1);
+        REQUIRE(readFile(libFile + "_ac.ll") == libText);
+    }
+
+    SECTION("the units do not depend on the paths of the files") {
+        REQUIRE(run((dir + "/./link-lib.ll").str()) == 0);
+    }
+
+    for (const std::string &file : {mainFile, libFile}) {
+        sys::fs::remove(file);
+        sys::fs::remove(file + "_ac.ll");
+    }
+    sys::fs::remove(dir);
+}
+
+// Analyze cache.ll changed by edit with the cache in file, returns the
+// names of the functions that get the graph.
+static std::set<std::string> getCacheScope(const std::string &file,
+                                           const std::function<void(Module &)> &edit,
+                                           unsigned &hits, unsigned &misses) {
+    LLVMContext ctx;
+    auto M = loadModule(ctx, "cache.ll");
+    edit(*M);
+    dg::DGLLVMPointerAnalysis PTA(M.get());
+    PTA.run();
+
+    AnalysisCache cache;
+    REQUIRE(cache.load(file, "key"));
+    std::set<std::string> names;
+    for (const Function *F : cache.getScope(&PTA, M->getFunction("main")))
+        names.insert(F->getName().str());
+    hits = cache.getHits();
+    misses = cache.getMisses();
+    REQUIRE(cache.save(file));
+    return names;
+}
+
+TEST_CASE("Reusing the analysis cache", "[cape][cache]") {
+    SmallString<128> file;
+    REQUIRE(!sys::fs::createTemporaryFile("cape-test", "cache", file));
+    // the first run has no cache
+    sys::fs::remove(file);
+    std::string path(file.begin(), file.end());
+
+    unsigned hits, misses;
+    auto all = std::set<std::string>{"main", "f", "g", "h", "k", "u"};
+    REQUIRE(getCacheScope(path, [](Module &) {}, hits, misses) == all);
+    REQUIRE(hits == 0);
+    REQUIRE(misses == 6);
+
+    // the graph marked 3 nodes of @f (update() writes what it marked)
+    std::string text = readFile(path);
+    size_t pos = text.find(" 0 f\n");
+    REQUIRE(pos != std::string::npos);
+    text.replace(pos, 5, " 3 f\n");
+    {
+        std::ofstream ofs(path);
+        ofs << text;
+    }
+
+    SECTION("nothing changed") {
+        auto scope = getCacheScope(path, [](Module &) {}, hits, misses);
+        REQUIRE(scope == std::set<std::string>{"main", "f", "h"});
+        REQUIRE(hits == 6);
+        REQUIRE(misses == 0);
+    }
+
+    SECTION("only names changed") {
+        auto rename = [](Module &M) { getInst(M, "g", "y")->setName("z"); };
+        auto scope = getCacheScope(path, rename, hits, misses);
+        REQUIRE(scope == std::set<std::string>{"main", "f", "h"});
+        REQUIRE(hits == 6);
+    }
+
+    SECTION("a function changed") {
+        auto edit = [](Module &M) {
+            auto *ret = cast<ReturnInst>(M.getFunction("g")->getEntryBlock().getTerminator());
+            IRBuilder<> B(ret);
+            ret->setOperand(0, B.CreateAdd(ret->getOperand(0), B.getInt32(1)));
+        };
+        // @g with its caller and @k, which loads what @g stores, and
+        // the marked @f with @h; only @u is reused without the graph
+        auto scope = getCacheScope(path, edit, hits, misses);
+        REQUIRE(scope == std::set<std::string>{"main", "f", "g", "h", "k"});
+        REQUIRE(hits == 3);
+        REQUIRE(misses == 3);
+
+        // the marked nodes of the rebuilt functions are unknown until
+        // update(), the hits keep theirs
+        REQUIRE(getCacheScope(path, edit, hits, misses) == std::set<std::string>{"main", "f", "h"});
+        REQUIRE(hits == 6);
+    }
+
+    SECTION("a callee changed") {
+        auto edit = [](Module &M) {
+            getInst(M, "h", "i")->setOperand(1, ConstantInt::get(Type::getInt32Ty(M.getContext()), 7));
+        };
+        // @h with its callers, nothing else uses @T
+        auto scope = getCacheScope(path, edit, hits, misses);
+        REQUIRE(scope == std::set<std::string>{"main", "f", "h"});
+        REQUIRE(hits == 3);
+        REQUIRE(misses == 3);
+    }
+
+    sys::fs::remove(path);
+}
+
+// A plan with every kind of action for plan.ll.
+static InstrumentationPlan makePlan(Module &M) {
+    Instruction *m = getInst(M, "f", "m");
+    Instruction *i = getInst(M, "f", "i");
+    Instruction *exit = getInst(M, "f", "v")->getNextNode();
+    BasicBlock *body = i->getParent();
+
+    InstrumentationPlan plan;
+    plan.addPushAlloc(m, 1, getInst(M, "f", "buf"));
+    plan.addInsertMalloc(m->getNextNode(), 2, m);
+    plan.addTransactionStart(i);
+    plan.addPreloadCode(i, "f");
+    plan.addPreloadBlock(i, "f", body);
+    plan.addPreloadAlloc(i, 1, false);
+    plan.addPreloadMalloc(i, 2, true);
+    plan.addPreloadGlobal(i, M.getNamedGlobal("T"), false, 16, 1024);
+    plan.addPreloadGlobal(i, M.getNamedGlobal("T"), true);
+    plan.addTransactionEnd(exit);
+    plan.addEraseMalloc(getCall(M, "f", "free"), 2);
+    plan.addPopAlloc(getCall(M, "f", "free")->getNextNode(), 1);
+    return plan;
+}
+
+static std::string printModule(const Module &M) {
+    std::string text;
+    raw_string_ostream out(text);
+    M.print(out, nullptr);
+    return out.str();
+}
+
+TEST_CASE("Writing and reading an instrumentation plan", "[cape][plan]") {
+    SmallString<128> file;
+    REQUIRE(!sys::fs::createTemporaryFile("cape-test", "json", file));
+    std::string path(file.begin(), file.end());
+
+    LLVMContext ctx;
+    auto M = loadModule(ctx, "plan.ll");
+    InstrumentationPlan plan = makePlan(*M);
+    REQUIRE(writePlan(path, plan));
+    std::string json = readFile(path);
+
+    auto copy = loadModule(ctx, "plan.ll");
+    InstrumentationPlan read;
+    REQUIRE(readPlan(*copy, path, read));
+    REQUIRE(read.size() == plan.size());
+
+    SECTION("the plan is the same") {
+        std::string text;
+        raw_string_ostream out(text);
+        writePlanJSON(out, read);
+        REQUIRE(out.str() == json);
+
+        const PlanAction &bounded = read.getActions()[7];
+        REQUIRE(bounded.kind == PlanAction::Kind::PreloadGlobal);
+        REQUIRE(bounded.offset == 16);
+        REQUIRE(bounded.length == 1024);
+        REQUIRE(read.getActions()[8].length == 0);
+    }
+
+    SECTION("applying it gives the same IR") {
+        REQUIRE(applyPlan(plan) == 1);
+        REQUIRE(applyPlan(read) == 1);
+        REQUIRE(printModule(*copy) == printModule(*M));
+
+        // the bounded preload
+        auto *CI = getCall(*copy, "f", "_Z13iterateGlobaliPv");
+        REQUIRE(cast<ConstantInt>(CI->getArgOperand(0))->getZExtValue() == 1024);
+    }
+
+    SECTION("a malformed plan is rejected") {
+        {
+            std::ofstream ofs(path);
+            ofs << json.substr(0, json.size() / 2);
+        }
+        InstrumentationPlan broken;
+        REQUIRE(!readPlan(*copy, path, broken));
+    }
+
+    SECTION("actions that do not fit the module are rejected") {
+        // write the plan for M and read it for the copy
+        auto reads = [&](const InstrumentationPlan &bad) {
+            REQUIRE(writePlan(path, bad));
+            InstrumentationPlan result;
+            return readPlan(*copy, path, result);
+        };
+        Instruction *i = getInst(*M, "f", "i");
+        InstrumentationPlan ok;
+        ok.addPreloadGlobal(i, M->getNamedGlobal("T"), false, 4000, 96);
+        ok.addEraseMalloc(getCall(*M, "f", "free"), 2);
+        REQUIRE(reads(ok));
+
+        InstrumentationPlan phi;
+        phi.addTransactionStart(getInst(*M, "g", "x"));
+        REQUIRE(!reads(phi));
+
+        InstrumentationPlan erase;
+        erase.addEraseMalloc(i, 2);
+        REQUIRE(!reads(erase));
+
+        InstrumentationPlan pop;
+        pop.addPopAlloc(getCall(*M, "f", "free"), 1);
+        REQUIRE(!reads(pop));
+
+        InstrumentationPlan outside;
+        outside.addPreloadGlobal(i, M->getNamedGlobal("T"), false, 4000, 97);
+        REQUIRE(!reads(outside));
+
+        InstrumentationPlan object;
+        object.addInsertMalloc(getInst(*M, "g", "y"), 2, getInst(*M, "f", "m"));
+        REQUIRE(!reads(object));
+
+        // the buffer ids are 32-bit
+        REQUIRE(writePlan(path, erase));
+        std::string text = readFile(path);
+        size_t pos = text.find("\"buffer\": 2");
+        REQUIRE(pos != std::string::npos);
+        text.replace(pos, 11, "\"buffer\": 4294967298");
+        {
+            std::ofstream ofs(path);
+            ofs << text;
+        }
+        InstrumentationPlan result;
+        REQUIRE(!readPlan(*copy, path, result));
+    }
+
+    sys::fs::remove(path);
+}
+
+TEST_CASE("Secret locals, parameters and fields", "[cape][secrets]") {
+    LLVMContext ctx;
+    auto M = loadModule(ctx, "annotations.ll");
+    auto secrets = findSecretAnnotations(*M);
+
+    Argument *param = &*M->getFunction("f")->arg_begin();
+    Instruction *local = getInst(*M, "main", "k");
+    Instruction *field = getInst(*M, "main", "a");
+    Instruction *object = getInst(*M, "main", "s");
+    REQUIRE(std::set<Value *>(secrets.begin(), secrets.end()) ==
+            std::set<Value *>{param, local, field});
+
+    SECTION("the local and the parameter are secret") {
+        REQUIRE(isSecret(local));
+        REQUIRE(isSecret(param));
+        REQUIRE(mayHoldSecret(local, 0, 4));
+    }
+
+    SECTION("only the bytes of the field are secret") {
+        // neither the field pointer nor the object are secret as a whole
+        REQUIRE(!isSecret(field));
+        REQUIRE(!isSecret(object));
+        REQUIRE(!mayHoldSecret(object, 4, 4));
+
+        dg::DGLLVMPointerAnalysis PTA(M.get());
+        PTA.run();
+        REQUIRE(addSecretFieldBytes(*M, &PTA, secrets) == 1);
+        REQUIRE(mayHoldSecret(object, 4, 4));
+        REQUIRE(mayHoldSecret(object, 0, 8));
+        REQUIRE(mayHoldSecret(object, dg::Offset::UNKNOWN, 4));
+        REQUIRE(!mayHoldSecret(object, 0, 4));
+    }
+}
+
+TEST_CASE("Only the secret bytes of a struct start the slice", "[cape][secrets]") {
+    LLVMContext ctx;
+    auto M = loadModule(ctx, "field-scope.ll");
+    dg::DGLLVMPointerAnalysis PTA(M.get());
+    PTA.run();
+
+    std::set<std::string> names;
+    for (const Function *F : getSecretScope(*M, &PTA, M->getFunction("main")))
+        names.insert(F->getName().str());
+    REQUIRE(names == std::set<std::string>{"main", "init", "useSecret"});
+
+    // the secret bytes are the second field of @K
+    GlobalVariable *K = M->getNamedGlobal("K");
+    REQUIRE(mayHoldSecret(K, 4, 4));
+    REQUIRE(!mayHoldSecret(K, 0, 4));
+}
+
+TEST_CASE("Bounding the bytes that an access reaches", "[cape][bounds]") {
+    LLVMContext ctx;
+    auto M = loadModule(ctx, "bounds.ll");
+    PreloadBounds bounds(*M);
+    REQUIRE(bounds.hasRelations());
+    GlobalVariable *T = M->getNamedGlobal("T");
+
+    // the bytes of the load %v in func, with the offset unknown to PTA
+    auto getBytes = [&](const char *func) {
+        auto *LI = cast<LoadInst>(getInst(*M, func, "v"));
+        return bounds.getAccessedBytes(LI, LI->getPointerOperand(),
+                                       dg::Offset::UNKNOWN, T, 4);
+    };
+    using Range = std::pair<uint64_t, uint64_t>;
+
+    SECTION("by the known bits of the index") {
+        REQUIRE(getBytes("masked") == Range(0, 256 * 4));
+    }
+
+    SECTION("by the relations at the access") {
+        REQUIRE(getBytes("guarded") == Range(0, 16 * 4));
+    }
+
+    SECTION("not at all") {
+        REQUIRE(getBytes("unbounded") == Range(0, 1024 * 4));
+    }
+
+    SECTION("by the offset of the pointer") {
+        auto *LI = cast<LoadInst>(getInst(*M, "constant", "v"));
+        REQUIRE(bounds.getAccessedBytes(LI, LI->getPointerOperand(), 40, T, 4) == Range(40, 44));
+        REQUIRE(bounds.getAccessedBytes(LI, LI->getPointerOperand(), dg::Offset::UNKNOWN, T, 4) ==
+                Range(40, 44));
+        // an access that is not smaller than the object
+        REQUIRE(bounds.getAccessedBytes(LI, LI->getPointerOperand(), 40, T, 0) == Range(0, 1024 * 4));
+    }
+}
+
+TEST_CASE("Redirecting the frees to the arena runtime", "[cape][arena]") {
+    LLVMContext ctx;
+    auto M = loadModule(ctx, "heap-arena.ll");
+    REQUIRE(redirectSensitiveMallocs(*M) == 1);
+    REQUIRE(!verifyModule(*M, &errs()));
+
+    Function *arenaFree = M->getFunction("_Z13capeArenaFreePv");
+    REQUIRE(getCall(*M, "f", "_Z15capeArenaMallocim"));
+    REQUIRE(M->getFunction("_Z15insertMallocSetiiPv")->use_empty());
+
+    // the table of allocator functions and the address in @B
+    auto *table = cast<ConstantStruct>(M->getNamedGlobal("A")->getInitializer());
+    REQUIRE(table->getOperand(0)->stripPointerCasts() == arenaFree);
+    REQUIRE(M->getNamedGlobal("B")->getInitializer()->stripPointerCasts() == arenaFree);
+
+    // the runtime itself falls back to libc
+    REQUIRE(getCall(*M, "_Z13capeArenaFreePv", "free"));
+    REQUIRE(M->getFunction("free")->hasOneUse());
+}
+
+// The marking passes of llvm-dg-dump from the secret global, then the plan
+static void markSecret(Module &M, const dg::CapeOptions &opts) {
+    GlobalVariable *secret = nullptr;
+    for (GlobalVariable &GV : M.globals())
+        if (GV.hasAttribute("secret"))
+            secret = &GV;
+    REQUIRE(secret);
+
+    LLVMDependenceGraphBuilder builder(&M);
+    auto dg = builder.build();
+    REQUIRE(dg);
+    std::set<dg::LLVMNode *> callsites;
+    dg->getSecretNodes(secret, &callsites);
+    REQUIRE(!callsites.empty());
+
+    LLVMSlicer slicer;
+    slicer.setCapeOptions(opts);
+    auto *pta = builder.getPTA();
+    uint32_t slid = 0;
+    uint16_t buff_id = 0;
+    for (dg::LLVMNode *start : callsites) {
+        buff_id = slicer.mark(start, pta, slid, true);
+        buff_id = slicer.mark(start, pta, slid, true, 1, buff_id);
+        buff_id = slicer.mark(start, pta, slid, true, 2, buff_id, dg->getAllFreeCalls());
+    }
+    applyPlan(slicer.getPlan());
+    REQUIRE(!verifyModule(M, &errs()));
+}
+
+static std::vector<CallInst *> getCalls(Function *F, const char *callee) {
+    std::vector<CallInst *> calls;
+    for (Instruction &I : instructions(F))
+        if (auto *CI = dyn_cast<CallInst>(&I))
+            if (CI->getCalledFunction() && CI->getCalledFunction()->getName() == callee)
+                calls.push_back(CI);
+    return calls;
+}
+
+static std::string getStringArg(CallInst *CI, unsigned i) {
+    auto *GV = cast<GlobalVariable>(CI->getArgOperand(i)->stripPointerCasts());
+    return cast<ConstantDataSequential>(GV->getInitializer())->getAsCString().str();
+}
+
+TEST_CASE("Preloading the code of a transaction block by block", "[cape][blocks]") {
+    LLVMContext ctx;
+    auto M = loadModule(ctx, "block-preload.ll");
+    Function *main = M->getFunction("main");
+    dg::CapeOptions opts;
+    opts.quiet = true;
+
+    SECTION("every block of the region once") {
+        opts.blockCodePreload = true;
+        markSecret(*M, opts);
+        REQUIRE(getCalls(main, "_Z16startTransactionv").size() == 1);
+
+        // the block by its start, with its end
+        std::map<Value *, Value *> blocks;
+        for (CallInst *CI : getCalls(main, "_Z16preloadBlockAddrPcPvS0_")) {
+            REQUIRE(getStringArg(CI, 0) == "main");
+            Value *bstart = CI->getArgOperand(1)->stripPointerCasts();
+            REQUIRE(blocks.emplace(bstart, CI->getArgOperand(2)).second);
+        }
+        REQUIRE(blocks.size() == 4);
+
+        auto getBlock = [&](const char *name) -> BasicBlock * {
+            for (BasicBlock &B : *main)
+                if (B.getName() == name)
+                    return &B;
+            return nullptr;
+        };
+        // the entry block starts where the function starts
+        REQUIRE(blocks.count(main));
+        REQUIRE(blocks[main] == BlockAddress::get(main, getBlock("then")));
+        REQUIRE(blocks[BlockAddress::get(main, getBlock("then"))] ==
+                BlockAddress::get(main, getBlock("else")));
+        REQUIRE(blocks.count(BlockAddress::get(main, getBlock("else"))));
+        // the last block ends where the function ends (see preloadBlockAddr)
+        Value *join = BlockAddress::get(main, getBlock("join"));
+        REQUIRE(blocks.count(join));
+        REQUIRE(isa<ConstantPointerNull>(blocks[join]));
+
+        // the callee as a whole
+        auto code = getCalls(main, "_Z15preloadInstAddrPc");
+        REQUIRE(code.size() == 1);
+        REQUIRE(getStringArg(code[0], 0) == "ext");
+    }
+
+    SECTION("the whole function without -bb-preload") {
+        markSecret(*M, opts);
+        REQUIRE(getCalls(main, "_Z16preloadBlockAddrPcPvS0_").empty());
+        std::set<std::string> code;
+        for (CallInst *CI : getCalls(main, "_Z15preloadInstAddrPc"))
+            REQUIRE(code.insert(getStringArg(CI, 0)).second);
+        REQUIRE(code == std::set<std::string>{"main", "ext"});
+    }
+}
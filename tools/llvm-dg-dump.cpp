@@ -2,14 +2,25 @@
 #error "This code needs LLVM enabled"
 #endif
 
+#include <algorithm>
+#include <chrono>
 #include <fstream>
 #include <iostream>
+#include <map>
 #include <set>
 #include <sstream>
 #include <string>
+#include <vector>
 
 #include <cassert>
+#include <cerrno>
+#include <cstdint>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <sys/wait.h>
+#include <unistd.h>
 
 // ignore unused parameters in LLVM libraries
 #if (__clang__)
@@ -24,6 +35,8 @@
 #include <llvm/IR/LLVMContext.h>
 #include <llvm/IR/Module.h>
 #include <llvm/IRReader/IRReader.h>
+#include <llvm/Support/Format.h>
+#include <llvm/Support/MathExtras.h>
 #include <llvm/Support/SourceMgr.h>
 #include <llvm/Support/raw_os_ostream.h>
 
@@ -51,120 +64,123 @@
 #include "dg/llvm/LLVMDG2Dot.h"
 
 #include "dg/llvm/PointerAnalysis/PointerAnalysis.h"
+#include "dg/llvm/Cape/AnalysisCache.h"
+#include "dg/llvm/Cape/CapeOptions.h"
+#include "dg/llvm/Cape/Cloak.h"
+#include "dg/llvm/Cape/CodeLayout.h"
+#include "dg/llvm/Cape/GlobalsLayout.h"
+#include "dg/llvm/Cape/HeapArena.h"
+#include "dg/llvm/Cape/Hoisting.h"
+#include "dg/llvm/Cape/IfConversion.h"
+#include "dg/llvm/Cape/Plan.h"
+#include "dg/llvm/Cape/PreloadBounds.h"
+#include "dg/llvm/Cape/Profile.h"
+#include "dg/llvm/Cape/SecretAnnotations.h"
+#include "dg/llvm/Cape/SecretScope.h"
+#include "dg/llvm/Cape/Stats.h"
+#include "dg/llvm/Cape/WarmUp.h"
+#include "dg/llvm/Cape/WholeProgram.h"
 
 #include "TimeMeasure.h"
 
 using namespace dg;
 using namespace llvm;
 
-int main(int argc, char *argv[]) {
+// the options of llvm-dg-dump, the same for every module
+struct DumpOptions {
+    bool mark_only{false};
+    bool bb_only{false};
+    bool threads{false};
+    const char *slicing_criterion{nullptr};
+    const char *dump_func_only{nullptr};
+    const char *pts{"fi"};
+    const char *entry_func{"main"};
+    LLVMControlDependenceAnalysisOptions::CDAlgorithm cd_alg{
+        LLVMControlDependenceAnalysisOptions::CDAlgorithm::STANDARD};
+
+    bool cloak{false};
+    // the modules are the units of one program
+    bool link{false};
+    CapeOptions cape_opts;
+    const char *stats_file{nullptr};
+    const char *cache_file{nullptr};
+    // dump the instrumentation plan, or apply one instead of the analysis
+    const char *plan_file{nullptr};
+    const char *apply_plan_file{nullptr};
+
+    uint32_t opts{debug::PRINT_CFG | debug::PRINT_DD | debug::PRINT_CD |
+                  debug::PRINT_USE | debug::PRINT_ID};
+};
+
+// Analyze and instrument one module (in its own context, so that more
+// modules can be analyzed at once), or the program linked from the units
+// (-link). The phases go to st if it is set.
+static int dumpModule(const std::vector<const char *> &units,
+                      const DumpOptions &dump, llvmdg::CapeStats *st) {
+    using namespace debug;
+
+    const char *module = units[0];
     llvm::Module *M;
     llvm::LLVMContext context;
     llvm::SMDiagnostic SMD;
-    bool mark_only = false;
-    bool bb_only = false;
-    bool threads = false;
-    const char *module = nullptr;
-    const char *slicing_criterion = nullptr;
-    const char *dump_func_only = nullptr;
-    const char *pts = "fi";
-    const char *entry_func = "main";
-    LLVMControlDependenceAnalysisOptions::CDAlgorithm cd_alg =
-        LLVMControlDependenceAnalysisOptions::CDAlgorithm::STANDARD;
-
-    bool cloak = false;
-
-    using namespace debug;
-    uint32_t opts = PRINT_CFG | PRINT_DD | PRINT_CD | PRINT_USE | PRINT_ID;
-
-    // parse options
-    for (int i = 1; i < argc; ++i) {
-        if (strcmp(argv[i], "-no-control") == 0) {
-            opts &= ~PRINT_CD;
-        } else if (strcmp(argv[i], "-no-use") == 0) {
-            opts &= ~PRINT_USE;
-        } else if (strcmp(argv[i], "-pta") == 0) {
-            pts = argv[++i];
-            /*
-        } else if (strcmp(argv[i], "-dda") == 0) {
-            dda = argv[++i];
-        */
-        } else if (strcmp(argv[i], "-no-data") == 0) {
-            opts &= ~PRINT_DD;
-        } else if (strcmp(argv[i], "-no-cfg") == 0) {
-            opts &= ~PRINT_CFG;
-        } else if (strcmp(argv[i], "-call") == 0) {
-            opts |= PRINT_CALL;
-        } else if (strcmp(argv[i], "-postdom") == 0) {
-            opts |= PRINT_POSTDOM;
-        } else if (strcmp(argv[i], "-bb-only") == 0) {
-            bb_only = true;
-        } else if (strcmp(argv[i], "-cfgall") == 0) {
-            opts |= PRINT_CFG;
-            opts |= PRINT_REV_CFG;
-        } else if (strcmp(argv[i], "-func") == 0) {
-            dump_func_only = argv[++i];
-        } else if (strcmp(argv[i], "-slice") == 0) {
-            slicing_criterion = argv[++i];
-        } else if (strcmp(argv[i], "-mark") == 0) {
-            mark_only = true;
-            slicing_criterion = argv[++i];
-        } else if (strcmp(argv[i], "-threads") == 0) {
-            threads = true;
-        } else if (strcmp(argv[i], "-entry") == 0) {
-            entry_func = argv[++i];
-        } else if (strcmp(argv[i], "-cd-alg") == 0) {
-            const char *arg = argv[++i];
-            if (strcmp(arg, "standard") == 0)
-                cd_alg = LLVMControlDependenceAnalysisOptions::CDAlgorithm::STANDARD;
-            else if (strcmp(arg, "classic") == 0)
-                cd_alg = LLVMControlDependenceAnalysisOptions::CDAlgorithm::STANDARD;
-            else if (strcmp(arg, "ntscd") == 0)
-                cd_alg = LLVMControlDependenceAnalysisOptions::CDAlgorithm::NTSCD;
-            else {
-                errs() << "Invalid control dependencies algorithm, try: classic, ce\n";
-                abort();
-            }
-
-        } else if (strcmp(argv[i], "-cloak") == 0) {
-            cloak = true;
-        } else {
-            module = argv[i];
-        }
-    }
-
-    if (!module) {
-        errs() << "Usage: % IR_module [output_file]\n";
-        return 1;
+    // the secrets switch to marking and ignore the slicing criterion
+    bool mark_only = dump.mark_only;
+    const char *slicing_criterion = dump.slicing_criterion;
+    const CapeOptions &cape_opts = dump.cape_opts;
+
+    if (st) {
+        st->setInfo("module", module);
+        if (units.size() > 1)
+            st->setCount("units", units.size());
+        st->setInfo("pta", dump.pts);
+        st->setInfo("entry", dump.entry_func);
     }
 
+    if (st)
+        st->begin("parse");
+    std::unique_ptr<llvm::Module> _M;
+    if (units.size() > 1) {
+        _M = llvmdg::linkUnits(context, {units.begin(), units.end()});
+        if (!_M)
+            return 1;
+        M = _M.get();
+    } else {
 #if ((LLVM_VERSION_MAJOR == 3) && (LLVM_VERSION_MINOR <= 5))
-    M = llvm::ParseIRFile(module, SMD, context);
+        M = llvm::ParseIRFile(module, SMD, context);
 #else
-    auto _M = llvm::parseIRFile(module, SMD, context);
-    // _M is unique pointer, we need to get Module *
-    M = _M.get();
+        _M = llvm::parseIRFile(module, SMD, context);
+        // _M is unique pointer, we need to get Module *
+        M = _M.get();
 #endif
+    }
+    if (st)
+        st->end("parse");
 
     if (!M) {
         llvm::errs() << "Failed parsing '" << module << "' file:\n";
-        SMD.print(argv[0], errs());
+        SMD.print("llvm-dg-dump", errs());
+        return 1;
+    }
+
+    if (!M->getFunction(dump.entry_func)) {
+        llvm::errs() << "The entry function '" << dump.entry_func
+                     << "' not found in '" << module << "'\n";
         return 1;
     }
 
     llvmdg::LLVMDependenceGraphOptions options;
 
-    options.CDAOptions.algorithm = cd_alg;
-    options.threads = threads;
-    options.PTAOptions.threads = threads;
-    options.DDAOptions.threads = threads;
-    options.PTAOptions.entryFunction = entry_func;
-    options.DDAOptions.entryFunction = entry_func;
-    if (strcmp(pts, "fs") == 0) {
+    options.CDAOptions.algorithm = dump.cd_alg;
+    options.threads = dump.threads;
+    options.PTAOptions.threads = dump.threads;
+    options.DDAOptions.threads = dump.threads;
+    options.PTAOptions.entryFunction = dump.entry_func;
+    options.DDAOptions.entryFunction = dump.entry_func;
+    if (strcmp(dump.pts, "fs") == 0) {
         options.PTAOptions.analysisType = LLVMPointerAnalysisOptions::AnalysisType::fs;
-    } else if (strcmp(pts, "fi") == 0) {
+    } else if (strcmp(dump.pts, "fi") == 0) {
         options.PTAOptions.analysisType = LLVMPointerAnalysisOptions::AnalysisType::fi;
-    } else if (strcmp(pts, "inv") == 0) {
+    } else if (strcmp(dump.pts, "inv") == 0) {
         options.PTAOptions.analysisType = LLVMPointerAnalysisOptions::AnalysisType::inv;
     } else {
         llvm::errs() << "Unknown points to analysis, try: fs, fi, inv\n";
@@ -177,17 +193,20 @@ int main(int argc, char *argv[]) {
         for (unsigned int i = 0; i < a->getNumOperands(); i++) {
             auto e = llvm::dyn_cast<llvm::ConstantStruct>(a->getOperand(i));
 
+            auto anno = llvm::dyn_cast<llvm::ConstantDataArray>(
+                            llvm::dyn_cast<llvm::GlobalVariable>(e->getOperand(1)->getOperand(0))->getOperand(0))
+                            ->getAsCString();
             if (auto glb = llvm::dyn_cast<llvm::GlobalVariable>(e->getOperand(0)->getOperand(0))) {
-                auto anno = llvm::dyn_cast<llvm::ConstantDataArray>(
-                                llvm::dyn_cast<llvm::GlobalVariable>(e->getOperand(1)->getOperand(0))->getOperand(0))
-                                ->getAsCString();
                 glb->addAttribute(anno); // <-- add function annotation here
+            } else if (auto fun = llvm::dyn_cast<llvm::Function>(e->getOperand(0)->getOperand(0))) {
+                // e.g., "cloak" for the functions that -cloak runs in transactions
+                fun->addFnAttr(anno);
             }
         }
     }
 
     auto sec = new llvm::StringRef("secret");
-    llvm::Value *secret_vl;
+    llvm::Value *secret_vl = nullptr;
     for (auto I = M->global_begin(), E = M->global_end(); I != E; ++I) {
         if (I->hasAttribute(*sec)) {
             // *(new StringRef("secret")))
@@ -196,22 +215,110 @@ int main(int argc, char *argv[]) {
             secret_vl = &(*I);
         }
     }
+    // the secret locals, fields and parameters
+    std::vector<llvm::Value *> secret_annos = llvmdg::findSecretAnnotations(*M);
+    if (!secret_annos.empty())
+        mark_only = true;
+    if (st)
+        st->setCount("annotated_secrets", secret_annos.size());
+    const bool has_secret = secret_vl || !secret_annos.empty();
+
+    // small secret-dependent branches need no transaction
+    if (cape_opts.ifConvert) {
+        llvmdg::CapeStats::Scope phase(st, "if-convert");
+        llvmdg::convertSecretBranches(*M, cape_opts);
+    }
 
     llvmdg::LLVMDependenceGraphBuilder builder(M, options);
-    auto dg = builder.build();
+    if (st) {
+        builder.setPhaseCallback([st](const char *phase, bool end) {
+            if (end)
+                st->end(phase);
+            else
+                st->begin(phase);
+        });
+    }
+    // what the previous runs learned about the functions (-cache)
+    llvmdg::AnalysisCache cache;
+    const bool useCache = dump.cache_file && has_secret && !dump.cloak;
+    if (useCache) {
+        std::string key = std::string(module) + " pta=" + dump.pts +
+                          " entry=" + dump.entry_func + " cd-alg=" +
+                          std::to_string(static_cast<int>(dump.cd_alg)) +
+                          (dump.threads ? " threads" : "");
+        if (!cache.load(dump.cache_file, key))
+            return 1;
+    }
+
+    std::unique_ptr<LLVMDependenceGraph> dg;
+    if (dump.apply_plan_file) {
+        // the decisions of an earlier run, without the analysis
+        llvmdg::CapeStats::Scope phase(st, "apply");
+        llvmdg::InstrumentationPlan plan;
+        if (!llvmdg::readPlan(*M, dump.apply_plan_file, plan))
+            return 1;
+        unsigned funcs = llvmdg::applyPlan(plan);
+        if (st) {
+            st->setCount("plan_actions", plan.size());
+            st->setCount("plan_functions", funcs);
+        }
+    } else if ((cape_opts.secretScope || useCache) && has_secret && !dump.cloak) {
+        // the graph only for the functions that the secret can reach
+        const Function *entry = M->getFunction(dump.entry_func);
+        dg = builder.build([&](LLVMPointerAnalysis *PTA) {
+            std::set<const Function *> scope;
+            if (useCache)
+                scope = cache.getScope(PTA, entry);
+            if (cape_opts.secretScope) {
+                auto secretScope = llvmdg::getSecretScope(*M, PTA, entry);
+                if (!useCache)
+                    return secretScope;
+                // both contain what the graph needs
+                std::set<const Function *> both;
+                for (const Function *F : scope) {
+                    if (secretScope.count(F) > 0)
+                        both.insert(F);
+                }
+                scope.swap(both);
+            }
+            return scope;
+        });
+
+        if (useCache) {
+            unsigned total = cache.getHits() + cache.getMisses();
+            if (!cape_opts.quiet)
+                errs() << "analysis cache: " << cache.getHits() << " of " << total
+                       << " functions reused\n";
+            if (st) {
+                st->setCount("cache_hits", cache.getHits());
+                st->setCount("cache_misses", cache.getMisses());
+                st->setInfo("cache_hit_rate",
+                            std::to_string(total ? 100 * cache.getHits() / total : 0) + "%");
+            }
+        }
+    } else {
+        if (cape_opts.secretScope || dump.cache_file)
+            errs() << "WARNING: -secret-scope and -cache need a secret and no -cloak, "
+                   << "building the whole graph\n";
+        dg = builder.build();
+    }
 
     std::set<LLVMNode *> callsites;
-    // const std::vector<LLVMNode *> *txnStartCallsites;
-    // const std::set<LLVMBBlock *> *txnEndCallBlocks;
-    if (secret_vl) {
-        dg->getSecretNodes(secret_vl, &callsites);
+    if (dg && has_secret) {
+        // only the accesses of the field bytes are accesses of the secret
+        unsigned fieldObjs = llvmdg::addSecretFieldBytes(*M, builder.getPTA(), secret_annos);
+        if (st)
+            st->setCount("secret_field_objects", fieldObjs);
+        if (secret_vl)
+            dg->getSecretNodes(secret_vl, &callsites);
+        dg->getAnnotatedSecretNodes(secret_annos, &callsites);
         // Ignore slicing_criterion when performing secret slicing.
         slicing_criterion = "";
     }
-    if (cloak) {
-        // txnStartCallsites = getTxnBeginCallNodes();
-        // txnEndCallBlocks = getTxnEndCallBlocks();
-    } else if (slicing_criterion) {
+    if (dump.cloak) {
+        // Cloak puts transactions around the annotated calls instead
+        mark_only = true;
+    } else if (dg && slicing_criterion) {
         const char *sc[] = {
             slicing_criterion,
             "klee_assume",
@@ -220,11 +327,16 @@ int main(int argc, char *argv[]) {
         dg->getCallSites(sc, &callsites);
     }
 
-    if (slicing_criterion || secret_vl || cloak) {
+    if (dg && (slicing_criterion || has_secret || dump.cloak)) {
         llvmdg::LLVMSlicer slicer;
-
-        if (cloak) {
-            // slicer.markPreloadingBlocks(txnStartCallsites, txnEndCallBlocks);
+        slicer.setCapeOptions(cape_opts);
+
+        if (dump.cloak) {
+            if (!cape_opts.quiet)
+                llvm::outs() << "[";
+            llvmdg::CapeStats::Scope phase(st, "cloak");
+            if (llvmdg::addCloakTransactions(*M, builder.getPTA()) == 0)
+                errs() << "WARNING: -cloak found no calls of functions annotated \"cloak\"\n";
         } else if (strcmp(slicing_criterion, "ret") == 0) {
             if (mark_only)
                 slicer.mark(dg->getExit());
@@ -234,27 +346,76 @@ int main(int argc, char *argv[]) {
             if (callsites.empty()) {
                 errs() << "ERR: slicing criterion not found: "
                        << slicing_criterion << "\n";
-                exit(1);
+                return 1;
             }
-            llvm::outs() << "[";
+            if (!cape_opts.quiet)
+                llvm::outs() << "[";
             uint32_t slid = 0;
             uint16_t buff_id = 0;
+            uint16_t max_buff_id = 0;
             auto *pta = builder.getPTA();
+            std::unique_ptr<llvmdg::PreloadBounds> bounds;
+            if (cape_opts.boundPreloads) {
+                llvmdg::CapeStats::Scope phase(st, "bounds");
+                bounds.reset(new llvmdg::PreloadBounds(*M));
+                if (!bounds->hasRelations())
+                    errs() << "WARNING: -bound-preloads: no value relations for this module, "
+                           << "bounding the indices by their known bits only\n";
+                slicer.setPreloadBounds(bounds.get());
+            }
             for (LLVMNode *start : callsites) {
+                if (st)
+                    st->begin("mark-0");
                 buff_id = slicer.mark(start, pta, slid, true);
+                if (st)
+                    st->end("mark-0");
                 //errs() << "second pass\n";
                 // second pass: identify secret-dependent accesses and add transations
                 //errs() << "buff_id before: "
                 //       << buff_id << "\n";
 #ifndef _DEBUG_
+                if (st)
+                    st->begin("mark-1");
                 buff_id = slicer.mark(start, pta, slid, true, 1, buff_id);
+                if (st)
+                    st->end("mark-1");
                 //errs() << "third pass\n";
                 //errs() << "buff_id after: "
                 //       << buff_id << "\n";
-                buff_id = slicer.mark(start, pta, slid, true, 2, buff_id, getAllFreeCalls());
+                if (st)
+                    st->begin("mark-2");
+                buff_id = slicer.mark(start, pta, slid, true, 2, buff_id, dg->getAllFreeCalls());
+                if (st)
+                    st->end("mark-2");
 #endif
                 //errs() << "buff_id final: "
                 //       << buff_id << "\n";
+                max_buff_id = std::max(max_buff_id, buff_id);
+            }
+            if (st) {
+                // the marking passes number the buffers from 1
+                st->setCount("buffer_ids", max_buff_id);
+                st->setCount("slicing_criteria", callsites.size());
+            }
+
+            // the marking only planned the instrumentation
+            const llvmdg::InstrumentationPlan &plan = slicer.getPlan();
+            if (dump.plan_file && !llvmdg::writePlan(dump.plan_file, plan))
+                return 1;
+            unsigned funcs;
+            {
+                llvmdg::CapeStats::Scope phase(st, "apply");
+                funcs = llvmdg::applyPlan(plan);
+            }
+            if (st) {
+                st->setCount("plan_actions", plan.size());
+                st->setCount("plan_functions", funcs);
+                if (bounds) {
+                    unsigned bounded = 0;
+                    for (const auto &A : plan.getActions())
+                        bounded += A.length != 0;
+                    st->setCount("bounded_preloads", bounded);
+                }
             }
 
             if (!mark_only)
@@ -280,24 +441,430 @@ int main(int argc, char *argv[]) {
     }
 
 #if 1
-    llvm::outs() << "]";
+    if (!cape_opts.quiet)
+        llvm::outs() << "]";
+    if (useCache) {
+        // the marked nodes, before the passes below change the code
+        cache.update(dg.get());
+        if (!cache.save(dump.cache_file))
+            return 1;
+    }
+    if (cape_opts.hoist && !dg) {
+        errs() << "WARNING: -hoist needs the graph, not hoisting with -apply-plan\n";
+    } else if (cape_opts.hoist) {
+        llvmdg::CapeStats::Scope phase(st, "hoist");
+        const auto &CF = dg->getConstructedFunctions();
+        llvmdg::hoistOutOfTransactions(*M, [&CF](const Instruction *I) {
+            auto *node = findInstruction(const_cast<Instruction *>(I), CF);
+            return node && node->getSlice() != 0;
+        });
+    }
+    // the sites that pay off to warm up, all without a profile
+    std::set<unsigned> warm_sites;
+    if (!cape_opts.profileUse.empty()) {
+        llvmdg::CapeStats::Scope phase(st, "profile-use");
+        llvmdg::Profile profile;
+        for (const std::string &file : cape_opts.profileUse) {
+            if (!llvmdg::readProfile(file, profile))
+                return 1;
+        }
+        warm_sites = llvmdg::applyProfile(*M, profile, cape_opts);
+    }
+    if (cape_opts.heapArena) {
+        llvmdg::CapeStats::Scope phase(st, "heap-arena");
+        unsigned num = llvmdg::redirectSensitiveMallocs(*M);
+        if (!cape_opts.quiet)
+            errs() << "redirected " << num << " malloc sites to arenas\n";
+        if (st)
+            st->setCount("arena_sites", num);
+    }
+    if (cape_opts.warmUp || !cape_opts.profileUse.empty()) {
+        llvmdg::CapeStats::Scope phase(st, "warm-up");
+        llvmdg::addWarmUp(*M, cape_opts.profileUse.empty() ? nullptr : &warm_sites);
+    }
+    if (cape_opts.profileGen) {
+        llvmdg::CapeStats::Scope phase(st, "profile-gen");
+        llvmdg::addProfiling(*M);
+    }
+    if (cape_opts.clusterCode) {
+        llvmdg::CapeStats::Scope phase(st, "code-layout");
+        llvmdg::clusterTransactionalCode(*M, cape_opts);
+    }
+    if (cape_opts.packGlobals) {
+        llvmdg::CapeStats::Scope phase(st, "pack-globals");
+        llvmdg::packPreloadedGlobals(*M, cape_opts);
+    }
+
+    if (units.size() > 1) {
+        llvmdg::CapeStats::Scope phase(st, "print");
+        unsigned written;
+        if (!llvmdg::writeUnits(*M, dump.entry_func, &written))
+            return 1;
+        if (st)
+            st->setCount("units_written", written);
+        if (!cape_opts.quiet)
+            llvm::errs() << "INFO: wrote " << written << " of " << units.size()
+                         << " units, the others did not change\n";
+        if (st)
+            st->countModule(*M);
+        return 0;
+    }
+
     string outName(module);
     outName += "_ac.ll";
     // std::error_code EC;
     // llvm::raw_fd_ostream out(outName, EC);
+    if (st)
+        st->begin("print");
     ofstream myfile;
     myfile.open(outName);
-    llvm::raw_os_ostream out(myfile);
-    M->print(out, nullptr);
+    {
+        llvm::raw_os_ostream out(myfile);
+        M->print(out, nullptr);
+    }
     myfile.close();
+    if (st)
+        st->end("print");
+
+    // after printing, getTransactionSites may number the sites
+    if (st)
+        st->countModule(*M);
 #else
-    if (bb_only) {
-        LLVMDGDumpBlocks dumper(dg.get(), opts);
-        dumper.dump(nullptr, dump_func_only);
+    if (dump.bb_only) {
+        LLVMDGDumpBlocks dumper(dg.get(), dump.opts);
+        dumper.dump(nullptr, dump.dump_func_only);
     } else {
-        LLVMDG2Dot dumper(dg.get(), opts);
-        dumper.dump(nullptr, dump_func_only);
+        LLVMDG2Dot dumper(dg.get(), dump.opts);
+        dumper.dump(nullptr, dump.dump_func_only);
     }
 #endif
-        return 0;
+    return 0;
+}
+
+struct DumpResult {
+    int status{1};
+    double seconds{0};
+    // what the module reported through the -stats file
+    unsigned long sites{0};
+    unsigned long preloads{0};
+    std::string report;
+    // written by the process of the module
+    FILE *out{nullptr};
+    std::chrono::steady_clock::time_point start;
+};
+
+// Analyze the module in a child process, which reports the numbers of
+// sites and preloads and then the -stats report of the module to out.
+// The static state of the analyses (e.g., the special nodes of the
+// pointer analysis) is per process, so the modules do not share it.
+static pid_t startModule(const char *module, const DumpOptions &dump, FILE *out) {
+    // do not let the child flush what the parent buffered
+    llvm::outs().flush();
+    llvm::errs().flush();
+
+    pid_t pid = fork();
+    if (pid != 0)
+        return pid;
+
+    llvmdg::CapeStats stats;
+    int status = dumpModule({module}, dump, &stats);
+    {
+        llvm::raw_fd_ostream os(fileno(out), false);
+        os << stats.getCount("transaction_sites") << " "
+           << stats.getCount("preload_calls") << "\n";
+        stats.writeJSON(os);
+    }
+    llvm::outs().flush();
+    llvm::errs().flush();
+    _exit(status);
+}
+
+static void readResult(DumpResult &res) {
+    rewind(res.out);
+    if (fscanf(res.out, "%lu %lu\n", &res.sites, &res.preloads) != 2) {
+        res.status = 1;
+    } else {
+        char buf[4096];
+        size_t n;
+        while ((n = fread(buf, 1, sizeof(buf), res.out)) > 0)
+            res.report.append(buf, n);
+    }
+    fclose(res.out);
+    res.out = nullptr;
+}
+
+// Analyze the modules in jobs processes at once (0 for all cores), print
+// a summary and write the reports of the modules into the -stats file.
+// A module that crashes fails alone. Returns non-zero if any of the
+// modules failed.
+static int dumpModules(const std::vector<const char *> &modules,
+                       DumpOptions dump, unsigned jobs) {
+    // the messages of the modules would interleave
+    dump.cape_opts.quiet = true;
+
+    if (jobs == 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        jobs = cores > 0 ? static_cast<unsigned>(cores) : 1;
+    }
+
+    std::vector<DumpResult> results(modules.size());
+    std::map<pid_t, size_t> running;
+    size_t next = 0;
+    while (next < modules.size() || !running.empty()) {
+        if (next < modules.size() && running.size() < jobs) {
+            DumpResult &res = results[next];
+            res.out = tmpfile();
+            if (!res.out) {
+                errs() << "ERROR: cannot create a temporary file for " << modules[next]
+                       << "\n";
+                ++next;
+                continue;
+            }
+            res.start = std::chrono::steady_clock::now();
+            pid_t pid = startModule(modules[next], dump, res.out);
+            if (pid < 0) {
+                errs() << "ERROR: cannot start the analysis of " << modules[next] << "\n";
+                fclose(res.out);
+                res.out = nullptr;
+            } else {
+                running[pid] = next;
+            }
+            ++next;
+            continue;
+        }
+
+        int wstatus;
+        pid_t pid = wait(&wstatus);
+        if (pid < 0)
+            break;
+        auto it = running.find(pid);
+        if (it == running.end())
+            continue;
+        DumpResult &res = results[it->second];
+        running.erase(it);
+
+        res.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                                    res.start)
+                          .count();
+        res.status = WIFEXITED(wstatus) ? WEXITSTATUS(wstatus) : 1;
+        if (WIFSIGNALED(wstatus))
+            errs() << "ERROR: the analysis of " << modules[it->second] << " crashed ("
+                   << strsignal(WTERMSIG(wstatus)) << ")\n";
+        readResult(res);
+    }
+
+    size_t width = strlen("module");
+    for (const char *module : modules)
+        width = std::max(width, strlen(module));
+
+    unsigned failed = 0;
+    llvm::outs() << left_justify("module", width) << "  status  time [s]"
+                 << "  sites  preloads\n";
+    for (size_t i = 0; i < modules.size(); ++i) {
+        const DumpResult &res = results[i];
+        if (res.status != 0)
+            ++failed;
+        llvm::outs() << left_justify(modules[i], width) << "  "
+                     << left_justify(res.status == 0 ? "ok" : "FAILED", 6)
+                     << format("  %8.2f", res.seconds);
+        if (res.status == 0)
+            llvm::outs() << format("  %5lu  %8lu", res.sites, res.preloads);
+        llvm::outs() << "\n";
+    }
+    llvm::outs() << modules.size() << " modules, " << failed << " failed\n";
+
+    if (dump.stats_file) {
+        std::ofstream ofs(dump.stats_file);
+        if (!ofs) {
+            errs() << "ERROR: cannot write statistics to " << dump.stats_file << "\n";
+            return 1;
+        }
+        llvm::raw_os_ostream out(ofs);
+        out << "[";
+        const char *sep = "\n";
+        for (const DumpResult &res : results) {
+            // a crashed module has no report
+            if (res.report.empty())
+                continue;
+            out << sep << res.report;
+            sep = ",\n";
+        }
+        out << "]\n";
+    }
+
+    return failed > 0 ? 1 : 0;
+}
+
+// Parse the positive number that follows the option argv[i].
+static bool parseCount(int argc, char *argv[], int &i, unsigned &value) {
+    const char *opt = argv[i];
+    if (++i >= argc) {
+        errs() << "ERROR: " << opt << " needs a number\n";
+        return false;
+    }
+
+    char *end;
+    errno = 0;
+    unsigned long num = strtoul(argv[i], &end, 10);
+    if (*argv[i] == '\0' || *argv[i] == '-' || *end != '\0' || errno != 0 ||
+        num == 0 || num > UINT32_MAX) {
+        errs() << "ERROR: " << opt << " needs a positive number, got '" << argv[i]
+               << "'\n";
+        return false;
+    }
+    value = static_cast<unsigned>(num);
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    DumpOptions dump;
+    std::vector<const char *> modules;
+    unsigned jobs = 0;
+
+    using namespace debug;
+
+    // parse options
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-no-control") == 0) {
+            dump.opts &= ~PRINT_CD;
+        } else if (strcmp(argv[i], "-no-use") == 0) {
+            dump.opts &= ~PRINT_USE;
+        } else if (strcmp(argv[i], "-pta") == 0) {
+            dump.pts = argv[++i];
+            /*
+        } else if (strcmp(argv[i], "-dda") == 0) {
+            dda = argv[++i];
+        */
+        } else if (strcmp(argv[i], "-no-data") == 0) {
+            dump.opts &= ~PRINT_DD;
+        } else if (strcmp(argv[i], "-no-cfg") == 0) {
+            dump.opts &= ~PRINT_CFG;
+        } else if (strcmp(argv[i], "-call") == 0) {
+            dump.opts |= PRINT_CALL;
+        } else if (strcmp(argv[i], "-postdom") == 0) {
+            dump.opts |= PRINT_POSTDOM;
+        } else if (strcmp(argv[i], "-bb-only") == 0) {
+            dump.bb_only = true;
+        } else if (strcmp(argv[i], "-cfgall") == 0) {
+            dump.opts |= PRINT_CFG;
+            dump.opts |= PRINT_REV_CFG;
+        } else if (strcmp(argv[i], "-func") == 0) {
+            dump.dump_func_only = argv[++i];
+        } else if (strcmp(argv[i], "-slice") == 0) {
+            dump.slicing_criterion = argv[++i];
+        } else if (strcmp(argv[i], "-mark") == 0) {
+            dump.mark_only = true;
+            dump.slicing_criterion = argv[++i];
+        } else if (strcmp(argv[i], "-threads") == 0) {
+            dump.threads = true;
+        } else if (strcmp(argv[i], "-entry") == 0) {
+            dump.entry_func = argv[++i];
+        } else if (strcmp(argv[i], "-cd-alg") == 0) {
+            const char *arg = argv[++i];
+            if (strcmp(arg, "standard") == 0)
+                dump.cd_alg = LLVMControlDependenceAnalysisOptions::CDAlgorithm::STANDARD;
+            else if (strcmp(arg, "classic") == 0)
+                dump.cd_alg = LLVMControlDependenceAnalysisOptions::CDAlgorithm::STANDARD;
+            else if (strcmp(arg, "ntscd") == 0)
+                dump.cd_alg = LLVMControlDependenceAnalysisOptions::CDAlgorithm::NTSCD;
+            else {
+                errs() << "Invalid control dependencies algorithm, try: classic, ce\n";
+                abort();
+            }
+
+        } else if (strcmp(argv[i], "-cloak") == 0) {
+            dump.cloak = true;
+        } else if (strcmp(argv[i], "-bb-preload") == 0) {
+            dump.cape_opts.blockCodePreload = true;
+        } else if (strcmp(argv[i], "-code-layout") == 0) {
+            dump.cape_opts.clusterCode = true;
+        } else if (strcmp(argv[i], "-pack-globals") == 0) {
+            dump.cape_opts.packGlobals = true;
+        } else if (strcmp(argv[i], "-data-align") == 0) {
+            dump.cape_opts.packGlobals = true;
+            if (!parseCount(argc, argv, i, dump.cape_opts.dataAlignment))
+                return 1;
+            if (!isPowerOf2_32(dump.cape_opts.dataAlignment)) {
+                errs() << "ERROR: -data-align needs a power of two, got "
+                       << dump.cape_opts.dataAlignment << "\n";
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-huge-pages") == 0) {
+            dump.cape_opts.packGlobals = true;
+            dump.cape_opts.hugePages = true;
+        } else if (strcmp(argv[i], "-warmup") == 0) {
+            dump.cape_opts.warmUp = true;
+        } else if (strcmp(argv[i], "-bound-preloads") == 0) {
+            dump.cape_opts.boundPreloads = true;
+        } else if (strcmp(argv[i], "-write-intent") == 0) {
+            dump.cape_opts.writeIntent = true;
+        } else if (strcmp(argv[i], "-if-convert") == 0) {
+            dump.cape_opts.ifConvert = true;
+        } else if (strcmp(argv[i], "-if-convert-max") == 0) {
+            dump.cape_opts.ifConvert = true;
+            if (!parseCount(argc, argv, i, dump.cape_opts.ifConvertMaxInsts))
+                return 1;
+        } else if (strcmp(argv[i], "-hoist") == 0) {
+            dump.cape_opts.hoist = true;
+        } else if (strcmp(argv[i], "-profile-gen") == 0) {
+            dump.cape_opts.profileGen = true;
+        } else if (strcmp(argv[i], "-profile-use") == 0) {
+            dump.cape_opts.profileUse.push_back(argv[++i]);
+        } else if (strcmp(argv[i], "-heap-arena") == 0) {
+            dump.cape_opts.heapArena = true;
+        } else if (strcmp(argv[i], "-secret-scope") == 0) {
+            dump.cape_opts.secretScope = true;
+        } else if (strcmp(argv[i], "-cache") == 0) {
+            dump.cache_file = argv[++i];
+        } else if (strcmp(argv[i], "-plan") == 0) {
+            dump.plan_file = argv[++i];
+        } else if (strcmp(argv[i], "-apply-plan") == 0) {
+            dump.apply_plan_file = argv[++i];
+        } else if (strcmp(argv[i], "-link") == 0) {
+            dump.link = true;
+        } else if (strcmp(argv[i], "-j") == 0) {
+            if (!parseCount(argc, argv, i, jobs))
+                return 1;
+        } else if (strcmp(argv[i], "-quiet") == 0) {
+            dump.cape_opts.quiet = true;
+        } else if (strcmp(argv[i], "-stats") == 0) {
+            // the counts replace the per-transaction messages
+            dump.cape_opts.quiet = true;
+            dump.stats_file = argv[++i];
+        } else {
+            modules.push_back(argv[i]);
+        }
+    }
+
+    if (modules.empty()) {
+        errs() << "Usage: % IR_module... [-j N | -link]\n";
+        return 1;
+    }
+
+    if (dump.link && jobs > 0) {
+        errs() << "-link analyzes one program, it cannot be used with -j\n";
+        return 1;
+    }
+    if (dump.apply_plan_file && (dump.plan_file || dump.cache_file || dump.cloak)) {
+        errs() << "-apply-plan skips the analysis, it cannot be used with "
+               << "-plan, -cache or -cloak\n";
+        return 1;
+    }
+    if (!dump.link && (modules.size() > 1 || jobs > 0)) {
+        if (dump.cache_file || dump.plan_file || dump.apply_plan_file) {
+            errs() << "-cache, -plan and -apply-plan are for one program, they cannot "
+                   << "be used with -j or more modules without -link\n";
+            return 1;
+        }
+        return dumpModules(modules, dump, jobs);
+    }
+
+    // the phases of the run, only with -stats
+    llvmdg::CapeStats stats;
+    llvmdg::CapeStats *st = dump.stats_file ? &stats : nullptr;
+    if (dumpModule(modules, dump, st) != 0)
+        return 1;
+    if (st && !stats.writeJSON(dump.stats_file))
+        return 1;
+    return 0;
 }
@@ -180,7 +180,7 @@ static void getLineCriteriaNodes(LLVMDependenceGraph& dg,
     llvm::errs() << "WARNING: The slicing criteria with variables names will not work\n";
 #else
     // create the mapping from LLVM values to C variable names
-    for (auto& it : getConstructedFunctions()) {
+    for (auto& it : dg.getConstructedFunctions()) {
         for (auto& I : llvm::instructions(*llvm::cast<llvm::Function>(it.first))) {
             if (const llvm::DbgDeclareInst *DD = llvm::dyn_cast<llvm::DbgDeclareInst>(&I)) {
                 auto val = DD->getAddress();
@@ -220,7 +220,7 @@ static void getLineCriteriaNodes(LLVMDependenceGraph& dg,
     }
 
     // map line criteria to nodes
-    for (auto& it : getConstructedFunctions()) {
+    for (auto& it : dg.getConstructedFunctions()) {
         for (auto& I : llvm::instructions(*llvm::cast<llvm::Function>(it.first))) {
             if (instMatchesCrit(dg, I, parsedCrit)) {
                 LLVMNode *nd = it.second->getNode(&I);
@@ -438,7 +438,8 @@ public:
             = new dg::debug::LLVMDGAssemblyAnnotationWriter(annotationOptions,
                                                             dg->getPTA(),
                                                             dg->getDDA(),
-                                                            criteria);
+                                                            criteria,
+                                                            dg);
         annot->emitModuleComment(std::move(module_comment));
         llvm::Module *M = dg->getModule();
         M->print(outputstream, annot);